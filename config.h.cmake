@@ -28,4 +28,7 @@
 /* Define to 1 if you have the `bzero' function. */
 #cmakedefine HAVE_BZERO 1 
 
+/* Define to 1 if you have the `mmap' function. */
+#cmakedefine HAVE_MMAP 1
+
 #endif /* end of include guard */
@@ -1,7 +1,7 @@
 #ifndef CNEZ_H
 #define CNEZ_H
 
-#include "libnez.h"
+#include "libnez/libnez.h"
 
 typedef struct ParsingContext {
     char *cur;
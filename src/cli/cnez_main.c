@@ -1,6 +1,7 @@
 #include <sys/time.h> // gettimeofday
 #include <unistd.h>
 #include <getopt.h>
+#include <inttypes.h>
 
 static uint64_t timer()
 {
@@ -36,6 +37,7 @@ static ParsingContext ParsingContext_init(ParsingContext ctx, unsigned flag_size
     ctx->input = ctx->cur = load_file(input, &input_size);
     ctx->memo  = memo_init(MOZ_MEMO_DEFAULT_WINDOW_SIZE, memo_size);
     ctx->ast   = AstMachine_init(128, ctx->input);
+    AstMachine_setTagList(ctx->ast, global_tag_list);
     ctx->table = symtable_init();
     ctx->input_size = input_size;
     ctx->flags_size = flag_size;
@@ -61,12 +63,12 @@ static void ParsingContext_dispose(ParsingContext ctx)
 static void ParsingContext_reset(ParsingContext ctx, unsigned flag_size, unsigned memo_size)
 {
     AstMachine_dispose(ctx->ast);
-    symtable_dispose(ctx->table);
+    symtable_reset(ctx->table);
     memo_dispose(ctx->memo);
     NodeManager_reset();
     ctx->memo  = memo_init(MOZ_MEMO_DEFAULT_WINDOW_SIZE, memo_size);
     ctx->ast   = AstMachine_init(128, ctx->input);
-    ctx->table = symtable_init();
+    AstMachine_setTagList(ctx->ast, global_tag_list);
     memset(ctx->flags, 0, sizeof(int) * flag_size);
 }
 
@@ -77,7 +79,7 @@ static void usage(const char *arg)
 
 int main(int argc, char* const argv[])
 {
-    uint64_t start, end, latency;
+    uint64_t start, end, latency = 0;
     struct ParsingContext lctx, *ctx;
 
     const char *input_file = NULL;
@@ -132,7 +134,7 @@ int main(int argc, char* const argv[])
             fprintf(stderr, "parse error\n");
             break;
         }
-        else if((ctx->cur - ctx->input) != ctx->input_size) {
+        else if((size_t)(ctx->cur - ctx->input) != ctx->input_size) {
             fprintf(stderr, "unconsume\n");
             break;
         }
@@ -154,7 +156,7 @@ int main(int argc, char* const argv[])
             NODE_GC_RELEASE(node);
 #endif
         ParsingContext_reset(ctx, CNEZ_FLAG_TABLE_SIZE, CNEZ_MEMO_SIZE);
-        fprintf(stderr, "ErapsedTime: %llu msec\n", end - start);
+        fprintf(stderr, "ErapsedTime: %" PRIu64 " msec\n", end - start);
         if(i == 0) {
             latency = end - start;
         }
@@ -162,6 +164,9 @@ int main(int argc, char* const argv[])
             latency = end - start;
         }
     }
+    if (print_stats) {
+        fprintf(stderr, "Latency: %" PRIu64 " msec\n", latency);
+    }
     ParsingContext_dispose(ctx);
     return 0;
 }
@@ -16,21 +16,108 @@ extern "C" {
 
 static void usage(const char *arg)
 {
-    fprintf(stderr, "Usage: %s -p <peg_file> -i <input_file>\n", arg);
+    fprintf(stderr, "Usage: %s -p <peg_file> -i <input_file> [-o <moz_file>] [-c <c_file>] [-b] [-w <prof_file>] [-r <prof_file>] [-t <phases>]\n", arg);
+    fprintf(stderr, "  -o <moz_file> : write the grammar as vm1 bytecode\n");
+    fprintf(stderr, "  -c <c_file>   : write the grammar as C source (see src/cli/cnez_main.c)\n");
+    fprintf(stderr, "  -b            : parse input_file with the vm1 engine\n");
+    fprintf(stderr, "  -w <prof_file>: write the choice profile of the parse (MOZVM_PROFILE_INST)\n");
+    fprintf(stderr, "  -r <prof_file>: reorder choice alternatives by a profile written by -w\n");
+    fprintf(stderr, "  -t <phases>   : dump compiler phases to stderr (ast,ir,link,code or all)\n");
+    fprintf(stderr, "  -i may be omitted when only -o or -c is given\n");
 }
 
-static int parse(moz_module_t *M, const char *input_file)
+static int write_bytecode(const char *moz_file, uint8_t *code, unsigned size)
+{
+    FILE *fp = fopen(moz_file, "wb");
+    int ok;
+    if (fp == NULL) {
+        return 0;
+    }
+    ok = fwrite(code, 1, size, fp) == size;
+    fclose(fp);
+    return ok;
+}
+
+static int write_csource(moz_runtime_t *R, Node *node, const char *c_file)
+{
+    FILE *fp = fopen(c_file, "w");
+    int ok;
+    if (fp == NULL) {
+        return 0;
+    }
+    ok = moz_compiler_compile_cnez(R, node, fp);
+    fclose(fp);
+    if (!ok) {
+        remove(c_file);
+    }
+    return ok;
+}
+
+static int parse_bytecode(uint8_t *code, unsigned size, const char *input_file)
+{
+    mozvm_loader_t L;
+    moz_inst_t *inst;
+    Node *node;
+    int result;
+
+    memset(&L, 0, sizeof(L));
+    if (!mozvm_loader_load_input_file(&L, input_file)) {
+        return 1;
+    }
+    inst = mozvm_loader_load_syntax(&L, code, size, 1);
+    if (inst == NULL) {
+        fprintf(stderr, "error: cannot load the generated bytecode\n");
+        if (L.R != NULL) {
+            moz_runtime_dispose(L.R);
+        }
+        mozvm_loader_dispose(&L);
+        return 1;
+    }
+    moz_runtime_set_source(L.R, L.input, L.input + L.input_size);
+    inst = moz_runtime_parse_init(L.R, L.input, inst);
+    result = moz_runtime_parse(L.R, L.input, inst);
+    node = ast_get_parsed_node(L.R->ast);
+    if (node != NULL) {
+        Node_print(node, L.R->C.tags);
+        NODE_GC_RELEASE(node);
+    }
+    moz_runtime_dispose(L.R);
+    mozvm_loader_dispose(&L);
+    return result;
+}
+
+static int write_profile(moz_module_t *M, const char *prof_file)
+{
+    FILE *fp = fopen(prof_file, "w");
+    int ok;
+    if (fp == NULL) {
+        return 0;
+    }
+    ok = moz_vm2_module_write_profile(M, fp);
+    fclose(fp);
+    if (!ok) {
+        remove(prof_file);
+    }
+    return ok;
+}
+
+static int parse(moz_module_t *M, const char *input_file, const char *prof_file)
 {
     size_t input_size = 0;
     char *input = (char *)load_file(input_file, &input_size, 32);
     int result;
     Node *node = NULL;
-    M->dump(M);
+    if (moz_compiler_trace & MOZ_TRACE_CODE) {
+        M->dump(M);
+    }
     result = M->parse(M, input, input_size, &node);
     if (node != NULL) {
         Node_print(node, M->runtime->C.tags);
         NODE_GC_RELEASE(node);
     }
+    if (prof_file != NULL && !write_profile(M, prof_file)) {
+        fprintf(stderr, "warning: no choice profile written (build with MOZVM_PROFILE_INST)\n");
+    }
     M->dispose(M);
     return result;
 }
@@ -40,13 +127,19 @@ struct parse_result {
     int parsed;
 };
 
-static int run(const char *peg_file, const char *input_file, struct parse_result *result)
+static int run(const char *peg_file, const char *input_file,
+        const char *moz_file, const char *c_file, int use_vm1,
+        const char *prof_out, const char *prof_in,
+        struct parse_result *result)
 {
     mozvm_loader_t L;
     moz_inst_t *inst;
     Node *node;
+    FILE *profile = NULL;
+    uint8_t *code = NULL;
+    unsigned code_size = 0;
 
-    if (input_file == NULL) {
+    if (input_file == NULL && moz_file == NULL && c_file == NULL) {
         result->error = "input_file is null. Please specify input file name";
         result->parsed = 0;
         return 1;
@@ -80,9 +173,50 @@ static int run(const char *peg_file, const char *input_file, struct parse_result
         result->parsed = 0;
         goto L_finally;
     }
-    moz_module_t *M = moz_compiler_compile(L.R, node);
+    if (c_file != NULL && !write_csource(L.R, node, c_file)) {
+        NODE_GC_RELEASE(node);
+        result->error = "Failed to write C source (unsupported grammar?)";
+        result->parsed = 0;
+        goto L_finally;
+    }
+    if (moz_file != NULL || use_vm1) {
+        code = moz_compiler_compile_bytecode(L.R, node, &code_size);
+        if (code == NULL) {
+            fprintf(stderr, "warning: grammar is not expressible in vm1 bytecode\n");
+        }
+    }
+    if (code != NULL && moz_file != NULL) {
+        if (!write_bytecode(moz_file, code, code_size)) {
+            NODE_GC_RELEASE(node);
+            result->error = "Failed to write moz file";
+            result->parsed = 0;
+            goto L_finally;
+        }
+    }
+    if (input_file == NULL) {
+        NODE_GC_RELEASE(node);
+        result->parsed = 1;
+        goto L_finally;
+    }
+    if (code != NULL && use_vm1) {
+        NODE_GC_RELEASE(node);
+        if (parse_bytecode(code, code_size, input_file) != 0) {
+            result->error = "Failed to parse input file";
+            result->parsed = 0;
+            goto L_finally;
+        }
+        result->parsed = 1;
+        goto L_finally;
+    }
+    if (prof_in != NULL && (profile = fopen(prof_in, "r")) == NULL) {
+        fprintf(stderr, "warning: cannot open %s, keeping source order\n", prof_in);
+    }
+    moz_module_t *M = moz_compiler_compile_profiled(L.R, node, profile);
+    if (profile != NULL) {
+        fclose(profile);
+    }
     NODE_GC_RELEASE(node);
-    if (parse(M, input_file) != 0) {
+    if (parse(M, input_file, prof_out) != 0) {
         result->error = "Failed to parse input file";
         result->parsed = 0;
         goto L_finally;
@@ -90,6 +224,9 @@ static int run(const char *peg_file, const char *input_file, struct parse_result
 
     result->parsed = 1;
 L_finally:
+    if (code != NULL) {
+        VM_FREE(code);
+    }
     moz_runtime_dispose(L.R);
     mozvm_loader_dispose(&L);
     NodeManager_dispose();
@@ -100,10 +237,15 @@ int main(int argc, char *const argv[])
 {
     const char *peg_file = NULL;
     const char *input_file = NULL;
+    const char *moz_file = NULL;
+    const char *c_file = NULL;
+    const char *prof_out = NULL;
+    const char *prof_in = NULL;
+    int use_vm1 = 0;
     struct parse_result result = {};
     int opt;
 
-    while ((opt = getopt(argc, argv, "p:i:h")) != -1) {
+    while ((opt = getopt(argc, argv, "p:i:o:c:bw:r:t:h")) != -1) {
         switch (opt) {
         case 'p':
             peg_file = optarg;
@@ -111,13 +253,36 @@ int main(int argc, char *const argv[])
         case 'i':
             input_file = optarg;
             break;
+        case 'o':
+            moz_file = optarg;
+            break;
+        case 'c':
+            c_file = optarg;
+            break;
+        case 'b':
+            use_vm1 = 1;
+            break;
+        case 'w':
+            prof_out = optarg;
+            break;
+        case 'r':
+            prof_in = optarg;
+            break;
+        case 't':
+            if (!moz_compiler_parse_trace(optarg, &moz_compiler_trace)) {
+                fprintf(stderr, "unknown phase in '%s'\n", optarg);
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
         case 'h':
         default: /* '?' */
             usage(argv[0]);
             exit(EXIT_FAILURE);
         }
     }
-    if (run(peg_file, input_file, &result) == 0) {
+    if (run(peg_file, input_file, moz_file, c_file, use_vm1,
+                prof_out, prof_in, &result) == 0) {
         fprintf(stderr, "Error: %s\n", result.error);
     }
 }
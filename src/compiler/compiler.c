@@ -21,11 +21,14 @@ DEF_ARRAY_OP_NOPOINTER(expr_ptr_t);
 
 #define OPTIMIZE /*optimize annotation*/
 
+unsigned moz_compiler_trace = 0;
+
 typedef struct moz_state_t {
     struct block_t *head;
     struct block_t *cur;
     struct block_t *next;
     struct block_t *fail;
+    unsigned slots; /* enclosing IPStore slots that are still live */
 } moz_state_t;
 
 static unsigned moz_compiler_add_string_id(ARRAY(pstring_ptr_t) *ary, name_t *name)
@@ -98,6 +101,21 @@ static IR_t *_IR_ALLOC(size_t size, ir_type_t type, moz_state_t *S)
 #define IR_ALLOC(T, S)   _IR_ALLOC(sizeof(T##_t), T, S)
 #define IR_ALLOC_T(T, S) ((T##_t *) IR_ALLOC(T, S))
 
+static const unsigned IR_SIZE[] = {
+#define DEFINE_IR_SIZE(NAME) sizeof(NAME##_t),
+    FOR_EACH_IR(DEFINE_IR_SIZE)
+#undef DEFINE_IR_SIZE
+};
+
+static IR_t *moz_ir_clone(IR_t *ir, block_t *parent)
+{
+    IR_t *newir = (IR_t *)VM_MALLOC(IR_SIZE[ir->type]);
+    memcpy(newir, ir, IR_SIZE[ir->type]);
+    newir->id = _MAX_IR_ID++;
+    newir->parent = parent;
+    return newir;
+}
+
 static block_t *moz_compiler_create_named_block(moz_compiler_t *C, enum block_type type)
 {
     block_t *BB = block_new(type);
@@ -116,6 +134,7 @@ static void moz_state_init(moz_compiler_t *C, moz_state_t *S)
     S->next = moz_compiler_create_named_block(C, BLOCK_EXIT);
     S->fail = moz_compiler_create_named_block(C, BLOCK_FAIL);
     S->cur = S->head;
+    S->slots = 0;
 }
 
 static void moz_state_copy(moz_state_t *dst, moz_state_t *src)
@@ -124,6 +143,7 @@ static void moz_state_copy(moz_state_t *dst, moz_state_t *src)
     dst->cur  = src->cur;
     dst->next = src->next;
     dst->fail = src->fail;
+    dst->slots = src->slots;
 }
 
 static void moz_compiler_set_label(moz_compiler_t *C, moz_state_t *S, block_t *BB)
@@ -198,6 +218,156 @@ static void moz_Set_to_ir(moz_compiler_t *C, moz_state_t *S, Set_t *e)
     moz_compiler_add(C, S, (IR_t *)ir);
 }
 
+/*
+ * Group input bytes by the alternatives that may succeed on them. Returns
+ * the number of groups, or 0 if the choice is not worth a table dispatch:
+ * every byte sees the same alternatives, there are more groups than a
+ * jump table holds, or the groups overlap so much that duplicating the
+ * shared alternatives would more than double the code.
+ */
+unsigned moz_Choice_predict(Choice_t *e,
+        uint64_t *masks, uint8_t jumps[256])
+{
+    unsigned i, k, c, n = 0, emitted = 0;
+    unsigned size = ARRAY_size(e->list);
+    bitset_t first[size + 1];
+    expr_t **x;
+
+    if (size < 2 || size > 64) {
+        return 0;
+    }
+    FOR_EACH_ARRAY_(e->list, x, i) {
+        moz_expr_first_set(*x, &first[i]);
+    }
+    for (c = 0; c < 256; c++) {
+        uint64_t mask = 0;
+        for (i = 0; i < size; i++) {
+            if (bitset_get(&first[i], c)) {
+                mask |= 1ULL << i;
+            }
+        }
+        for (k = 0; k < n; k++) {
+            if (masks[k] == mask) {
+                break;
+            }
+        }
+        if (k == n) {
+            if (n == MOZ_IR_TABLE_JUMP_SIZE) {
+                return 0;
+            }
+            masks[n++] = mask;
+            for (; mask; mask &= mask - 1) {
+                emitted++;
+            }
+        }
+        jumps[c] = k;
+    }
+    if (n < 2 || emitted > 2 * size) {
+        return 0;
+    }
+    return n;
+}
+
+OPTIMIZE static void moz_Choice_to_TableJump(moz_compiler_t *C, moz_state_t *S, Choice_t *e,
+        uint64_t masks[MOZ_IR_TABLE_JUMP_SIZE], unsigned size, uint8_t jumps[256])
+{
+    /**
+     * Choice(E1, E2, E3), FIRST(E1) = {a}, FIRST(E2) = {b}, FIRST(E3) = {a, c}
+     * L_head
+     *  TableJump [a: L_a, b: L_b, c: L_c, _: FAIL]
+     * L_a
+     *  E1, NEXT, next1
+     * L_next1
+     *  E3, NEXT, FAIL
+     * L_b
+     *  E2, NEXT, FAIL
+     * L_c
+     *  E3, NEXT, FAIL
+     */
+    unsigned i, k;
+    block_t *next;
+    moz_state_t state = {};
+    ITableJump_t *ir = IR_ALLOC_T(ITableJump, S);
+
+    ir->tblId = C->jmptbl_size++;
+    memcpy(ir->jumps, jumps, sizeof(ir->jumps));
+    moz_compiler_add(C, S, (IR_t *)ir);
+
+    moz_state_copy(&state, S);
+    next = moz_compiler_create_block(C);
+    for (k = 0; k < size; k++) {
+        uint64_t mask = masks[k];
+        block_t *head = mask == 0 ? S->fail : moz_compiler_create_block(C);
+        ir->targets[k] = head;
+        block_link(S->cur, head);
+        for (i = 0; mask; i++) {
+            if ((mask & (1ULL << i)) == 0) {
+                continue;
+            }
+            mask &= ~(1ULL << i);
+            state.next = next;
+            state.fail = mask ? moz_compiler_create_block(C) : S->fail;
+            moz_compiler_set_label(C, &state, head);
+            moz_expr_to_ir(C, &state, ARRAY_get(expr_ptr_t, &e->list, i));
+            moz_compiler_link(C, &state, state.cur, state.next);
+            head = state.fail;
+        }
+    }
+    /* padding slots must repeat a used target (see jump_table3_init) */
+    for (; k < MOZ_IR_TABLE_JUMP_SIZE; k++) {
+        ir->targets[k] = ir->targets[0];
+    }
+    moz_compiler_set_label(C, S, next);
+}
+
+/*
+ * Try first the alternatives that succeeded most often in the branch
+ * profile. An alternative only moves ahead of alternatives whose first set
+ * is disjoint from its own: at most one of them can match, so the ordered
+ * choice keeps its meaning.
+ */
+static void moz_Choice_order(moz_compiler_t *C, Choice_t *e, unsigned *order)
+{
+    unsigned i, j, size = ARRAY_size(e->list);
+    bitset_t first[size + 1];
+    long *count;
+    expr_t **x;
+
+    for (i = 0; i < size; i++) {
+        order[i] = i;
+    }
+    if (C->branch_profile == NULL || e->branch == 0) {
+        return;
+    }
+    count = C->branch_profile + e->branch - 1;
+    FOR_EACH_ARRAY_(e->list, x, i) {
+        moz_expr_first_set(*x, &first[i]);
+    }
+    for (i = 1; i < size; i++) {
+        for (j = i; j > 0; j--) {
+            unsigned prev = order[j - 1];
+            if (count[prev] >= count[i] || !bitset_disjoint(&first[prev], &first[i])) {
+                break;
+            }
+            order[j] = prev;
+        }
+        order[j] = i;
+    }
+}
+
+/* counter 2n counts the attempts of branch n, 2n + 1 its successes */
+static void moz_Choice_count(moz_compiler_t *C, moz_state_t *S, Choice_t *e,
+        unsigned alt, unsigned success)
+{
+#ifdef MOZVM_PROFILE_INST
+    if (e->branch > 0) {
+        ICount_t *ir = IR_ALLOC_T(ICount, S);
+        ir->counterId = 2 * (e->branch - 1 + alt) + success;
+        moz_compiler_add(C, S, (IR_t *)ir);
+    }
+#endif
+}
+
 static void moz_Choice_to_ir(moz_compiler_t *C, moz_state_t *S, Choice_t *e)
 {
     /**
@@ -211,23 +381,33 @@ static void moz_Choice_to_ir(moz_compiler_t *C, moz_state_t *S, Choice_t *e)
      */
     unsigned i;
     block_t *blocks[ARRAY_size(e->list) + 1 + 1];
+    unsigned order[ARRAY_size(e->list) + 1];
     block_t *next;
     moz_state_t state = {};
-    expr_t **x;
+    uint64_t masks[MOZ_IR_TABLE_JUMP_SIZE];
+    uint8_t jumps[256];
+    unsigned size;
 
+    if ((size = moz_Choice_predict(e, masks, jumps)) > 0) {
+        moz_Choice_to_TableJump(C, S, e, masks, size, jumps);
+        return;
+    }
     moz_state_copy(&state, S);
     for (i = 0; i < ARRAY_size(e->list); i++) {
         blocks[i] = moz_compiler_create_block(C);
     }
     blocks[i] = S->fail;
     next = moz_compiler_create_block(C);
+    moz_Choice_order(C, e, order);
 
     moz_compiler_link(C, &state, state.cur, blocks[0]);
-    FOR_EACH_ARRAY_(e->list, x, i) {
+    for (i = 0; i < ARRAY_size(e->list); i++) {
         state.next = next;
         state.fail = blocks[i + 1];
         moz_compiler_set_label(C, &state, blocks[i]);
-        moz_expr_to_ir(C, &state, *x);
+        moz_Choice_count(C, &state, e, order[i], 0);
+        moz_expr_to_ir(C, &state, ARRAY_get(expr_ptr_t, &e->list, order[i]));
+        moz_Choice_count(C, &state, e, order[i], 1);
         moz_compiler_link(C, &state, state.cur, state.next);
     }
     moz_compiler_set_label(C, S, state.next);
@@ -240,6 +420,23 @@ static void moz_Fail_to_ir(moz_compiler_t *C, moz_state_t *S, Fail_t *e)
     moz_compiler_add(C, S, (IR_t *)ir);
 }
 
+OPTIMIZE static void moz_And_Class_to_NSet(moz_compiler_t *C, moz_state_t *S, expr_t *e)
+{
+    /* &[a-z] fails exactly where ![^a-z] does */
+    bitset_t set;
+    INSet_t *ir = IR_ALLOC_T(INSet, S);
+    bitset_init(&set);
+    if (e->type == Byte) {
+        bitset_set(&set, ((Byte_t *)e)->byte);
+    }
+    else {
+        bitset_copy(&set, &((Set_t *)e)->set);
+    }
+    bitset_flip(&set);
+    ir->setId = moz_compiler_add_set(C, &set);
+    moz_compiler_add(C, S, (IR_t *)ir);
+}
+
 static void moz_And_to_ir(moz_compiler_t *C, moz_state_t *S, And_t *e)
 {
     /**
@@ -254,6 +451,10 @@ static void moz_And_to_ir(moz_compiler_t *C, moz_state_t *S, And_t *e)
      *  goto FAIL;
      */
     moz_state_t state;
+    if (e->expr->type == Byte || e->expr->type == Set) {
+        moz_And_Class_to_NSet(C, S, e->expr);
+        return;
+    }
     moz_state_copy(&state, S);
     block_t *head = moz_compiler_create_block(C);
     block_t *next = moz_compiler_create_block(C);
@@ -264,13 +465,18 @@ static void moz_And_to_ir(moz_compiler_t *C, moz_state_t *S, And_t *e)
     state.fail = fail;
     moz_compiler_set_label(C, &state, head);
 
-    moz_compiler_add(C, &state, IR_ALLOC(IPStore, &state));
+    IPStore_t *store = IR_ALLOC_T(IPStore, &state);
+    store->slot = C->slot_size++;
+    moz_compiler_add(C, &state, (IR_t *)store);
+    state.slots++;
     moz_expr_to_ir(C, &state, e->expr);
     moz_compiler_link(C, &state, state.cur, state.next);
 
     moz_compiler_set_label(C, &state, state.next);
     state.fail = S->fail;
-    moz_compiler_add(C, &state, IR_ALLOC(IPLoad, &state));
+    IPLoad_t *load = IR_ALLOC_T(IPLoad, &state);
+    load->slot = store->slot;
+    moz_compiler_add(C, &state, (IR_t *)load);
     state.fail = fail;
 
     moz_compiler_set_label(C, &state, state.fail);
@@ -285,6 +491,27 @@ OPTIMIZE static void moz_Not_Any_to_NAny(moz_compiler_t *C, moz_state_t *S)
     moz_compiler_add(C, S, (IR_t *)ir);
 }
 
+OPTIMIZE static void moz_Not_Byte_to_NByte(moz_compiler_t *C, moz_state_t *S, Byte_t *e)
+{
+    INByte_t *ir = IR_ALLOC_T(INByte, S);
+    ir->byte = e->byte;
+    moz_compiler_add(C, S, (IR_t *)ir);
+}
+
+OPTIMIZE static void moz_Not_Set_to_NSet(moz_compiler_t *C, moz_state_t *S, Set_t *e)
+{
+    INSet_t *ir = IR_ALLOC_T(INSet, S);
+    ir->setId = moz_compiler_add_set(C, &e->set);
+    moz_compiler_add(C, S, (IR_t *)ir);
+}
+
+OPTIMIZE static void moz_Not_Str_to_NStr(moz_compiler_t *C, moz_state_t *S, Str_t *e)
+{
+    INStr_t *ir = IR_ALLOC_T(INStr, S);
+    ir->strId = moz_compiler_add_string(C, &e->list);
+    moz_compiler_add(C, S, (IR_t *)ir);
+}
+
 static void moz_Not_to_ir(moz_compiler_t *C, moz_state_t *S, Not_t *e)
 {
     /**
@@ -303,9 +530,21 @@ static void moz_Not_to_ir(moz_compiler_t *C, moz_state_t *S, Not_t *e)
     moz_state_t state;
     moz_state_copy(&state, S);
 
-    if (e->expr->type == Any) {
+    switch (e->expr->type) {
+    case Any:
         moz_Not_Any_to_NAny(C, S);
         return;
+    case Byte:
+        moz_Not_Byte_to_NByte(C, S, (Byte_t *)e->expr);
+        return;
+    case Set:
+        moz_Not_Set_to_NSet(C, S, (Set_t *)e->expr);
+        return;
+    case Str:
+        moz_Not_Str_to_NStr(C, S, (Str_t *)e->expr);
+        return;
+    default:
+        break;
     }
     block_t *head = moz_compiler_create_block(C);
     block_t *next = moz_compiler_create_block(C);
@@ -316,7 +555,10 @@ static void moz_Not_to_ir(moz_compiler_t *C, moz_state_t *S, Not_t *e)
     state.fail = next;
     moz_compiler_set_label(C, &state, head);
 
-    moz_compiler_add(C, &state, IR_ALLOC(IPStore, &state));
+    IPStore_t *store = IR_ALLOC_T(IPStore, &state);
+    store->slot = C->slot_size++;
+    moz_compiler_add(C, &state, (IR_t *)store);
+    state.slots++;
     moz_expr_to_ir(C, &state, e->expr);
     moz_compiler_link(C, &state, state.cur, state.next);
 
@@ -326,8 +568,11 @@ static void moz_Not_to_ir(moz_compiler_t *C, moz_state_t *S, Not_t *e)
     moz_compiler_set_label(C, &state, state.fail);
     {
         block_t *cur_fail = state.fail;
+        IPLoad_t *load;
         state.fail = S->fail;
-        moz_compiler_add(C, &state, IR_ALLOC(IPLoad, &state));
+        load = IR_ALLOC_T(IPLoad, &state);
+        load->slot = store->slot;
+        moz_compiler_add(C, &state, (IR_t *)load);
         state.fail = cur_fail;
     }
     moz_compiler_set_label(C, S, state.fail);
@@ -448,6 +693,167 @@ OPTIMIZE static void moz_Repetition_to_RByte(moz_compiler_t *C, moz_state_t *S,
     moz_compiler_add(C, S, (IR_t *)ir);
 }
 
+/* true if e calls a production */
+static int moz_expr_has_invoke(expr_t *e)
+{
+    expr_t **x, **end;
+    switch (e->type) {
+    case Invoke:
+        return 1;
+    case And:
+    case Not:
+    case Option:
+        return moz_expr_has_invoke(((Unary_t *)e)->expr);
+    case Choice:
+    case Sequence:
+    case Repetition:
+        FOR_EACH_ARRAY(((List_t *)e)->list, x, end) {
+            if (moz_expr_has_invoke(*x)) {
+                return 1;
+            }
+        }
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+/* true if e has an And or Not around a call. Their slot is on the stack
+ * then, and the paths where they fail leave it pushed. */
+static int moz_expr_leaves_slot(expr_t *e)
+{
+    expr_t **x, **end;
+    switch (e->type) {
+    case And:
+    case Not:
+        if (moz_expr_has_invoke(((Unary_t *)e)->expr)) {
+            return 1;
+        }
+        /* fall through */
+    case Option:
+        return moz_expr_leaves_slot(((Unary_t *)e)->expr);
+    case Choice:
+    case Sequence:
+    case Repetition:
+        FOR_EACH_ARRAY(((List_t *)e)->list, x, end) {
+            if (moz_expr_leaves_slot(*x)) {
+                return 1;
+            }
+        }
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+/* true if e, and every production it calls, only moves the position. A
+ * failed iteration of moz_Repetition_to_PLoop rewinds the position but
+ * not the AST logs or the symbol table. seen holds the decls entered. */
+static int moz_expr_position_only(expr_t *e, ARRAY(decl_ptr_t) *seen)
+{
+    expr_t **x, **end;
+    decl_t *decl, **d, **dend;
+    switch (e->type) {
+    case Any:
+    case Byte:
+    case Str:
+    case Set:
+    case Empty:
+    case Fail:
+        return 1;
+    case Invoke:
+        decl = ((Invoke_t *)e)->decl;
+        if (decl == NULL || decl->body == NULL) {
+            return 0;
+        }
+        FOR_EACH_ARRAY(*seen, d, dend) {
+            if (*d == decl) {
+                return 1;
+            }
+        }
+        ARRAY_add(decl_ptr_t, seen, decl);
+        return moz_expr_position_only(decl->body, seen);
+    case And:
+    case Not:
+    case Option:
+        return moz_expr_position_only(((Unary_t *)e)->expr, seen);
+    case Choice:
+    case Sequence:
+    case Repetition:
+        FOR_EACH_ARRAY(((List_t *)e)->list, x, end) {
+            if (!moz_expr_position_only(*x, seen)) {
+                return 0;
+            }
+        }
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+OPTIMIZE static void moz_Repetition_to_PLoop(moz_compiler_t *C, moz_state_t *S, Repetition_t *e)
+{
+    /**
+     * Repetition(E1, E2)
+     * L_head:
+     *  PStore
+     *  E1, next1, L_fail
+     * L_next1:
+     *  E2, next2, L_fail
+     * L_next2:
+     *  goto L_head
+     * L_fail:
+     *  PLoad
+     *
+     * A failed iteration goes back to the end of the last complete one, so
+     * the body and the productions it calls only move the position.
+     * Without an IInvoke in the body the slot gets a vm2 register, so an
+     * iteration saves one position and never writes to the frame. Across a
+     * call the slot is on the stack, and L_next2 pops the previous
+     * iteration's position through a register before L_head pushes again:
+     *  PStore tmp; PLoad; PLoad tmp
+     */
+    moz_state_t state;
+    block_t *head = moz_compiler_create_named_block(C, BLOCK_LOOP_HEAD);
+    block_t *fail = moz_compiler_create_block(C);
+    IPStore_t *store;
+    IPLoad_t *load;
+    expr_t **x, **end;
+
+    moz_state_copy(&state, S);
+    moz_compiler_link(C, &state, state.cur, head);
+    moz_compiler_set_label(C, &state, head);
+    state.fail = fail;
+    store = IR_ALLOC_T(IPStore, &state);
+    store->slot = C->slot_size++;
+    moz_compiler_add(C, &state, (IR_t *)store);
+    state.slots++;
+    FOR_EACH_ARRAY(e->list, x, end) {
+        block_t *next = moz_compiler_create_block(C);
+        state.next = next;
+        moz_expr_to_ir(C, &state, *x);
+        moz_compiler_link(C, &state, state.cur, next);
+        moz_compiler_set_label(C, &state, next);
+    }
+    if (moz_expr_has_invoke((expr_t *)e)) {
+        IPStore_t *tmp = IR_ALLOC_T(IPStore, &state);
+        tmp->slot = C->slot_size++;
+        moz_compiler_add(C, &state, (IR_t *)tmp);
+        load = IR_ALLOC_T(IPLoad, &state);
+        load->slot = store->slot;
+        moz_compiler_add(C, &state, (IR_t *)load);
+        load = IR_ALLOC_T(IPLoad, &state);
+        load->slot = tmp->slot;
+        moz_compiler_add(C, &state, (IR_t *)load);
+    }
+    moz_compiler_link(C, &state, state.cur, head);
+
+    moz_compiler_set_label(C, S, fail);
+    load = IR_ALLOC_T(IPLoad, S);
+    load->slot = store->slot;
+    moz_compiler_add(C, S, (IR_t *)load);
+}
+
 static void moz_Repetition_to_ir(moz_compiler_t *C, moz_state_t *S, Repetition_t *e)
 {
     /**
@@ -461,6 +867,10 @@ static void moz_Repetition_to_ir(moz_compiler_t *C, moz_state_t *S, Repetition_t
      * L_next3
      *  goto L_head
      * L_fail
+     *
+     * Only when no register is left, the body builds AST or updates the
+     * symbol table (see moz_expr_position_only), or it leaves a slot pushed
+     * (see moz_expr_leaves_slot): a failed iteration keeps what it consumed.
      */
     unsigned i;
     block_t *blocks[ARRAY_size(e->list) + 1 + 1];
@@ -486,6 +896,17 @@ static void moz_Repetition_to_ir(moz_compiler_t *C, moz_state_t *S, Repetition_t
             break;
         }
     }
+    if (S->slots < MOZ_IR_REGISTER_SIZE && !moz_expr_leaves_slot((expr_t *)e)) {
+        ARRAY(decl_ptr_t) seen;
+        int position_only;
+        ARRAY_init(decl_ptr_t, &seen, 4);
+        position_only = moz_expr_position_only((expr_t *)e, &seen);
+        ARRAY_dispose(decl_ptr_t, &seen);
+        if (position_only) {
+            moz_Repetition_to_PLoop(C, S, e);
+            return;
+        }
+    }
 
     moz_state_copy(&state, S);
     for (i = 0; i < ARRAY_size(e->list); i++) {
@@ -608,6 +1029,124 @@ static void moz_expr_to_ir(moz_compiler_t *C, moz_state_t *S, expr_t *e)
     translate[e->type](C, S, e);
 }
 
+static void moz_left_recursive_Choice_to_ir(moz_compiler_t *C, moz_state_t *S, Choice_t *e)
+{
+    /**
+     * Choice(E1, E2, E3) as the body of a left-recursive decl
+     * L_head
+     *  PStore
+     *  E1, NEXT, next1
+     * L_next1
+     *  PLoad
+     *  PStore
+     *  E2, NEXT, next2
+     * L_next2
+     *  PLoad
+     *  E3, NEXT, FAIL
+     *
+     * Once the seed grew, E1 may consume input before it fails (E '+' N on
+     * the last N): the next alternative starts over from the position of
+     * the run. ILrGrow drops the slot of the alternative that succeeded.
+     */
+    unsigned i, size = ARRAY_size(e->list);
+    unsigned order[size + 1];
+    block_t *head = moz_compiler_create_block(C);
+    block_t *next = moz_compiler_create_block(C);
+    moz_state_t state;
+
+    moz_state_copy(&state, S);
+    moz_Choice_order(C, e, order);
+    moz_compiler_link(C, &state, state.cur, head);
+    moz_compiler_set_label(C, &state, head);
+    for (i = 0; i < size; i++) {
+        IPStore_t *store = NULL;
+        state.next = next;
+        state.fail = S->fail;
+        if (i + 1 < size) {
+            state.fail = moz_compiler_create_block(C);
+            store = IR_ALLOC_T(IPStore, &state);
+            store->slot = C->slot_size++;
+            moz_compiler_add(C, &state, (IR_t *)store);
+            state.slots++;
+        }
+        moz_Choice_count(C, &state, e, order[i], 0);
+        moz_expr_to_ir(C, &state, ARRAY_get(expr_ptr_t, &e->list, order[i]));
+        moz_Choice_count(C, &state, e, order[i], 1);
+        moz_compiler_link(C, &state, state.cur, state.next);
+        if (store) {
+            IPLoad_t *load;
+            moz_compiler_set_label(C, &state, state.fail);
+            state.slots--;
+            state.fail = S->fail;
+            load = IR_ALLOC_T(IPLoad, &state);
+            load->slot = store->slot;
+            moz_compiler_add(C, &state, (IR_t *)load);
+        }
+    }
+    moz_compiler_set_label(C, S, next);
+}
+
+static void moz_left_recursive_decl_to_ir(moz_compiler_t *C, moz_state_t *S, decl_t *decl)
+{
+    /*
+     * decl(E1) where E1 may invoke decl before consuming input
+     * L_head:
+     *  ILrEnter L_seed
+     * L_loop:
+     *  E1, L_exit
+     *  ILrGrow L_exit
+     *  goto L_loop
+     * L_exit:
+     *  ILrLeave L_fail
+     * L_seed:
+     *  ILrSeed L_fail
+     */
+    uint16_t lrId = C->lr_size++;
+    block_t *loop = moz_compiler_create_named_block(C, BLOCK_LOOP_HEAD);
+    block_t *grow = moz_compiler_create_block(C);
+    block_t *seed = moz_compiler_create_block(C);
+    block_t *fail = S->fail;
+    ILrEnter_t *enter;
+    ILrGrow_t *grow_ir;
+    ILrLeave_t *leave;
+    ILrSeed_t *seed_ir;
+
+    S->fail = seed;
+    enter = IR_ALLOC_T(ILrEnter, S);
+    enter->lrId = lrId;
+    moz_compiler_add(C, S, (IR_t *)enter);
+    S->fail = fail;
+    moz_compiler_link(C, S, S->cur, loop);
+
+    moz_compiler_set_label(C, S, loop);
+    S->fail = S->next;
+    if (decl->body->type == Choice) {
+        moz_left_recursive_Choice_to_ir(C, S, (Choice_t *)decl->body);
+    }
+    else {
+        moz_expr_to_ir(C, S, decl->body);
+    }
+    moz_compiler_link(C, S, S->cur, grow);
+    moz_compiler_set_label(C, S, grow);
+    grow_ir = IR_ALLOC_T(ILrGrow, S);
+    grow_ir->lrId = lrId;
+    moz_compiler_add(C, S, (IR_t *)grow_ir);
+    moz_compiler_link(C, S, grow, loop);
+    S->fail = fail;
+
+    moz_compiler_set_label(C, S, S->next);
+    leave = IR_ALLOC_T(ILrLeave, S);
+    leave->lrId = lrId;
+    moz_compiler_add(C, S, (IR_t *)leave);
+    moz_compiler_add(C, S, IR_ALLOC(IRet, S));
+
+    moz_compiler_set_label(C, S, seed);
+    seed_ir = IR_ALLOC_T(ILrSeed, S);
+    seed_ir->lrId = lrId;
+    moz_compiler_add(C, S, (IR_t *)seed_ir);
+    moz_compiler_add(C, S, IR_ALLOC(IRet, S));
+}
+
 static void moz_decl_to_ir(moz_compiler_t *C, decl_t *decl)
 {
     /*
@@ -620,20 +1159,69 @@ static void moz_decl_to_ir(moz_compiler_t *C, decl_t *decl)
     moz_state_t state, *S = &state;
     moz_state_init(C, S);
     moz_compiler_set_label(C, S, S->head);
-    moz_expr_to_ir(C, S, decl->body);
-
-    moz_compiler_link(C, S, S->cur, S->next);
-    moz_compiler_set_label(C, S, S->next);
-    moz_compiler_add(C, S, IR_ALLOC(IRet, S));
+    if (decl->left_recursive) {
+        moz_left_recursive_decl_to_ir(C, S, decl);
+    }
+    else {
+        moz_expr_to_ir(C, S, decl->body);
+        moz_compiler_link(C, S, S->cur, S->next);
+        moz_compiler_set_label(C, S, S->next);
+        moz_compiler_add(C, S, IR_ALLOC(IRet, S));
+    }
 
     moz_compiler_set_label(C, S, S->fail);
     moz_compiler_add(C, S, IR_ALLOC(IFail, S));
     decl->inst = S->head;
 }
 
+/* Number Choice alternatives before any of them is reordered, so that a
+ * branch profile matches every compilation of the same grammar. */
+static void moz_expr_number_branch(moz_compiler_t *C, expr_t *e)
+{
+    expr_t **x, **end;
+    switch (e->type) {
+    case Choice:
+        if (((Choice_t *)e)->branch == 0 &&
+                C->branch_size + 2 * ARRAY_size(((Choice_t *)e)->list) <= UINT16_MAX) {
+            ((Choice_t *)e)->branch = C->branch_size / 2 + 1;
+            C->branch_size += 2 * ARRAY_size(((Choice_t *)e)->list);
+        }
+        /* fallthrough */
+    case Sequence:
+    case Repetition:
+        FOR_EACH_ARRAY(((List_t *)e)->list, x, end) {
+            moz_expr_number_branch(C, *x);
+        }
+        break;
+    case And:
+    case Not:
+    case Option:
+    case Xblock:
+        moz_expr_number_branch(C, ((Unary_t *)e)->expr);
+        break;
+    case Xlocal:
+    case Xsymbol:
+        moz_expr_number_branch(C, ((NameUnary_t *)e)->expr);
+        break;
+    default:
+        break;
+    }
+}
+
 static void moz_ast_to_ir(moz_compiler_t *C)
 {
     decl_t **decl, **e;
+    FOR_EACH_ARRAY(C->decls, decl, e) {
+        if (MOZ_RC_COUNT(*decl) > 0) {
+            moz_expr_number_branch(C, (*decl)->body);
+        }
+    }
+    if (C->branch_profile && C->branch_profile_size != C->branch_size / 2) {
+        fprintf(stderr, "warning: branch profile does not match the grammar\n");
+        VM_FREE(C->branch_profile);
+        C->branch_profile = NULL;
+        C->branch_profile_size = 0;
+    }
     FOR_EACH_ARRAY(C->decls, decl, e) {
         if (MOZ_RC_COUNT(*decl) > 0) {
             moz_decl_to_ir(C, *decl);
@@ -673,6 +1261,18 @@ static void remove_from_parent(moz_compiler_t *C, IR_t *inst, int do_free)
     }
 }
 
+static void block_free_insts(block_t *bb)
+{
+    IR_t **x, **e;
+    FOR_EACH_ARRAY(bb->insts, x, e) {
+        VM_FREE(*x);
+    }
+    ARRAY_size(bb->insts) = 0;
+}
+
+/* Instructions merged into several predecessors are cloned so that every
+ * IR id appears once in the CFG (the linker and register allocator index
+ * per-instruction data by id). */
 static int simplify_cfg(WORK_LIST(block_ptr_t, moz_compiler_ptr_t) *W, block_t *bb)
 {
     moz_compiler_t *C = W->context;
@@ -731,7 +1331,7 @@ static int simplify_cfg(WORK_LIST(block_ptr_t, moz_compiler_ptr_t) *W, block_t *
                 }
                 FOR_EACH_ARRAY(bb->insts, x, e) {
                     if (*x != inst) {
-                        block_insert_before(pred, term, *x);
+                        block_insert_before(pred, term, moz_ir_clone(*x, pred));
                     }
                 }
                 ((IJump_t *)term)->v.target = succ;
@@ -743,8 +1343,7 @@ static int simplify_cfg(WORK_LIST(block_ptr_t, moz_compiler_ptr_t) *W, block_t *
             }
             if (modified == preds_size) {
                 block_unlink(bb, succ);
-                remove_from_parent(C, inst, 1);
-                ARRAY_size(bb->insts) = 0;
+                block_free_insts(bb);
                 ARRAY_remove_element(block_ptr_t, &C->blocks, bb);
             }
             if (modified > 0) {
@@ -774,7 +1373,7 @@ static int simplify_cfg(WORK_LIST(block_ptr_t, moz_compiler_ptr_t) *W, block_t *
                 continue;
             }
             FOR_EACH_ARRAY(bb->insts, x, e) {
-                block_insert_before(pred, term, *x);
+                block_insert_before(pred, term, moz_ir_clone(*x, pred));
             }
             remove_from_parent(C, term, 1);
             block_set_type(pred, bb->type);
@@ -783,6 +1382,7 @@ static int simplify_cfg(WORK_LIST(block_ptr_t, moz_compiler_ptr_t) *W, block_t *
             modified++;
         }
         if (modified == preds_size) {
+            block_free_insts(bb);
             ARRAY_remove_element(block_ptr_t, &C->blocks, bb);
         }
         if (modified > 0) {
@@ -864,6 +1464,207 @@ static void moz_ir_optimize(moz_compiler_t *C)
     }
 }
 
+/* position register allocation */
+typedef struct pos_point {
+    block_t *bb;
+    unsigned idx;
+} pos_point_t;
+
+DEF_ARRAY_T_OP(pos_point_t);
+
+static int moz_ir_may_fail(IR_t *ir)
+{
+    switch (ir->type) {
+    case IInvoke:
+    case IAny:
+    case IByte:
+    case IStr:
+    case ISet:
+    case IUByte:
+    case IUSet:
+    case INAny:
+    case INByte:
+    case INStr:
+    case INSet:
+    case IMemoFail:
+    case ILrEnter:
+    case ILrGrow:
+    case ILrLeave:
+    case ILrSeed:
+    case ISIsDef:
+    case ISExists:
+    case ISMatch:
+    case ISIs:
+    case ISIsa:
+        return ir->fail != NULL;
+    default:
+        return 0;
+    }
+}
+
+/* Bucket every (bb, idx) point by key; begin[k]..begin[k+1] is bucket k. */
+static unsigned *pos_index_prefix_sum(unsigned *begin, unsigned size)
+{
+    unsigned i;
+    for (i = 1; i < size + 2; i++) {
+        begin[i] += begin[i - 1];
+    }
+    return begin;
+}
+
+/*
+ * Keep the position saved by IPStore in a vm2 register instead of on the
+ * stack. For each slot, walk backward from its IPLoads (through block
+ * predecessors and instructions whose fail label enters the block) until
+ * reaching the IPStore; every instruction seen is one where the slot is
+ * live. Slots live across an IInvoke stay on the stack because a callee
+ * may reuse the same registers. The others get the lowest register that
+ * no other slot live at the same instructions occupies.
+ */
+static void moz_ir_allocate_register(moz_compiler_t *C)
+{
+    unsigned nblocks = max_block_id;
+    unsigned nslots = C->slot_size;
+    unsigned nirs = moz_ir_max_id();
+    unsigned *fail_begin, *load_begin, *visited, *live, *entered;
+    pos_point_t *fail_points, *load_points;
+    uint8_t *used;
+    int *reg;
+    ARRAY(pos_point_t) stack;
+    block_t **I, **E;
+    IR_t **x, **e;
+    unsigned i, slot;
+
+    if (nslots == 0) {
+        return;
+    }
+    fail_begin = (unsigned *)VM_CALLOC(nblocks + 2, sizeof(unsigned));
+    load_begin = (unsigned *)VM_CALLOC(nslots + 2, sizeof(unsigned));
+    FOR_EACH_ARRAY(C->blocks, I, E) {
+        FOR_EACH_ARRAY((*I)->insts, x, e) {
+            if (moz_ir_may_fail(*x)) {
+                fail_begin[block_id((*x)->fail) + 2]++;
+            }
+            else if ((*x)->type == IPLoad) {
+                load_begin[((IPLoad_t *)*x)->slot + 2]++;
+            }
+        }
+    }
+    pos_index_prefix_sum(fail_begin, nblocks);
+    pos_index_prefix_sum(load_begin, nslots);
+    fail_points = (pos_point_t *)VM_MALLOC(sizeof(pos_point_t) * (fail_begin[nblocks + 1] + 1));
+    load_points = (pos_point_t *)VM_MALLOC(sizeof(pos_point_t) * (load_begin[nslots + 1] + 1));
+    FOR_EACH_ARRAY(C->blocks, I, E) {
+        FOR_EACH_ARRAY((*I)->insts, x, e) {
+            pos_point_t p = { *I, (unsigned)(x - ARRAY_BEGIN((*I)->insts)) };
+            if (moz_ir_may_fail(*x)) {
+                fail_points[fail_begin[block_id((*x)->fail) + 1]++] = p;
+            }
+            else if ((*x)->type == IPLoad) {
+                load_points[load_begin[((IPLoad_t *)*x)->slot + 1]++] = p;
+            }
+        }
+    }
+
+    visited = (unsigned *)VM_CALLOC(nirs, sizeof(unsigned));
+    entered = (unsigned *)VM_CALLOC(nblocks, sizeof(unsigned));
+    live    = (unsigned *)VM_MALLOC(sizeof(unsigned) * nirs);
+    used    = (uint8_t *)VM_CALLOC(nirs, sizeof(uint8_t));
+    reg     = (int *)VM_MALLOC(sizeof(int) * nslots);
+    ARRAY_init(pos_point_t, &stack, 4);
+
+    for (slot = 0; slot < nslots; slot++) {
+        unsigned mark = slot + 1;
+        unsigned nlive = 0;
+        unsigned mask = 0;
+        int spill = 0;
+
+        ARRAY_size(stack) = 0;
+        for (i = load_begin[slot]; i < load_begin[slot + 1]; i++) {
+            IR_t *ir = block_get(load_points[i].bb, load_points[i].idx);
+            visited[ir->id] = mark;
+            live[nlive++] = ir->id;
+            ARRAY_add(pos_point_t, &stack, &load_points[i]);
+        }
+        while (!spill && ARRAY_size(stack) > 0) {
+            pos_point_t p = *ARRAY_pop(pos_point_t, &stack);
+            block_t **pred, **pred_end;
+
+            for (i = p.idx; i > 0; i--) {
+                IR_t *ir = block_get(p.bb, i - 1);
+                if (visited[ir->id] == mark) {
+                    break;
+                }
+                visited[ir->id] = mark;
+                live[nlive++] = ir->id;
+                if (ir->type == IInvoke) {
+                    spill = 1;
+                    break;
+                }
+                if (ir->type == IPStore && ((IPStore_t *)ir)->slot == slot) {
+                    break;
+                }
+            }
+            if (i > 0 || spill || entered[block_id(p.bb)] == mark) {
+                continue;
+            }
+            entered[block_id(p.bb)] = mark;
+            FOR_EACH_ARRAY(p.bb->preds, pred, pred_end) {
+                pos_point_t q = { *pred, block_size(*pred) };
+                ARRAY_add(pos_point_t, &stack, &q);
+            }
+            for (i = fail_begin[block_id(p.bb)]; i < fail_begin[block_id(p.bb) + 1]; i++) {
+                pos_point_t q = { fail_points[i].bb, fail_points[i].idx + 1 };
+                ARRAY_add(pos_point_t, &stack, &q);
+            }
+        }
+
+        reg[slot] = -1;
+        if (spill) {
+            continue;
+        }
+        for (i = 0; i < nlive; i++) {
+            mask |= used[live[i]];
+        }
+        for (i = 0; i < MOZ_IR_REGISTER_SIZE; i++) {
+            if ((mask & (1U << i)) == 0) {
+                reg[slot] = i;
+                break;
+            }
+        }
+        if (reg[slot] < 0) {
+            continue;
+        }
+        for (i = 0; i < nlive; i++) {
+            used[live[i]] |= 1U << reg[slot];
+        }
+    }
+
+    FOR_EACH_ARRAY(C->blocks, I, E) {
+        FOR_EACH_ARRAY((*I)->insts, x, e) {
+            if ((*x)->type == IPStore && reg[((IPStore_t *)*x)->slot] >= 0) {
+                (*x)->type = IPStoreR;
+                ((IPStore_t *)*x)->reg = reg[((IPStore_t *)*x)->slot];
+            }
+            else if ((*x)->type == IPLoad && reg[((IPLoad_t *)*x)->slot] >= 0) {
+                (*x)->type = IPLoadR;
+                ((IPLoad_t *)*x)->reg = reg[((IPLoad_t *)*x)->slot];
+            }
+        }
+    }
+
+    ARRAY_dispose(pos_point_t, &stack);
+    VM_FREE(reg);
+    VM_FREE(used);
+    VM_FREE(live);
+    VM_FREE(entered);
+    VM_FREE(visited);
+    VM_FREE(load_points);
+    VM_FREE(fail_points);
+    VM_FREE(load_begin);
+    VM_FREE(fail_begin);
+}
+
 static void moz_inst_header_dump(IR_t *ir, int fail_block, int line_feed)
 {
     fprintf(stderr, "  %03d %s", ir->id, IR_TYPE_NAME[ir->type]);
@@ -878,12 +1679,21 @@ static void moz_inst_header_dump(IR_t *ir, int fail_block, int line_feed)
 void moz_inst_dump(moz_compiler_t *C, IR_t *ir)
 {
     char buf[128] = {};
+    unsigned i;
     switch (ir->type) {
     case IJump:
         moz_inst_header_dump(ir, 0, 0);
         fprintf(stderr, " BB%d\n", block_id(((IJump_t *)ir)->v.target));
         break;
     case ITableJump:
+        moz_inst_header_dump(ir, 0, 0);
+        fprintf(stderr, " tbl=%d [", ((ITableJump_t *)ir)->tblId);
+        for (i = 0; i < MOZ_IR_TABLE_JUMP_SIZE; i++) {
+            fprintf(stderr, "%sBB%d", i > 0 ? ", " : "",
+                    block_id(((ITableJump_t *)ir)->targets[i]));
+        }
+        fprintf(stderr, "]\n");
+        break;
     case ILabel:
     case IExit:
     case IRet:
@@ -891,6 +1701,14 @@ void moz_inst_dump(moz_compiler_t *C, IR_t *ir)
     case IPStore:
         moz_inst_header_dump(ir, 0, 1);
         break;
+    case IPLoadR:
+        moz_inst_header_dump(ir, 0, 0);
+        fprintf(stderr, " r%d\n", ((IPLoadR_t *)ir)->reg);
+        break;
+    case IPStoreR:
+        moz_inst_header_dump(ir, 0, 0);
+        fprintf(stderr, " r%d\n", ((IPStoreR_t *)ir)->reg);
+        break;
     case IFail:
         moz_inst_header_dump(ir, 1, 1);
         break;
@@ -902,24 +1720,27 @@ void moz_inst_dump(moz_compiler_t *C, IR_t *ir)
                 ((IInvoke_t *)ir)->v.decl->name.str);
         break;
     case IByte:
+    case INByte:
     case IRByte:
     case IOByte:
-        moz_inst_header_dump(ir, ir->type == IByte, 0);
+        moz_inst_header_dump(ir, ir->type == IByte || ir->type == INByte, 0);
         write_char(buf, ((IByte_t *)ir)->byte);
         fprintf(stderr, " byte='%s'\n", buf);
         break;
 
     case IStr:
+    case INStr:
     case IRStr:
     case IOStr:
-        moz_inst_header_dump(ir, ir->type == IStr, 0);
+        moz_inst_header_dump(ir, ir->type == IStr || ir->type == INStr, 0);
         fprintf(stderr, " str='%s'\n",
                 ARRAY_get(pstring_ptr_t, &C->strs, ((IStr_t *)ir)->strId)->str);
         break;
     case ISet:
+    case INSet:
     case IRSet:
     case IOSet:
-        moz_inst_header_dump(ir, ir->type == ISet, 0);
+        moz_inst_header_dump(ir, ir->type == ISet || ir->type == INSet, 0);
         dump_set(ARRAY_get(bitset_t, &C->sets, ((ISet_t *)ir)->setId), buf);
         fprintf(stderr, " set=%s\n", buf);
         break;
@@ -935,6 +1756,17 @@ void moz_inst_dump(moz_compiler_t *C, IR_t *ir)
     case INAny:
         moz_inst_header_dump(ir, ir->type != IRAny, 1);
         break;
+    case ILrEnter:
+    case ILrGrow:
+    case ILrLeave:
+    case ILrSeed:
+        moz_inst_header_dump(ir, 1, 0);
+        fprintf(stderr, " lr=%d\n", ((ILrEnter_t *)ir)->lrId);
+        break;
+    case ICount:
+        moz_inst_header_dump(ir, 0, 0);
+        fprintf(stderr, " counter=%d\n", ((ICount_t *)ir)->counterId);
+        break;
 
     case IUSet:
     case IUByte:
@@ -1036,6 +1868,12 @@ moz_compiler_t *moz_compiler_init(moz_compiler_t *C, moz_runtime_t *R)
     ARRAY_init(pstring_ptr_t, &C->tags, 1);
     ARRAY_init(bitset_t, &C->sets, 1);
     ARRAY_init(block_ptr_t, &C->blocks, 1);
+    C->jmptbl_size = 0;
+    C->slot_size = 0;
+    C->lr_size = 0;
+    C->branch_size = 0;
+    C->branch_profile = NULL;
+    C->branch_profile_size = 0;
     return C;
 }
 
@@ -1046,23 +1884,142 @@ void moz_compiler_dispose(moz_compiler_t *C)
     ARRAY_dispose(pstring_ptr_t, &C->tags);
     ARRAY_dispose(bitset_t, &C->sets);
     ARRAY_dispose(decl_ptr_t, &C->decls);
+    if (C->branch_profile) {
+        VM_FREE(C->branch_profile);
+    }
+}
+
+/* read "<branch> <success> <failure>" lines after "branches <size>" */
+int moz_compiler_load_profile(moz_compiler_t *C, FILE *fp)
+{
+    char line[128];
+    unsigned size, branch;
+    long success, failure;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (line[0] == '#') {
+            continue;
+        }
+        if (C->branch_profile == NULL && sscanf(line, "branches %u", &size) == 1 &&
+                size <= UINT16_MAX) {
+            C->branch_profile = (long *)VM_CALLOC(size + 1, sizeof(long));
+            C->branch_profile_size = size;
+            continue;
+        }
+        if (C->branch_profile == NULL ||
+                sscanf(line, "%u %ld %ld", &branch, &success, &failure) != 3 ||
+                branch >= C->branch_profile_size) {
+            goto L_broken;
+        }
+        C->branch_profile[branch] = success;
+    }
+    if (C->branch_profile != NULL) {
+        return 1;
+    }
+L_broken:
+    if (C->branch_profile != NULL) {
+        VM_FREE(C->branch_profile);
+        C->branch_profile = NULL;
+        C->branch_profile_size = 0;
+    }
+    return 0;
+}
+
+int moz_compiler_parse_trace(const char *phases, unsigned *trace)
+{
+    static const struct {
+        const char *name;
+        unsigned flag;
+    } table[] = {
+        { "ast",  MOZ_TRACE_AST  },
+        { "ir",   MOZ_TRACE_IR   },
+        { "link", MOZ_TRACE_LINK },
+        { "code", MOZ_TRACE_CODE },
+        { "all",  MOZ_TRACE_ALL  }
+    };
+    const char *p = phases;
+    unsigned i, flags = 0;
+    while (*p) {
+        size_t len = strcspn(p, ",");
+        for (i = 0; i < sizeof(table) / sizeof(table[0]); i++) {
+            if (strlen(table[i].name) == len && strncmp(p, table[i].name, len) == 0) {
+                flags |= table[i].flag;
+                break;
+            }
+        }
+        if (i == sizeof(table) / sizeof(table[0])) {
+            return 0;
+        }
+        p += len;
+        if (*p == ',') {
+            p++;
+        }
+    }
+    *trace = flags;
+    return 1;
 }
 
 moz_module_t *moz_compiler_compile(moz_runtime_t *R, Node *node)
+{
+    return moz_compiler_compile_profiled(R, node, NULL);
+}
+
+moz_module_t *moz_compiler_compile_profiled(moz_runtime_t *R, Node *node, FILE *profile)
 {
     moz_module_t *M;
     moz_compiler_t C;
     moz_compiler_init(&C, R);
+    if (profile != NULL && !moz_compiler_load_profile(&C, profile)) {
+        fprintf(stderr, "warning: broken branch profile, keeping source order\n");
+    }
     moz_node_to_ast(&C, node);
-    moz_ast_dump(&C);
-    moz_ast_to_ir(&C);
-    moz_ir_optimize(&C);
-    moz_ir_dump(&C);
-    M = moz_vm2_module_compile(&C);
+    M = moz_compiler_compile_ast(&C);
     moz_compiler_dispose(&C);
     return M;
 }
 
+moz_module_t *moz_compiler_compile_ast(moz_compiler_t *C)
+{
+    if (moz_compiler_trace & MOZ_TRACE_AST) {
+        moz_ast_dump(C);
+    }
+    moz_ast_to_ir(C);
+    moz_ir_optimize(C);
+    moz_ir_allocate_register(C);
+    if (moz_compiler_trace & MOZ_TRACE_IR) {
+        moz_ir_dump(C);
+    }
+    return moz_vm2_module_compile(C);
+}
+
+int moz_compiler_compile_ast_cnez(moz_compiler_t *C, FILE *fp)
+{
+    moz_ast_to_ir(C);
+    moz_ir_optimize(C);
+    return moz_cnez_module_emit(C, fp);
+}
+
+uint8_t *moz_compiler_compile_bytecode(moz_runtime_t *R, Node *node, unsigned *size)
+{
+    uint8_t *code;
+    moz_compiler_t C;
+    moz_compiler_init(&C, R);
+    moz_node_to_ast(&C, node);
+    code = moz_vm1_module_emit(&C, size);
+    moz_compiler_dispose(&C);
+    return code;
+}
+
+int moz_compiler_compile_cnez(moz_runtime_t *R, Node *node, FILE *fp)
+{
+    int emitted;
+    moz_compiler_t C;
+    moz_compiler_init(&C, R);
+    moz_node_to_ast(&C, node);
+    emitted = moz_compiler_compile_ast_cnez(&C, fp);
+    moz_compiler_dispose(&C);
+    return emitted;
+}
+
 void dump_set2(bitset_t *set)
 {
     char buf[1024] = {};
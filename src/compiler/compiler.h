@@ -1,6 +1,7 @@
 #include "mozvm.h"
 #include "node/node.h"
 #include "core/pstring.h"
+#include <stdio.h>
 
 #ifndef MOZ_COMPILER_H
 #define MOZ_COMPILER_H
@@ -39,11 +40,46 @@ typedef struct moz_compiler_t {
     ARRAY(pstring_ptr_t) strs;
     ARRAY(pstring_ptr_t) tags;
     ARRAY(bitset_t) sets;
+    unsigned jmptbl_size;
+    unsigned slot_size;
+    unsigned lr_size;
+    /* attempt and success counters of every Choice alternative (ICount) */
+    unsigned branch_size;
+    /* counters of a previous run, NULL if alternatives keep source order */
+    long *branch_profile;
+    unsigned branch_profile_size;
 } moz_compiler_t;
 
+/* compiler phases dumped to stderr, selected by moz_compiler_trace */
+#define MOZ_TRACE_AST  (1 << 0) /* expressions after moz_ast_optimize */
+#define MOZ_TRACE_IR   (1 << 1) /* IR after register allocation */
+#define MOZ_TRACE_LINK (1 << 2) /* vm2 instruction addresses and label fixups */
+#define MOZ_TRACE_CODE (1 << 3) /* vm2 bytecode of the compiled module */
+#define MOZ_TRACE_ALL  (MOZ_TRACE_AST | MOZ_TRACE_IR | MOZ_TRACE_LINK | MOZ_TRACE_CODE)
+
+/* 0 (nothing is dumped) unless set by the caller */
+extern unsigned moz_compiler_trace;
+/* "ast,ir,link,code" or "all" to MOZ_TRACE_* bits, 0 if a phase is unknown */
+int moz_compiler_parse_trace(const char *phases, unsigned *trace);
+
 moz_compiler_t *moz_compiler_init(moz_compiler_t *C, moz_runtime_t *R);
 void moz_compiler_dispose(moz_compiler_t *C);
 struct moz_module_t *moz_compiler_compile(moz_runtime_t *R, Node *node);
+/* same, reordering Choice alternatives by a profile written by
+ * moz_vm2_module_write_profile (see module.h) */
+struct moz_module_t *moz_compiler_compile_profiled(moz_runtime_t *R, Node *node, FILE *profile);
+/* C->branch_profile from a moz_vm2_module_write_profile file. Returns 0,
+ * leaving C without a profile, if the file is empty or broken */
+int moz_compiler_load_profile(moz_compiler_t *C, FILE *fp);
+/* vm2 module of the decls of C, which moz_ast_optimize has already run on
+ * (grammars built with moz_compiler_get_factory) */
+struct moz_module_t *moz_compiler_compile_ast(moz_compiler_t *C);
+/* .moz bytecode for vm1 (see mozvm_loader_load_syntax), NULL if unsupported */
+uint8_t *moz_compiler_compile_bytecode(moz_runtime_t *R, Node *node, unsigned *size);
+/* C source for src/cli/cnez_main.c, 0 if unsupported */
+int moz_compiler_compile_cnez(moz_runtime_t *R, Node *node, FILE *fp);
+/* same for the decls of C, which moz_ast_optimize has already run on */
+int moz_compiler_compile_ast_cnez(moz_compiler_t *C, FILE *fp);
 void moz_inst_dump(moz_compiler_t *C, struct IR *ir);
 
 #ifdef __cplusplus
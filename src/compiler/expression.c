@@ -3,6 +3,9 @@
 #include "dump.h"
 
 #define MOZC_USE_AST_INLINING 1
+/* max number of expression nodes copied into a caller per inlined call */
+#define MOZC_INLINE_BUDGET         8
+#define MOZC_INLINE_PATTERN_BUDGET 32
 
 DEF_ARRAY_OP_NOPOINTER(decl_ptr_t);
 DEF_ARRAY_OP_NOPOINTER(expr_ptr_t);
@@ -46,7 +49,10 @@ static bool isPatternMatchOnly(expr_t *e)
     case Fail:
         return true;
     case Invoke:
-        return false; /* TODO */
+        if (((Invoke_t *)e)->decl == NULL || ((Invoke_t *)e)->decl->recursive) {
+            return false;
+        }
+        return isPatternMatchOnly(((Invoke_t *)e)->decl->body);
     case And:
     case Not:
     case Option:
@@ -66,6 +72,103 @@ static bool isPatternMatchOnly(expr_t *e)
     return false;
 }
 
+/* first set */
+static bool moz_expr_first(expr_t *e, bitset_t *set);
+
+static bool moz_expr_list_first(ARRAY(expr_ptr_t) *list, bitset_t *set)
+{
+    expr_t **x, **end;
+    FOR_EACH_ARRAY(*list, x, end) {
+        if (!moz_expr_first(*x, set)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void bitset_fill(bitset_t *set)
+{
+    bitset_init(set);
+    bitset_flip(set);
+}
+
+/*
+ * Add to set every byte that may start a successful match of e. Returns true
+ * if e may also succeed without consuming input; in that case the bytes
+ * accepted by the expressions that follow e must be added by the caller.
+ * Invoke reads decl->first and decl->nullable, see moz_ast_compute_first.
+ */
+static bool moz_expr_first(expr_t *e, bitset_t *set)
+{
+    expr_t **x, **end;
+    decl_t *decl;
+    bool nullable = false;
+    switch (e->type) {
+    case Empty:
+        return true;
+    case Fail:
+        return false;
+    case Any:
+        bitset_fill(set);
+        return false;
+    case Byte:
+        bitset_set(set, ((Byte_t *)e)->byte);
+        return false;
+    case Str:
+        if (ARRAY_size(((Str_t *)e)->list) == 0) {
+            return true;
+        }
+        bitset_set(set, ARRAY_get(uint8_t, &((Str_t *)e)->list, 0));
+        return false;
+    case Set:
+        bitset_or(set, &((Set_t *)e)->set);
+        return false;
+    case Option:
+        moz_expr_first(((Option_t *)e)->expr, set);
+        return true;
+    case Repetition:
+        moz_expr_list_first(&((Repetition_t *)e)->list, set);
+        return true;
+    case Sequence:
+        return moz_expr_list_first(&((Sequence_t *)e)->list, set);
+    case Choice:
+        FOR_EACH_ARRAY(((Choice_t *)e)->list, x, end) {
+            nullable |= moz_expr_first(*x, set);
+        }
+        return nullable;
+    case Invoke:
+        decl = ((Invoke_t *)e)->decl;
+        if (decl != NULL) {
+            bitset_or(set, &decl->first);
+            return decl->nullable;
+        }
+        bitset_fill(set);
+        return true;
+    case Xblock:
+        return moz_expr_first(((Xblock_t *)e)->expr, set);
+    case Xlocal:
+    case Xsymbol:
+        return moz_expr_first(((NameUnary_t *)e)->expr, set);
+    case Xis:
+    case Xisa:
+    case Xmatch:
+        /* consumes a symbol that is only known at runtime */
+        bitset_fill(set);
+        return true;
+    default:
+        /* predicates, tree construction and symbol table state */
+        return true;
+    }
+}
+
+void moz_expr_first_set(expr_t *e, bitset_t *set)
+{
+    bitset_init(set);
+    if (moz_expr_first(e, set)) {
+        bitset_fill(set);
+    }
+}
+
 /* decl */
 static decl_t *decl_new()
 {
@@ -87,6 +190,7 @@ decl_t *moz_decl_new(moz_compiler_t *C, const char *name, unsigned len)
 void moz_decl_mark_as_top_level(decl_t *decl)
 {
     MOZ_RC_RETAIN(decl);
+    decl->top_level = 1;
 }
 
 static int moz_decl_use_once(decl_t *decl)
@@ -983,6 +1087,38 @@ static int _moz_List_optimize(moz_compiler_t *C, expr_t *e)
     return modified;
 }
 
+/* number of nodes in e, counting at most limit */
+static unsigned moz_expr_size(expr_t *e, unsigned limit)
+{
+    expr_t **x, **end;
+    unsigned size = 1;
+    switch (e->type) {
+    case And:
+    case Not:
+    case Option:
+    case Xblock:
+        size += moz_expr_size(((Unary_t *)e)->expr, limit);
+        break;
+    case Xlocal:
+    case Xsymbol:
+        size += moz_expr_size(((NameUnary_t *)e)->expr, limit);
+        break;
+    case Choice:
+    case Sequence:
+    case Repetition:
+        FOR_EACH_ARRAY(((List_t *)e)->list, x, end) {
+            if (size > limit) {
+                break;
+            }
+            size += moz_expr_size(*x, limit - size);
+        }
+        break;
+    default:
+        break;
+    }
+    return size;
+}
+
 static void moz_ast_do_inline(expr_t **ref, Invoke_t *expr)
 {
     decl_t *decl = expr->decl;
@@ -993,29 +1129,21 @@ static void moz_ast_do_inline(expr_t **ref, Invoke_t *expr)
 static int moz_Invoke_optimize(moz_compiler_t *C, expr_t *parent, expr_t **ref, expr_t *e)
 {
     Invoke_t *expr = (Invoke_t *)e;
-    if (expr->decl != NULL) {
-        decl_t *decl = expr->decl;
-        if (MOZC_USE_AST_INLINING &&
-                (moz_decl_use_once(decl) || isPatternMatchOnly(decl->body))) {
-            moz_ast_do_inline(ref, expr);
-            return 1;
-        }
-        if (MOZC_USE_AST_INLINING) {
-            // Inline decl body if decl only have single expression.
-            assert(decl->body != NULL);
-            switch (decl->body->type) {
-            case Empty:
-            case Any:
-            case Byte:
-            case Str:
-            case Set:
-            case Fail:
-                moz_ast_do_inline(ref, expr);
-                return 1;
-            default:
-                break;
-            }
-            }
+    decl_t *decl = expr->decl;
+    unsigned size;
+    if (!MOZC_USE_AST_INLINING || decl == NULL || decl->recursive) {
+        return 0;
+    }
+    assert(decl->body != NULL);
+    if (moz_decl_use_once(decl)) {
+        moz_ast_do_inline(ref, expr);
+        return 1;
+    }
+    size = moz_expr_size(decl->body, MOZC_INLINE_PATTERN_BUDGET + 1);
+    if (size <= MOZC_INLINE_BUDGET ||
+            (size <= MOZC_INLINE_PATTERN_BUDGET && isPatternMatchOnly(decl->body))) {
+        moz_ast_do_inline(ref, expr);
+        return 1;
     }
     return 0;
 }
@@ -1073,7 +1201,6 @@ static int moz_Choice_optimize(moz_compiler_t *C, expr_t *parent, expr_t **ref,
     if (ARRAY_size(expr->list) == 1) {
         expr_t *child = ARRAY_get(expr_ptr_t, &expr->list, 0);
         MOZ_RC_ASSIGN(*ref, child, moz_expr_sweep);
-        ARRAY_dispose(expr_ptr_t, &expr->list);
         return 1;
     }
     if (useByteMapOptimization(expr)) {
@@ -1157,6 +1284,78 @@ static expr_t *moz_Sequence_concatByte(Byte_t *b1, Byte_t *b2)
     return (expr_t *)s3;
 }
 
+static bool isClassPredicate(expr_t *e)
+{
+    return (e->type == Not || e->type == And) && isByteOrSet(((Unary_t *)e)->expr);
+}
+
+static void put_class(bitset_t *set, expr_t *e)
+{
+    if (e->type == Byte) {
+        put_byte(set, (Byte_t *)e);
+    }
+    else {
+        put_set(set, (Set_t *)e);
+    }
+}
+
+static int moz_Sequence_fuseClass(Sequence_t *e, int offset)
+{
+    /*
+     * e = [A, Not(Byte('"')), Not(Byte('\\')), Any, C]
+     * -> e = [A, Set[^"\\], C]
+     * e = [A, And(Set[0-9a-f]), Not(Set[a-z]), Set[0-9A-Z], C]
+     * -> e = [A, Set[0-9], C]
+     */
+    int i, last = offset;
+    int size = (int)ARRAY_size(e->list);
+    bitset_t tmp;
+    expr_t *consumer;
+    Set_t *set;
+
+    while (last < size && isClassPredicate(ARRAY_get(expr_ptr_t, &e->list, last))) {
+        last++;
+    }
+    if (last == size) {
+        return 0;
+    }
+    consumer = ARRAY_get(expr_ptr_t, &e->list, last);
+    if (consumer->type != Any && !isByteOrSet(consumer)) {
+        return 0;
+    }
+    set = EXPR_ALLOC_T(Set);
+    bitset_init(&set->set);
+    if (consumer->type == Any) {
+        //XXX Should not accept '\0'
+        bitset_set(&set->set, 0);
+        bitset_flip(&set->set);
+    }
+    else {
+        put_class(&set->set, consumer);
+    }
+    for (i = offset; i < last; i++) {
+        Unary_t *pred = (Unary_t *)ARRAY_get(expr_ptr_t, &e->list, i);
+        bitset_init(&tmp);
+        put_class(&tmp, pred->expr);
+        if (pred->base.type == Not) {
+            bitset_flip(&tmp);
+        }
+        bitset_and(&set->set, &tmp);
+    }
+    for (i = last; i >= offset; i--) {
+        expr_t *child = ARRAY_get(expr_ptr_t, &e->list, i);
+        if (i == offset) {
+            ARRAY_set(expr_ptr_t, &e->list, i, (expr_t *)set);
+            MOZ_RC_RETAIN((expr_t *)set);
+        }
+        else {
+            ARRAY_remove(expr_ptr_t, &e->list, i);
+        }
+        MOZ_RC_RELEASE(child, moz_expr_sweep);
+    }
+    return 1;
+}
+
 static int _moz_Sequence_optimize(moz_compiler_t *C, Sequence_t *e)
 {
     int modified = 0;
@@ -1167,6 +1366,7 @@ static int _moz_Sequence_optimize(moz_compiler_t *C, Sequence_t *e)
         if (child->type == Sequence) {
             Sequence_t *seq = (Sequence_t *)child;
             moz_Sequence_do_flatten(e, i, seq);
+            child = ARRAY_get(expr_ptr_t, &e->list, i);
             modified = 1;
         }
 
@@ -1185,6 +1385,7 @@ static int _moz_Sequence_optimize(moz_compiler_t *C, Sequence_t *e)
                 MOZ_RC_RELEASE(child, moz_expr_sweep);
                 MOZ_RC_RELEASE(child2, moz_expr_sweep);
                 ARRAY_remove(expr_ptr_t, &e->list, i + 1);
+                child = expr;
                 modified = 1;
             }
         }
@@ -1215,6 +1416,7 @@ static int _moz_Sequence_optimize(moz_compiler_t *C, Sequence_t *e)
                 MOZ_RC_RETAIN(expr);
                 MOZ_RC_RELEASE(child, moz_expr_sweep);
                 MOZ_RC_RELEASE(child2, moz_expr_sweep);
+                child = expr;
                 modified = 1;
             }
             else {
@@ -1225,26 +1427,9 @@ static int _moz_Sequence_optimize(moz_compiler_t *C, Sequence_t *e)
          * e = [A, Not(Byte('4'), Any, C]
          * -> e = [A, Set[^4], C]
          */
-        if (child->type == Not && i + 1 < (int)ARRAY_size(e->list)) {
-            Not_t *not = (Not_t *)(child);
-            expr_t *child2 = ARRAY_get(expr_ptr_t, &e->list, i + 1);
-            if (not->expr->type == Byte) {
-                Byte_t *byte = (Byte_t *)not->expr;
-                if (child2->type == Any) {
-                    Set_t *set = EXPR_ALLOC_T(Set);
-                    bitset_init(&set->set);
-                    bitset_set(&set->set, byte->byte);
-                    //XXX Should not accept '\0'
-                    bitset_set(&set->set, 0);
-                    bitset_flip(&set->set);
-                    ARRAY_set(expr_ptr_t, &e->list, i, (expr_t *)set);
-                    ARRAY_remove(expr_ptr_t, &e->list, i + 1);
-                    MOZ_RC_RETAIN((expr_t *)set);
-                    MOZ_RC_RELEASE(child, moz_expr_sweep);
-                    MOZ_RC_RELEASE(child2, moz_expr_sweep);
-                    modified = 1;
-                }
-            }
+        child = ARRAY_get(expr_ptr_t, &e->list, i);
+        if (isClassPredicate(child)) {
+            modified |= moz_Sequence_fuseClass(e, i);
         }
     }
     return modified;
@@ -1274,7 +1459,6 @@ static int moz_Sequence_optimize(moz_compiler_t *C, expr_t *parent, expr_t **ref
 
     if (ARRAY_size(expr->list) == 1) {
         MOZ_RC_ASSIGN(*ref, ARRAY_get(expr_ptr_t, &expr->list, 0), moz_expr_sweep);
-        ARRAY_dispose(expr_ptr_t, &expr->list);
         return 1;
     }
     return modified;
@@ -1302,6 +1486,337 @@ static int moz_expr_optimize(moz_compiler_t *C, expr_t *parent, expr_t **ref, ex
     return optimize[e->type](C, parent, ref, e);
 }
 
+/* reachability */
+static unsigned moz_decl_visit_epoch = 0;
+
+static bool moz_decl_reach(decl_t *decl, decl_t *target, unsigned epoch);
+
+/* mark every decl invoked from e; returns true if target is invoked */
+static bool moz_expr_reach(expr_t *e, decl_t *target, unsigned epoch)
+{
+    expr_t **x, **end;
+    switch (e->type) {
+    case Invoke:
+        if (((Invoke_t *)e)->decl == NULL) {
+            return false;
+        }
+        if (((Invoke_t *)e)->decl == target) {
+            return true;
+        }
+        return moz_decl_reach(((Invoke_t *)e)->decl, target, epoch);
+    case And:
+    case Not:
+    case Option:
+    case Xblock:
+        return moz_expr_reach(((Unary_t *)e)->expr, target, epoch);
+    case Xlocal:
+    case Xsymbol:
+        return moz_expr_reach(((NameUnary_t *)e)->expr, target, epoch);
+    case Choice:
+    case Sequence:
+    case Repetition:
+        FOR_EACH_ARRAY(((List_t *)e)->list, x, end) {
+            if (moz_expr_reach(*x, target, epoch)) {
+                return true;
+            }
+        }
+        return false;
+    default:
+        return false;
+    }
+}
+
+static bool moz_decl_reach(decl_t *decl, decl_t *target, unsigned epoch)
+{
+    if (decl->visit == epoch) {
+        return false;
+    }
+    decl->visit = epoch;
+    return decl->body != NULL && moz_expr_reach(decl->body, target, epoch);
+}
+
+/* Tarjan's strongly connected components of the call graph */
+typedef struct moz_scc_t {
+    ARRAY(decl_ptr_t) stack;
+    unsigned index;
+} moz_scc_t;
+
+static void moz_decl_scc(moz_scc_t *S, decl_t *decl);
+
+static void moz_expr_scc(moz_scc_t *S, decl_t *decl, expr_t *e)
+{
+    expr_t **x, **end;
+    decl_t *callee;
+    switch (e->type) {
+    case Invoke:
+        callee = ((Invoke_t *)e)->decl;
+        if (callee == NULL) {
+            break;
+        }
+        if (callee == decl) {
+            decl->recursive = 1;
+        }
+        if (callee->scc_index == 0) {
+            moz_decl_scc(S, callee);
+            if (callee->scc_low < decl->scc_low) {
+                decl->scc_low = callee->scc_low;
+            }
+        }
+        else if (callee->scc_on_stack && callee->scc_index < decl->scc_low) {
+            decl->scc_low = callee->scc_index;
+        }
+        break;
+    case And:
+    case Not:
+    case Option:
+    case Xblock:
+        moz_expr_scc(S, decl, ((Unary_t *)e)->expr);
+        break;
+    case Xlocal:
+    case Xsymbol:
+        moz_expr_scc(S, decl, ((NameUnary_t *)e)->expr);
+        break;
+    case Choice:
+    case Sequence:
+    case Repetition:
+        FOR_EACH_ARRAY(((List_t *)e)->list, x, end) {
+            moz_expr_scc(S, decl, *x);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void moz_decl_scc(moz_scc_t *S, decl_t *decl)
+{
+    decl_t *member;
+    bool cycle;
+    decl->scc_index = decl->scc_low = ++S->index;
+    decl->scc_on_stack = 1;
+    ARRAY_add(decl_ptr_t, &S->stack, decl);
+    if (decl->body != NULL) {
+        moz_expr_scc(S, decl, decl->body);
+    }
+    if (decl->scc_low != decl->scc_index) {
+        return;
+    }
+    /* decl is the root of a component; every member of a component with
+     * more than one decl is on a cycle */
+    cycle = *ARRAY_last(S->stack) != decl;
+    do {
+        member = ARRAY_pop(decl_ptr_t, &S->stack);
+        member->scc_on_stack = 0;
+        if (cycle) {
+            member->recursive = 1;
+        }
+    } while (member != decl);
+}
+
+/*
+ * A decl is recursive if it lies on a cycle of the call graph. Inlining
+ * never creates new cycles, so this only needs to run once. O(D + E).
+ */
+static void moz_ast_mark_recursive_decl(moz_compiler_t *C)
+{
+    decl_t **decl, **end;
+    moz_scc_t S;
+    S.index = 0;
+    ARRAY_init(decl_ptr_t, &S.stack, 4);
+    FOR_EACH_ARRAY(C->decls, decl, end) {
+        (*decl)->recursive = 0;
+        (*decl)->scc_index = 0;
+    }
+    FOR_EACH_ARRAY(C->decls, decl, end) {
+        if ((*decl)->scc_index == 0) {
+            moz_decl_scc(&S, *decl);
+        }
+    }
+    ARRAY_dispose(decl_ptr_t, &S.stack);
+}
+
+/* left recursion */
+static bool moz_expr_nullable(expr_t *e)
+{
+    expr_t **x, **end;
+    switch (e->type) {
+    case Fail:
+    case Any:
+    case Byte:
+    case Set:
+        return false;
+    case Str:
+        return ARRAY_size(((Str_t *)e)->list) == 0;
+    case Invoke:
+        return ((Invoke_t *)e)->decl == NULL || ((Invoke_t *)e)->decl->nullable;
+    case Sequence:
+        FOR_EACH_ARRAY(((List_t *)e)->list, x, end) {
+            if (!moz_expr_nullable(*x)) {
+                return false;
+            }
+        }
+        return true;
+    case Choice:
+        FOR_EACH_ARRAY(((List_t *)e)->list, x, end) {
+            if (moz_expr_nullable(*x)) {
+                return true;
+            }
+        }
+        return false;
+    case Xblock:
+        return moz_expr_nullable(((Unary_t *)e)->expr);
+    case Xlocal:
+    case Xsymbol:
+        return moz_expr_nullable(((NameUnary_t *)e)->expr);
+    default:
+        /* Empty, Option, Repetition, And, Not and the other operators */
+        return true;
+    }
+}
+
+static void moz_decl_mark_left_recursion(decl_t *decl, unsigned epoch);
+
+/* visit every decl that e may invoke before consuming input */
+static void moz_expr_mark_left_recursion(expr_t *e, unsigned epoch)
+{
+    expr_t **x, **end;
+    switch (e->type) {
+    case Invoke:
+        if (((Invoke_t *)e)->decl != NULL) {
+            moz_decl_mark_left_recursion(((Invoke_t *)e)->decl, epoch);
+        }
+        break;
+    case And:
+    case Not:
+    case Option:
+    case Xblock:
+        moz_expr_mark_left_recursion(((Unary_t *)e)->expr, epoch);
+        break;
+    case Xlocal:
+    case Xsymbol:
+        moz_expr_mark_left_recursion(((NameUnary_t *)e)->expr, epoch);
+        break;
+    case Sequence:
+    case Repetition:
+        FOR_EACH_ARRAY(((List_t *)e)->list, x, end) {
+            moz_expr_mark_left_recursion(*x, epoch);
+            if (!moz_expr_nullable(*x)) {
+                break;
+            }
+        }
+        break;
+    case Choice:
+        FOR_EACH_ARRAY(((List_t *)e)->list, x, end) {
+            moz_expr_mark_left_recursion(*x, epoch);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/* visit is epoch while decl is on the DFS stack and epoch + 1 after */
+static void moz_decl_mark_left_recursion(decl_t *decl, unsigned epoch)
+{
+    if (decl->visit == epoch) {
+        decl->left_recursive = 1;
+        return;
+    }
+    if (decl->visit == epoch + 1) {
+        return;
+    }
+    decl->visit = epoch;
+    if (decl->body != NULL) {
+        moz_expr_mark_left_recursion(decl->body, epoch);
+    }
+    decl->visit = epoch + 1;
+}
+
+/*
+ * Every cycle of left calls has a DFS back edge, so marking the targets of
+ * back edges puts a growing production (see ILrEnter) on each of them.
+ */
+static void moz_ast_mark_left_recursive_decl(moz_compiler_t *C)
+{
+    decl_t **decl, **end;
+    unsigned epoch;
+    int modified = 1;
+    FOR_EACH_ARRAY(C->decls, decl, end) {
+        (*decl)->nullable = 0;
+        (*decl)->left_recursive = 0;
+    }
+    while (modified) {
+        modified = 0;
+        FOR_EACH_ARRAY(C->decls, decl, end) {
+            if (!(*decl)->nullable && (*decl)->body != NULL &&
+                    moz_expr_nullable((*decl)->body)) {
+                (*decl)->nullable = 1;
+                modified = 1;
+            }
+        }
+    }
+    epoch = ++moz_decl_visit_epoch;
+    ++moz_decl_visit_epoch;
+    FOR_EACH_ARRAY(C->decls, decl, end) {
+        moz_decl_mark_left_recursion(*decl, epoch);
+    }
+}
+
+/*
+ * FIRST sets only grow while the bodies are re-evaluated, so iterating to a
+ * fixed point gives every decl, left-recursive ones included, the least set.
+ * Requires decl->nullable (moz_ast_mark_left_recursive_decl).
+ */
+static void moz_ast_compute_first(moz_compiler_t *C)
+{
+    decl_t **decl, **end;
+    bitset_t set;
+    int modified = 1;
+    FOR_EACH_ARRAY(C->decls, decl, end) {
+        bitset_init(&(*decl)->first);
+    }
+    while (modified) {
+        modified = 0;
+        FOR_EACH_ARRAY(C->decls, decl, end) {
+            if ((*decl)->body == NULL) {
+                continue;
+            }
+            bitset_copy(&set, &(*decl)->first);
+            moz_expr_first((*decl)->body, &set);
+            if (!bitset_equal(&set, &(*decl)->first)) {
+                bitset_copy(&(*decl)->first, &set);
+                modified = 1;
+            }
+        }
+    }
+}
+
+/*
+ * Reference counts keep unreachable cycles of decls alive. Cut the body of
+ * every decl that cannot be reached from a top-level decl so that
+ * moz_ast_remove_unused_decl frees them.
+ */
+static int moz_ast_drop_unreachable_decl(moz_compiler_t *C)
+{
+    decl_t **decl, **end;
+    int modified = 0;
+    unsigned epoch = ++moz_decl_visit_epoch;
+    FOR_EACH_ARRAY(C->decls, decl, end) {
+        if ((*decl)->top_level) {
+            moz_decl_reach(*decl, NULL, epoch);
+        }
+    }
+    FOR_EACH_ARRAY(C->decls, decl, end) {
+        if ((*decl)->visit != epoch &&
+                (*decl)->body != NULL && (*decl)->body->type != Empty) {
+            expr_t **ref = &(*decl)->body;
+            MOZ_RC_ASSIGN(*ref, moz_expr_new_Empty(C), moz_expr_sweep);
+            modified = 1;
+        }
+    }
+    return modified;
+}
+
 static void moz_ast_mark_live_decl(moz_compiler_t *C)
 {
     decl_t **decl, **end;
@@ -1332,6 +1847,7 @@ static void moz_ast_remove_unused_decl(moz_compiler_t *C)
 void moz_ast_optimize(moz_compiler_t *C)
 {
     int modified = 1;
+    moz_ast_mark_recursive_decl(C);
     while (modified) {
         decl_t **decl, **end;
         modified = 0;
@@ -1339,8 +1855,11 @@ void moz_ast_optimize(moz_compiler_t *C)
         FOR_EACH_ARRAY(C->decls, decl, end) {
             modified |= moz_expr_optimize(C, NULL, &(*decl)->body, (*decl)->body);
         }
+        modified |= moz_ast_drop_unreachable_decl(C);
         moz_ast_remove_unused_decl(C);
     }
+    moz_ast_mark_left_recursive_decl(C);
+    moz_ast_compute_first(C);
 }
 
 /* sweep */
@@ -1385,6 +1904,7 @@ static void moz_List_sweep(List_t *e)
     FOR_EACH_ARRAY(e->list, x, end) {
         MOZ_RC_RELEASE(*x, moz_expr_sweep);
     }
+    ARRAY_dispose(expr_ptr_t, &e->list);
     memset(e, 0, sizeof(*e));
     VM_FREE(e);
 }
@@ -67,6 +67,14 @@ typedef struct decl {
     name_t name;
     struct expr *body;
     struct block_t *inst;
+    unsigned top_level : 1;
+    unsigned recursive : 1;
+    unsigned left_recursive : 1;
+    unsigned nullable : 1;
+    unsigned scc_on_stack : 1;
+    unsigned visit;
+    unsigned scc_index, scc_low; /* moz_ast_mark_recursive_decl */
+    bitset_t first; /* FIRST set of body, filled by moz_ast_optimize */
 } decl_t;
 
 typedef struct expr {
@@ -128,6 +136,7 @@ typedef struct And_t {
 typedef struct Choice_t {
     expr_t base;
     ARRAY(expr_ptr_t) list;
+    unsigned branch; /* 1 + branch profile index of list[0], 0 if none */
 } Choice_t;
 
 typedef struct Empty_t {
@@ -249,6 +258,11 @@ void moz_ast_optimize(moz_compiler_t *C);
 void moz_ast_dump(moz_compiler_t *C);
 void moz_decl_sweep(decl_t *decl);
 void moz_expr_sweep(expr_t *e);
+/* set contains every byte at which e may succeed (all bytes if e is nullable) */
+void moz_expr_first_set(expr_t *e, bitset_t *set);
+/* group bytes by the alternatives that may match them (compiler.c); masks
+ * holds MOZ_IR_TABLE_JUMP_SIZE entries */
+unsigned moz_Choice_predict(Choice_t *e, uint64_t *masks, uint8_t jumps[256]);
 
 /* Expression factory */
 typedef const struct moz_expr_factory_t {
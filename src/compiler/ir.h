@@ -9,6 +9,8 @@
     OP(IInvoke) \
     OP(IPLoad) \
     OP(IPStore) \
+    OP(IPLoadR) \
+    OP(IPStoreR) \
     OP(IRet) \
     OP(IFail) \
     OP(IAny) \
@@ -35,6 +37,11 @@
     OP(ILookup) \
     OP(IMemo) \
     OP(IMemoFail) \
+    OP(ILrEnter) \
+    OP(ILrGrow) \
+    OP(ILrLeave) \
+    OP(ILrSeed) \
+    OP(ICount) \
     OP(ITStart) \
     OP(ITCommit) \
     OP(ITAbort) \
@@ -95,9 +102,13 @@ typedef struct IJump {
     } v;
 } IJump_t;
 
+#define MOZ_IR_TABLE_JUMP_SIZE 8 /* jump_table3_t */
+
 typedef struct ITableJump {
     VMIR_BASE;
     uint16_t tblId;
+    struct block_t *targets[MOZ_IR_TABLE_JUMP_SIZE];
+    uint8_t jumps[256]; /* index of targets for each input byte */
 } ITableJump_t;
 
 typedef struct IInvoke {
@@ -108,13 +119,21 @@ typedef struct IInvoke {
     } v;
 } IInvoke_t;
 
+#define MOZ_IR_REGISTER_SIZE 8 /* position registers of vm2 */
+
+/* IPStore/IPLoad pairs sharing a slot save and restore the same position.
+ * IPStoreR/IPLoadR keep it in register `reg` instead of the stack. */
 typedef struct IPLoad {
     VMIR_BASE;
-} IPLoad_t;
+    unsigned slot;
+    uint8_t reg;
+} IPLoad_t, IPLoadR_t;
 
 typedef struct IPStore {
     VMIR_BASE;
-} IPStore_t;
+    unsigned slot;
+    uint8_t reg;
+} IPStore_t, IPStoreR_t;
 
 typedef struct IRet {
     VMIR_BASE;
@@ -245,6 +264,19 @@ typedef struct IMemoFail {
     uint16_t memoId;
 } IMemoFail_t;
 
+/* Seed growing for a left-recursive production; lrId indexes the
+ * runtime seed table. */
+typedef struct ILrEnter {
+    VMIR_BASE;
+    uint16_t lrId;
+} ILrEnter_t, ILrGrow_t, ILrLeave_t, ILrSeed_t;
+
+/* Branch counter of MOZVM_PROFILE_INST builds (see moz_Choice_to_ir) */
+typedef struct ICount {
+    VMIR_BASE;
+    uint16_t counterId;
+} ICount_t;
+
 typedef struct ITStart {
     VMIR_BASE;
 } ITStart_t;
@@ -317,38 +349,38 @@ typedef struct ISClose {
 
 typedef struct ISMask {
     VMIR_BASE;
-    TAG_t tagId;
+    TBL_t tblId;
 } ISMask_t;
 
 typedef struct ISDef {
     VMIR_BASE;
-    TAG_t tagId;
+    TBL_t tblId;
 } ISDef_t;
 
 typedef struct ISIsDef {
     VMIR_BASE;
-    TAG_t tagId;
+    TBL_t tblId;
     STRING_t strId;
 } ISIsDef_t;
 
 typedef struct ISExists {
     VMIR_BASE;
-    TAG_t tagId;
+    TBL_t tblId;
 } ISExists_t;
 
 typedef struct ISMatch {
     VMIR_BASE;
-    TAG_t tagId;
+    TBL_t tblId;
 } ISMatch_t;
 
 typedef struct ISIs {
     VMIR_BASE;
-    TAG_t tagId;
+    TBL_t tblId;
 } ISIs_t;
 
 typedef struct ISIsa {
     VMIR_BASE;
-    TAG_t tagId;
+    TBL_t tblId;
 } ISIsa_t;
 
 /* Internal API */
@@ -1,5 +1,6 @@
 #include "module.h"
 #include "core/karray.h"
+#include "jmptbl.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -53,7 +54,9 @@ static void mozlinker_resolve(mozlinker_t *linker, uint8_t *code)
 {
     unsigned i;
     assert(ARRAY_size(linker->labels) == ARRAY_size(linker->targets));
-    mozlinker_dump_address(linker);
+    if (moz_compiler_trace & MOZ_TRACE_LINK) {
+        mozlinker_dump_address(linker);
+    }
     for (i = 0; i < ARRAY_size(linker->labels); i++) {
         /*
          * bytecode format
@@ -67,8 +70,10 @@ static void mozlinker_resolve(mozlinker_t *linker, uint8_t *code)
         mozaddr_t labelOffset = *ARRAY_n(linker->labels, i);
         mozaddr_t targetId = *ARRAY_n(linker->targets, i);
         int callerId = *(int *)(code + labelOffset);
-        fprintf(stderr, "labelOffset:%d, targetId:%d, callerId:%d\n",
-                labelOffset, targetId, callerId);
+        if (moz_compiler_trace & MOZ_TRACE_LINK) {
+            fprintf(stderr, "labelOffset:%d, targetId:%d, callerId:%d\n",
+                    labelOffset, targetId, callerId);
+        }
         mozaddr_t *addr = (mozaddr_t *)(code + labelOffset);
         moz_inst_t *callee_addr_head = code + linker->address_head[targetId];
         moz_inst_t *caller_addr_tail = code + linker->address_tail[callerId];
@@ -76,6 +81,22 @@ static void mozlinker_resolve(mozlinker_t *linker, uint8_t *code)
     }
 }
 
+static void mozlinker_resolve_jump_table(mozlinker_t *linker, ITableJump_t *ir, jump_table3_t *tbl)
+{
+    unsigned i;
+    int targets[MOZ_IR_TABLE_JUMP_SIZE];
+    int jumps[256];
+    mozaddr_t caller_addr_tail = linker->address_tail[ir->base.id];
+    for (i = 0; i < MOZ_IR_TABLE_JUMP_SIZE; i++) {
+        IR_t *first = ARRAY_get(IR_ptr_t, &ir->targets[i]->insts, 0);
+        targets[i] = (int)(linker->address_head[first->id] - caller_addr_tail);
+    }
+    for (i = 0; i < 256; i++) {
+        jumps[i] = targets[ir->jumps[i]];
+    }
+    jump_table3_init(tbl, targets, jumps);
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -4,6 +4,8 @@
 #include "ir.h"
 #include "expression.h"
 #include "block.h"
+#include "vm1_opcode.h"
+#include <ctype.h>
 #define MOZVM_MOZVM2_DUMP 1
 
 #define dump_opcode(out, R, opcode)  fprintf(out, "%s ", IR_TYPE_NAME[opcode]);
@@ -14,6 +16,7 @@
 #define dump_BITSET_t(out, R, setId) fprintf(out, "set(%d) ", setId);
 #define dump_STRING_t(out, R, strId) fprintf(out, "'%s' ", R->C.strs[strId]);
 #define dump_TAG_t(out, R, tagId)    fprintf(out, "'%s' ", R->C.tags[tagId]);
+#define dump_TBL_t(out, R, tblId)    fprintf(out, "'%s' ", R->C.tables[tblId]);
 #include "vm2_inst.h"
 #include "linker.c"
 
@@ -102,6 +105,16 @@ static moz_vm2_module_t *moz_vm2_module_new(moz_compiler_t *C, uint8_t *code_beg
             M->base.runtime->C.tags[i++] = (*x)->str;
         }
     }
+#ifdef MOZVM_PROFILE_INST
+    if (C->branch_size) {
+        M->base.runtime->C.profile = (long *) VM_CALLOC(C->branch_size, sizeof(long));
+        M->base.runtime->C.profile_size = C->branch_size;
+    }
+#endif
+    if (C->lr_size) {
+        M->base.runtime->C.lr_size = C->lr_size;
+        M->base.runtime->seeds = (moz_lr_seed_t *) VM_CALLOC(C->lr_size, sizeof(moz_lr_seed_t));
+    }
     M->compiled_code = code_begin;
     M->compiled_code_end = M->compiled_code + code_size;
     return M;
@@ -129,7 +142,8 @@ static void moz_IJump_encode(moz_bytecode_writer_t *W, IJump_t *ir)
 
 static void moz_ITableJump_encode(moz_bytecode_writer_t *W, ITableJump_t *ir)
 {
-    TODO((IR_t *)ir);
+    /* targets are resolved into runtime->C.jumps3 by the linker */
+    moz_buffer_writer_write16(&W->writer, ir->tblId);
 }
 
 static void moz_IInvoke_encode(moz_bytecode_writer_t *W, IInvoke_t *ir)
@@ -148,6 +162,16 @@ static void moz_IPStore_encode(moz_bytecode_writer_t *W, IPStore_t *ir)
     /* do nothing */
 }
 
+static void moz_IPLoadR_encode(moz_bytecode_writer_t *W, IPLoadR_t *ir)
+{
+    moz_buffer_writer_write8(&W->writer, ir->reg);
+}
+
+static void moz_IPStoreR_encode(moz_bytecode_writer_t *W, IPStoreR_t *ir)
+{
+    moz_buffer_writer_write8(&W->writer, ir->reg);
+}
+
 static void moz_IRet_encode(moz_bytecode_writer_t *W, IRet_t *ir)
 {
     /* do nothing */
@@ -284,6 +308,35 @@ static void moz_IMemoFail_encode(moz_bytecode_writer_t *W, IMemoFail_t *ir)
     TODO((IR_t *)ir);
 }
 
+static void moz_ILrEnter_encode(moz_bytecode_writer_t *W, ILrEnter_t *ir)
+{
+    mozlinker_add_label(&W->linker, &W->writer, ir->base.fail, ir->base.id);
+    moz_buffer_writer_write16(&W->writer, ir->lrId);
+}
+
+static void moz_ILrGrow_encode(moz_bytecode_writer_t *W, ILrGrow_t *ir)
+{
+    mozlinker_add_label(&W->linker, &W->writer, ir->base.fail, ir->base.id);
+    moz_buffer_writer_write16(&W->writer, ir->lrId);
+}
+
+static void moz_ILrLeave_encode(moz_bytecode_writer_t *W, ILrLeave_t *ir)
+{
+    mozlinker_add_label(&W->linker, &W->writer, ir->base.fail, ir->base.id);
+    moz_buffer_writer_write16(&W->writer, ir->lrId);
+}
+
+static void moz_ILrSeed_encode(moz_bytecode_writer_t *W, ILrSeed_t *ir)
+{
+    mozlinker_add_label(&W->linker, &W->writer, ir->base.fail, ir->base.id);
+    moz_buffer_writer_write16(&W->writer, ir->lrId);
+}
+
+static void moz_ICount_encode(moz_bytecode_writer_t *W, ICount_t *ir)
+{
+    moz_buffer_writer_write16(&W->writer, ir->counterId);
+}
+
 static void moz_ITStart_encode(moz_bytecode_writer_t *W, ITStart_t *ir)
 {
     TODO((IR_t *)ir);
@@ -402,8 +455,10 @@ static unsigned moz_ir_encode(moz_bytecode_writer_t *W, IR_t *ir)
     encode[ir->type](W, ir);
     W->linker.address_head[ir->id] = pos;
     W->linker.address_tail[ir->id] = moz_buffer_writer_length(&W->writer);
-    fprintf(stderr, "id:%03d addr=(%u, %u)\n",
-            ir->id, pos, moz_buffer_writer_length(&W->writer));
+    if (moz_compiler_trace & MOZ_TRACE_LINK) {
+        fprintf(stderr, "id:%03d addr=(%u, %u)\n",
+                ir->id, pos, moz_buffer_writer_length(&W->writer));
+    }
     return pos;
 }
 
@@ -443,11 +498,917 @@ moz_module_t *moz_vm2_module_compile(struct moz_compiler_t *C)
             moz_buffer_writer_length(&W.writer));
     mozlinker_resolve(&W.linker, code);
     M = moz_vm2_module_new(C, code, moz_buffer_writer_length(&W.writer));
+    if (C->jmptbl_size > 0) {
+        jump_table3_t *tables;
+        tables = (jump_table3_t *) VM_CALLOC(C->jmptbl_size, sizeof(jump_table3_t));
+        FOR_EACH_ARRAY(C->blocks, I, E) {
+            IR_t **x, **e;
+            FOR_EACH_ARRAY((*I)->insts, x, e) {
+                if ((*x)->type == ITableJump) {
+                    ITableJump_t *ir = (ITableJump_t *)*x;
+                    mozlinker_resolve_jump_table(&W.linker, ir, tables + ir->tblId);
+                }
+            }
+        }
+        M->base.runtime->C.jumps3 = tables;
+    }
     moz_buffer_writer_dispose(&W.writer);
     mozlinker_dispose(&W.linker);
     return (moz_module_t *) M;
 }
 
+int moz_vm2_module_write_profile(moz_module_t *M, FILE *fp)
+{
+#ifdef MOZVM_PROFILE_INST
+    mozvm_constant_t *C = &M->runtime->C;
+    unsigned i;
+    if (C->profile == NULL) {
+        return 0;
+    }
+    fprintf(fp, "# mozvm branch profile: <branch> <success> <failure>\n");
+    fprintf(fp, "branches %u\n", C->profile_size / 2);
+    for (i = 0; i < C->profile_size; i += 2) {
+        fprintf(fp, "%u %ld %ld\n", i / 2, C->profile[i + 1],
+                C->profile[i] - C->profile[i + 1]);
+    }
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/* vm1 bytecode (.moz) emitter */
+
+#define MOZ1_NEZ_VERSION    0
+#define MOZ1_UNBOUND_LABEL  ((unsigned)-1)
+
+typedef struct moz_vm1_patch_t {
+    unsigned offset;
+    unsigned label;
+} moz_vm1_patch_t;
+
+typedef unsigned moz_vm1_label_t;
+typedef name_t *name_ptr_t;
+
+DEF_ARRAY_T_OP(moz_vm1_patch_t);
+DEF_ARRAY_T_OP_NOPOINTER(moz_vm1_label_t);
+DEF_ARRAY_T_OP_NOPOINTER(name_ptr_t);
+
+typedef struct moz_vm1_writer_t {
+    moz_compiler_t *compiler;
+    ARRAY(uint8_t) code;
+    unsigned inst_size;
+    unsigned jmptbl_size;
+    int error;
+    int *prods;                     /* decl index -> production id */
+    ARRAY(moz_vm1_label_t) labels;  /* label -> instruction index */
+    ARRAY(moz_vm1_patch_t) patches; /* 24-bit operands to resolve */
+    ARRAY(expr_ptr_t) strs;
+    ARRAY(expr_ptr_t) sets;
+    ARRAY(name_ptr_t) tags;
+} moz_vm1_writer_t;
+
+/* .moz is big endian */
+static void moz_vm1_write_be(ARRAY(uint8_t) *buf, uint32_t v, unsigned bytes)
+{
+    while (bytes-- > 0) {
+        ARRAY_add(uint8_t, buf, (uint8_t)(v >> (8 * bytes)));
+    }
+}
+
+static void moz_vm1_write_str(ARRAY(uint8_t) *buf, const char *str, unsigned len)
+{
+    unsigned i;
+    moz_vm1_write_be(buf, len, 2);
+    for (i = 0; i < len; i++) {
+        ARRAY_add(uint8_t, buf, str[i]);
+    }
+    ARRAY_add(uint8_t, buf, 0);
+}
+
+static void moz_vm1_op(moz_vm1_writer_t *W, enum moz_vm1_opcode op)
+{
+    ARRAY_add(uint8_t, &W->code, op);
+    W->inst_size++;
+}
+
+static unsigned moz_vm1_new_label(moz_vm1_writer_t *W)
+{
+    ARRAY_add(moz_vm1_label_t, &W->labels, MOZ1_UNBOUND_LABEL);
+    return ARRAY_size(W->labels) - 1;
+}
+
+static void moz_vm1_bind_label(moz_vm1_writer_t *W, unsigned label)
+{
+    ARRAY_set(moz_vm1_label_t, &W->labels, label, W->inst_size);
+}
+
+static void moz_vm1_addr(moz_vm1_writer_t *W, unsigned label)
+{
+    moz_vm1_patch_t patch = { ARRAY_size(W->code), label };
+    ARRAY_add(moz_vm1_patch_t, &W->patches, &patch);
+    moz_vm1_write_be(&W->code, 0, 3);
+}
+
+static unsigned moz_vm1_add_str(moz_vm1_writer_t *W, Str_t *e)
+{
+    expr_t **x, **end;
+    FOR_EACH_ARRAY(W->strs, x, end) {
+        Str_t *s = (Str_t *)*x;
+        if (ARRAY_size(s->list) == ARRAY_size(e->list) &&
+                memcmp(s->list.list, e->list.list, ARRAY_size(e->list)) == 0) {
+            return x - ARRAY_BEGIN(W->strs);
+        }
+    }
+    ARRAY_add(expr_ptr_t, &W->strs, (expr_t *)e);
+    return ARRAY_size(W->strs) - 1;
+}
+
+static unsigned moz_vm1_add_set(moz_vm1_writer_t *W, Set_t *e)
+{
+    expr_t **x, **end;
+    FOR_EACH_ARRAY(W->sets, x, end) {
+        if (memcmp(&((Set_t *)*x)->set, &e->set, sizeof(bitset_t)) == 0) {
+            return x - ARRAY_BEGIN(W->sets);
+        }
+    }
+    ARRAY_add(expr_ptr_t, &W->sets, (expr_t *)e);
+    return ARRAY_size(W->sets) - 1;
+}
+
+static unsigned moz_vm1_add_tag(moz_vm1_writer_t *W, name_t *name)
+{
+    name_t **x, **end;
+    FOR_EACH_ARRAY(W->tags, x, end) {
+        if ((*x)->len == name->len &&
+                strncmp((*x)->str, name->str, name->len) == 0) {
+            return x - ARRAY_BEGIN(W->tags);
+        }
+    }
+    ARRAY_add(name_ptr_t, &W->tags, name);
+    return ARRAY_size(W->tags) - 1;
+}
+
+static void moz_vm1_emit_expr(moz_vm1_writer_t *W, expr_t *e);
+
+static void moz_vm1_emit_class(moz_vm1_writer_t *W, enum moz_vm1_opcode op, expr_t *e)
+{
+    moz_vm1_op(W, op);
+    switch (e->type) {
+    case Byte:
+        ARRAY_add(uint8_t, &W->code, ((Byte_t *)e)->byte);
+        break;
+    case Str:
+        moz_vm1_write_be(&W->code, moz_vm1_add_str(W, (Str_t *)e), 2);
+        break;
+    case Set:
+        moz_vm1_write_be(&W->code, moz_vm1_add_set(W, (Set_t *)e), 2);
+        break;
+    default:
+        break;
+    }
+}
+
+/* op for Byte, Str and Set (in this order); 0 if e is none of them */
+static int moz_vm1_class_op(expr_t *e, int byte, int str, int set)
+{
+    switch (e->type) {
+    case Byte:
+        return byte;
+    case Str:
+        return str;
+    case Set:
+        return set;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Alt next1; E1; Succ; Jump end
+ * next1: Alt next2; E2; Succ; Jump end
+ * next2: E3; Jump end
+ */
+static void moz_vm1_emit_alternatives(moz_vm1_writer_t *W, expr_t **alts, unsigned size, unsigned end)
+{
+    unsigned i;
+    if (size == 0) {
+        moz_vm1_op(W, MOZ1_Fail);
+        return;
+    }
+    for (i = 0; i < size; i++) {
+        unsigned next = 0;
+        if (i + 1 < size) {
+            next = moz_vm1_new_label(W);
+            moz_vm1_op(W, MOZ1_Alt);
+            moz_vm1_addr(W, next);
+        }
+        moz_vm1_emit_expr(W, alts[i]);
+        if (i + 1 < size) {
+            moz_vm1_op(W, MOZ1_Succ);
+        }
+        moz_vm1_op(W, MOZ1_Jump);
+        moz_vm1_addr(W, end);
+        if (i + 1 < size) {
+            moz_vm1_bind_label(W, next);
+        }
+    }
+}
+
+static void moz_vm1_emit_Choice(moz_vm1_writer_t *W, Choice_t *e)
+{
+    unsigned i, k, c, size = ARRAY_size(e->list);
+    unsigned end = moz_vm1_new_label(W);
+    uint64_t masks[MOZ_IR_TABLE_JUMP_SIZE];
+    uint8_t jumps[256];
+    unsigned groups;
+    expr_t *alts[size];
+
+    if ((groups = moz_Choice_predict(e, masks, jumps)) > 0) {
+        /* First dispatches each byte to the alternatives that may match
+         * it; the loader turns it into TblJump1/2/3. */
+        unsigned heads[MOZ_IR_TABLE_JUMP_SIZE];
+        for (k = 0; k < groups; k++) {
+            heads[k] = moz_vm1_new_label(W);
+        }
+        moz_vm1_op(W, MOZ1_First);
+        for (c = 0; c < 256; c++) {
+            moz_vm1_addr(W, heads[jumps[c]]);
+        }
+        moz_vm1_addr(W, heads[jumps[0]]); /* 257th entry is unused */
+        W->jmptbl_size++;
+        for (k = 0; k < groups; k++) {
+            unsigned n = 0;
+            for (i = 0; i < size; i++) {
+                if (masks[k] & (1ULL << i)) {
+                    alts[n++] = ARRAY_get(expr_ptr_t, &e->list, i);
+                }
+            }
+            moz_vm1_bind_label(W, heads[k]);
+            moz_vm1_emit_alternatives(W, alts, n, end);
+        }
+    }
+    else {
+        for (i = 0; i < size; i++) {
+            alts[i] = ARRAY_get(expr_ptr_t, &e->list, i);
+        }
+        moz_vm1_emit_alternatives(W, alts, size, end);
+    }
+    moz_vm1_bind_label(W, end);
+}
+
+static void moz_vm1_emit_expr(moz_vm1_writer_t *W, expr_t *e)
+{
+    expr_t **x, **end;
+    unsigned label, label2;
+    int op;
+
+    switch (e->type) {
+    case Empty:
+        break;
+    case Invoke: {
+        Invoke_t *invoke = (Invoke_t *)e;
+        int id = ARRAY_index(decl_ptr_t, &W->compiler->decls, invoke->decl);
+        label = moz_vm1_new_label(W);
+        moz_vm1_op(W, MOZ1_Call);
+        moz_vm1_addr(W, label);
+        moz_vm1_write_be(&W->code, W->prods[id], 2);
+        moz_vm1_addr(W, id);
+        moz_vm1_bind_label(W, label);
+        break;
+    }
+    case Any:
+        moz_vm1_op(W, MOZ1_Any);
+        break;
+    case Byte:
+    case Str:
+    case Set:
+        moz_vm1_emit_class(W, moz_vm1_class_op(e, MOZ1_Byte, MOZ1_Str, MOZ1_Set), e);
+        break;
+    case Fail:
+        moz_vm1_op(W, MOZ1_Fail);
+        break;
+    case And:
+        moz_vm1_op(W, MOZ1_Pos);
+        moz_vm1_emit_expr(W, ((And_t *)e)->expr);
+        moz_vm1_op(W, MOZ1_Back);
+        break;
+    case Not:
+        e = ((Not_t *)e)->expr;
+        if (e->type == Any) {
+            moz_vm1_op(W, MOZ1_NAny);
+        }
+        else if ((op = moz_vm1_class_op(e, MOZ1_NByte, MOZ1_NStr, MOZ1_NSet))) {
+            moz_vm1_emit_class(W, (enum moz_vm1_opcode)op, e);
+        }
+        else {
+            /* Alt L; E; Succ; Fail; L: */
+            label = moz_vm1_new_label(W);
+            moz_vm1_op(W, MOZ1_Alt);
+            moz_vm1_addr(W, label);
+            moz_vm1_emit_expr(W, e);
+            moz_vm1_op(W, MOZ1_Succ);
+            moz_vm1_op(W, MOZ1_Fail);
+            moz_vm1_bind_label(W, label);
+        }
+        break;
+    case Option:
+        e = ((Option_t *)e)->expr;
+        if ((op = moz_vm1_class_op(e, MOZ1_OByte, MOZ1_OStr, MOZ1_OSet))) {
+            moz_vm1_emit_class(W, (enum moz_vm1_opcode)op, e);
+        }
+        else {
+            /* Alt L; E; Succ; L: */
+            label = moz_vm1_new_label(W);
+            moz_vm1_op(W, MOZ1_Alt);
+            moz_vm1_addr(W, label);
+            moz_vm1_emit_expr(W, e);
+            moz_vm1_op(W, MOZ1_Succ);
+            moz_vm1_bind_label(W, label);
+        }
+        break;
+    case Choice:
+        moz_vm1_emit_Choice(W, (Choice_t *)e);
+        break;
+    case Sequence:
+        FOR_EACH_ARRAY(((Sequence_t *)e)->list, x, end) {
+            moz_vm1_emit_expr(W, *x);
+        }
+        break;
+    case Repetition: {
+        Repetition_t *rep = (Repetition_t *)e;
+        if (ARRAY_size(rep->list) == 1 &&
+                (op = moz_vm1_class_op(ARRAY_get(expr_ptr_t, &rep->list, 0),
+                                       MOZ1_RByte, MOZ1_RStr, MOZ1_RSet))) {
+            moz_vm1_emit_class(W, (enum moz_vm1_opcode)op,
+                    ARRAY_get(expr_ptr_t, &rep->list, 0));
+            break;
+        }
+        /* Alt end; loop: E; Skip; Jump loop; end: */
+        label  = moz_vm1_new_label(W);
+        label2 = moz_vm1_new_label(W);
+        moz_vm1_op(W, MOZ1_Alt);
+        moz_vm1_addr(W, label2);
+        moz_vm1_bind_label(W, label);
+        FOR_EACH_ARRAY(rep->list, x, end) {
+            moz_vm1_emit_expr(W, *x);
+        }
+        moz_vm1_op(W, MOZ1_Skip);
+        moz_vm1_op(W, MOZ1_Jump);
+        moz_vm1_addr(W, label);
+        moz_vm1_bind_label(W, label2);
+        break;
+    }
+    case Tcapture:
+        moz_vm1_op(W, MOZ1_TCapture);
+        ARRAY_add(uint8_t, &W->code, 0);
+        break;
+    case Tnew:
+        moz_vm1_op(W, MOZ1_TNew);
+        ARRAY_add(uint8_t, &W->code, 0);
+        break;
+    case Tpush:
+        moz_vm1_op(W, MOZ1_TPush);
+        break;
+    case Tpop:
+        moz_vm1_op(W, MOZ1_TPop);
+        moz_vm1_write_be(&W->code, moz_vm1_add_tag(W, &((Tpop_t *)e)->name), 2);
+        break;
+    case Ttag:
+        moz_vm1_op(W, MOZ1_TTag);
+        moz_vm1_write_be(&W->code, moz_vm1_add_tag(W, &((Ttag_t *)e)->name), 2);
+        break;
+    case Xblock:
+        moz_vm1_op(W, MOZ1_SOpen);
+        moz_vm1_emit_expr(W, ((Xblock_t *)e)->expr);
+        moz_vm1_op(W, MOZ1_SClose);
+        break;
+    default:
+        /* the AST keeps no operands for these (see moz_*_to_ir) */
+        W->error = 1;
+        break;
+    }
+}
+
+static void moz_vm1_writer_dispose(moz_vm1_writer_t *W)
+{
+    ARRAY_dispose(uint8_t, &W->code);
+    ARRAY_dispose(moz_vm1_label_t, &W->labels);
+    ARRAY_dispose(moz_vm1_patch_t, &W->patches);
+    ARRAY_dispose(expr_ptr_t, &W->strs);
+    ARRAY_dispose(expr_ptr_t, &W->sets);
+    ARRAY_dispose(name_ptr_t, &W->tags);
+}
+
+uint8_t *moz_vm1_module_emit(moz_compiler_t *C, unsigned *size)
+{
+    moz_vm1_writer_t W;
+    ARRAY(uint8_t) out;
+    decl_t **decl, **decl_end;
+    moz_vm1_patch_t *patch, *patch_end;
+    expr_t **x, **end;
+    name_t **name, **name_end;
+    unsigned i, j, prod_size = 0;
+    int prods[ARRAY_size(C->decls) + 1];
+    uint8_t *code = NULL;
+
+    memset(&W, 0, sizeof(W));
+    W.compiler = C;
+    W.prods = prods;
+    ARRAY_init(uint8_t, &W.code, 64);
+    ARRAY_init(moz_vm1_label_t, &W.labels, ARRAY_size(C->decls) + 1);
+    ARRAY_init(moz_vm1_patch_t, &W.patches, 4);
+    ARRAY_init(expr_ptr_t, &W.strs, 1);
+    ARRAY_init(expr_ptr_t, &W.sets, 1);
+    ARRAY_init(name_ptr_t, &W.tags, 1);
+    ARRAY_init(uint8_t, &out, 64);
+
+    /* label i is the entry of C->decls[i]; the first decl is the start */
+    FOR_EACH_ARRAY(C->decls, decl, decl_end) {
+        unsigned id = moz_vm1_new_label(&W);
+        prods[id] = MOZ_RC_COUNT(*decl) > 0 ? (int)prod_size++ : -1;
+    }
+    FOR_EACH_ARRAY(C->decls, decl, decl_end) {
+        unsigned id = decl - ARRAY_BEGIN(C->decls);
+        if (prods[id] < 0) {
+            continue;
+        }
+        if ((*decl)->left_recursive) {
+            /* vm1 has no seed table, the call would never return */
+            W.error = 1;
+        }
+        moz_vm1_bind_label(&W, id);
+        moz_vm1_op(&W, MOZ1_Label);
+        moz_vm1_write_be(&W.code, prods[id], 2);
+        moz_vm1_emit_expr(&W, (*decl)->body);
+        moz_vm1_op(&W, MOZ1_Ret);
+    }
+    if (W.error || W.inst_size > UINT16_MAX) {
+        goto L_finally;
+    }
+    FOR_EACH_ARRAY(W.patches, patch, patch_end) {
+        unsigned target = ARRAY_get(moz_vm1_label_t, &W.labels, patch->label);
+        assert(target != MOZ1_UNBOUND_LABEL);
+        W.code.list[patch->offset + 0] = (uint8_t)(target >> 16);
+        W.code.list[patch->offset + 1] = (uint8_t)(target >> 8);
+        W.code.list[patch->offset + 2] = (uint8_t)(target);
+    }
+
+    ARRAY_add(uint8_t, &out, 'N');
+    ARRAY_add(uint8_t, &out, 'E');
+    ARRAY_add(uint8_t, &out, 'Z');
+    ARRAY_add(uint8_t, &out, MOZ1_NEZ_VERSION);
+    moz_vm1_write_be(&out, W.inst_size, 2);
+    moz_vm1_write_be(&out, 0, 2); /* memo_size */
+    moz_vm1_write_be(&out, W.jmptbl_size, 2);
+    moz_vm1_write_be(&out, prod_size, 2);
+    FOR_EACH_ARRAY(C->decls, decl, decl_end) {
+        if (MOZ_RC_COUNT(*decl) > 0) {
+            moz_vm1_write_str(&out, (*decl)->name.str, (*decl)->name.len);
+        }
+    }
+    moz_vm1_write_be(&out, ARRAY_size(W.sets), 2);
+    FOR_EACH_ARRAY(W.sets, x, end) {
+        bitset_t *set = &((Set_t *)*x)->set;
+        for (i = 0; i < 256; i += 32) {
+            uint32_t v = 0;
+            for (j = 0; j < 32; j++) {
+                if (bitset_get(set, i + j)) {
+                    v |= 1U << j;
+                }
+            }
+            moz_vm1_write_be(&out, v, 4);
+        }
+    }
+    moz_vm1_write_be(&out, ARRAY_size(W.strs), 2);
+    FOR_EACH_ARRAY(W.strs, x, end) {
+        Str_t *str = (Str_t *)*x;
+        moz_vm1_write_str(&out, (const char *)str->list.list, ARRAY_size(str->list));
+    }
+    moz_vm1_write_be(&out, ARRAY_size(W.tags), 2);
+    FOR_EACH_ARRAY(W.tags, name, name_end) {
+        moz_vm1_write_str(&out, (*name)->str, (*name)->len);
+    }
+    moz_vm1_write_be(&out, 0, 2); /* symbol tables */
+    for (i = 0; i < ARRAY_size(W.code); i++) {
+        ARRAY_add(uint8_t, &out, W.code.list[i]);
+    }
+    *size = ARRAY_size(out);
+    code = buffer_copy(out.list, ARRAY_size(out));
+
+L_finally:
+    ARRAY_dispose(uint8_t, &out);
+    moz_vm1_writer_dispose(&W);
+    return code;
+}
+
+/* C source emitter (driven by src/cli/cnez_main.c) */
+
+typedef struct moz_cnez_writer_t {
+    moz_compiler_t *compiler;
+    FILE *fp;
+    ARRAY(block_ptr_t) targets; /* blocks reached by goto in a function */
+} moz_cnez_writer_t;
+
+static int moz_cnez_supported(IR_t *ir)
+{
+    switch (ir->type) {
+    case ILabel:    case IJump:    case ITableJump: case IInvoke:
+    case IPLoad:    case IPStore:  case IPLoadR:    case IPStoreR:
+    case IRet:      case IFail:    case IAny:       case IByte:
+    case IStr:      case ISet:     case INAny:      case INByte:
+    case INStr:     case INSet:    case IRAny:      case IRByte:
+    case IRStr:     case IRSet:    case IOByte:     case IOStr:
+    case IOSet:     case ITPush:   case ITPop:      case ITNew:
+    case ITCapture: case ITTag:    case ICount:
+        return 1;
+    default:
+        /* these need the vm stack (or are not emitted by moz_ast_to_ir) */
+        return 0;
+    }
+}
+
+static int moz_cnez_may_fail(IR_t *ir)
+{
+    switch (ir->type) {
+    case IInvoke: case IAny:  case IByte:  case IStr:  case ISet:
+    case INAny:   case INByte: case INStr: case INSet:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static void moz_cnez_write_cstr(FILE *fp, const char *str, unsigned len)
+{
+    unsigned i;
+    fputc('"', fp);
+    for (i = 0; i < len; i++) {
+        uint8_t c = str[i];
+        if (c == '"' || c == '\\' || c == '?' || c < 0x20 || c >= 0x7f) {
+            fprintf(fp, "\\%03o", c);
+        }
+        else {
+            fputc(c, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+/* p<index>_<name> with every non-identifier character replaced by '_' */
+static void moz_cnez_write_func_name(moz_cnez_writer_t *W, decl_t *decl)
+{
+    unsigned i;
+    fprintf(W->fp, "p%d_", ARRAY_index(decl_ptr_t, &W->compiler->decls, decl));
+    for (i = 0; i < decl->name.len; i++) {
+        char c = decl->name.str[i];
+        fputc(isalnum((uint8_t)c) ? c : '_', W->fp);
+    }
+}
+
+static void moz_cnez_write_table(FILE *fp, const char *name, unsigned id, uint8_t *table)
+{
+    unsigned i;
+    fprintf(fp, "static const uint8_t %s%u[256] = {", name, id);
+    for (i = 0; i < 256; i++) {
+        fprintf(fp, "%s%d,", i % 32 == 0 ? "\n    " : "", table[i]);
+    }
+    fprintf(fp, "\n};\n");
+}
+
+/* number of targets the byte table actually uses */
+static unsigned moz_cnez_table_size(ITableJump_t *tbl)
+{
+    unsigned c, size = 0;
+    for (c = 0; c < 256; c++) {
+        if (tbl->jumps[c] >= size) {
+            size = tbl->jumps[c] + 1;
+        }
+    }
+    return size;
+}
+
+static void moz_cnez_add_target(moz_cnez_writer_t *W, block_t *bb)
+{
+    block_t **x, **e;
+    FOR_EACH_ARRAY(W->targets, x, e) {
+        if (*x == bb) {
+            return;
+        }
+    }
+    ARRAY_add(block_ptr_t, &W->targets, bb);
+}
+
+static int moz_cnez_is_target(moz_cnez_writer_t *W, block_t *bb)
+{
+    block_t **x, **e;
+    FOR_EACH_ARRAY(W->targets, x, e) {
+        if (*x == bb) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* bytes at or past the end of input read as the NUL appended by load_file,
+ * so only patterns containing 0 need an explicit EOS test. vm2 has no such
+ * test and matches that NUL as input: the two only differ there. */
+static int moz_cnez_set_has_nul(moz_compiler_t *C, BITSET_t setId)
+{
+    return bitset_get(ARRAY_n(C->sets, setId), 0);
+}
+
+static void moz_cnez_write_ir(moz_cnez_writer_t *W, IR_t *ir)
+{
+    FILE *fp = W->fp;
+    moz_compiler_t *C = W->compiler;
+    unsigned fail = ir->fail ? ir->fail->id : 0;
+    pstring_t *str;
+    unsigned i;
+
+    switch (ir->type) {
+    case ILabel:
+    case ICount:
+        break;
+    case IJump:
+        fprintf(fp, "    goto L%u;\n", ((IJump_t *)ir)->v.target->id);
+        break;
+    case ITableJump: {
+        ITableJump_t *tbl = (ITableJump_t *)ir;
+        unsigned size = moz_cnez_table_size(tbl);
+        fprintf(fp, "    switch (jump%d[(uint8_t)*cur]) {\n", tbl->tblId);
+        for (i = 0; i + 1 < size; i++) {
+            fprintf(fp, "    case %u: goto L%u;\n", i, tbl->targets[i]->id);
+        }
+        fprintf(fp, "    default: goto L%u;\n", tbl->targets[i]->id);
+        fprintf(fp, "    }\n");
+        break;
+    }
+    case IInvoke:
+        fprintf(fp, "    ctx->cur = cur;\n    if (");
+        moz_cnez_write_func_name(W, ((IInvoke_t *)ir)->v.decl);
+        fprintf(fp, "(ctx)) {\n        goto L%u;\n    }\n    cur = ctx->cur;\n", fail);
+        break;
+    case IPLoad:
+    case IPLoadR:
+        fprintf(fp, "    cur = pos%u;\n", ((IPLoad_t *)ir)->slot);
+        break;
+    case IPStore:
+    case IPStoreR:
+        fprintf(fp, "    pos%u = cur;\n", ((IPStore_t *)ir)->slot);
+        break;
+    case IRet:
+        fprintf(fp, "    ctx->cur = cur;\n    return 0;\n");
+        break;
+    case IFail:
+        fprintf(fp, "    return 1;\n");
+        break;
+    case IAny:
+        fprintf(fp, "    if (cur == TAIL(ctx)) {\n        goto L%u;\n    }\n    cur++;\n", fail);
+        break;
+    case IByte:
+        fprintf(fp, "    if (%s(uint8_t)*cur != %d) {\n        goto L%u;\n    }\n    cur++;\n",
+                ((IByte_t *)ir)->byte == 0 ? "cur == TAIL(ctx) || " : "",
+                ((IByte_t *)ir)->byte, fail);
+        break;
+    case IStr:
+        str = *ARRAY_n(C->strs, ((IStr_t *)ir)->strId);
+        fprintf(fp, "    if (TAIL(ctx) - cur < %u || memcmp(cur, str%d, %u) != 0) {\n"
+                "        goto L%u;\n    }\n    cur += %u;\n",
+                str->len, ((IStr_t *)ir)->strId, str->len, fail, str->len);
+        break;
+    case ISet:
+        fprintf(fp, "    if (%s!set%d[(uint8_t)*cur]) {\n        goto L%u;\n    }\n    cur++;\n",
+                moz_cnez_set_has_nul(C, ((ISet_t *)ir)->setId) ? "cur == TAIL(ctx) || " : "",
+                ((ISet_t *)ir)->setId, fail);
+        break;
+    case INAny:
+        fprintf(fp, "    if (cur != TAIL(ctx)) {\n        goto L%u;\n    }\n", fail);
+        break;
+    case INByte:
+        fprintf(fp, "    if (%s(uint8_t)*cur == %d) {\n        goto L%u;\n    }\n",
+                ((INByte_t *)ir)->byte == 0 ? "cur != TAIL(ctx) && " : "",
+                ((INByte_t *)ir)->byte, fail);
+        break;
+    case INStr:
+        str = *ARRAY_n(C->strs, ((INStr_t *)ir)->strId);
+        fprintf(fp, "    if (TAIL(ctx) - cur >= %u && memcmp(cur, str%d, %u) == 0) {\n"
+                "        goto L%u;\n    }\n",
+                str->len, ((INStr_t *)ir)->strId, str->len, fail);
+        break;
+    case INSet:
+        fprintf(fp, "    if (%sset%d[(uint8_t)*cur]) {\n        goto L%u;\n    }\n",
+                moz_cnez_set_has_nul(C, ((INSet_t *)ir)->setId) ? "cur != TAIL(ctx) && " : "",
+                ((INSet_t *)ir)->setId, fail);
+        break;
+    case IRAny:
+        fprintf(fp, "    cur = TAIL(ctx);\n");
+        break;
+    case IRByte:
+        fprintf(fp, "    while (%s(uint8_t)*cur == %d) {\n        cur++;\n    }\n",
+                ((IRByte_t *)ir)->byte == 0 ? "cur != TAIL(ctx) && " : "",
+                ((IRByte_t *)ir)->byte);
+        break;
+    case IRStr:
+        str = *ARRAY_n(C->strs, ((IRStr_t *)ir)->strId);
+        fprintf(fp, "    while (TAIL(ctx) - cur >= %u && memcmp(cur, str%d, %u) == 0) {\n"
+                "        cur += %u;\n    }\n",
+                str->len, ((IRStr_t *)ir)->strId, str->len, str->len);
+        break;
+    case IRSet:
+        fprintf(fp, "    while (%sset%d[(uint8_t)*cur]) {\n        cur++;\n    }\n",
+                moz_cnez_set_has_nul(C, ((IRSet_t *)ir)->setId) ? "cur != TAIL(ctx) && " : "",
+                ((IRSet_t *)ir)->setId);
+        break;
+    case IOByte:
+        fprintf(fp, "    if (%s(uint8_t)*cur == %d) {\n        cur++;\n    }\n",
+                ((IOByte_t *)ir)->byte == 0 ? "cur != TAIL(ctx) && " : "",
+                ((IOByte_t *)ir)->byte);
+        break;
+    case IOStr:
+        str = *ARRAY_n(C->strs, ((IOStr_t *)ir)->strId);
+        fprintf(fp, "    if (TAIL(ctx) - cur >= %u && memcmp(cur, str%d, %u) == 0) {\n"
+                "        cur += %u;\n    }\n",
+                str->len, ((IOStr_t *)ir)->strId, str->len, str->len);
+        break;
+    case IOSet:
+        fprintf(fp, "    if (%sset%d[(uint8_t)*cur]) {\n        cur++;\n    }\n",
+                moz_cnez_set_has_nul(C, ((IOSet_t *)ir)->setId) ? "cur != TAIL(ctx) && " : "",
+                ((IOSet_t *)ir)->setId);
+        break;
+    case ITPush:
+        fprintf(fp, "    ast_log_push(ctx->ast);\n");
+        break;
+    case ITPop:
+        fprintf(fp, "    ast_log_pop(ctx->ast, %d);\n", ((ITPop_t *)ir)->tagId);
+        break;
+    case ITNew:
+        fprintf(fp, "    ast_log_new(ctx->ast, (mozpos_t)(cur + %d));\n", ((ITNew_t *)ir)->shift);
+        break;
+    case ITCapture:
+        fprintf(fp, "    ast_log_capture(ctx->ast, (mozpos_t)(cur + %d));\n", ((ITCapture_t *)ir)->shift);
+        break;
+    case ITTag:
+        fprintf(fp, "    ast_log_tag(ctx->ast, global_tag_list[%d]);\n", ((ITTag_t *)ir)->tagId);
+        break;
+    default:
+        assert(0 && "unreachable");
+        break;
+    }
+}
+
+/* blocks from decl->inst up to the next entry block form one function */
+static void moz_cnez_write_func(moz_cnez_writer_t *W, decl_t *decl, block_t **begin, block_t **end)
+{
+    FILE *fp = W->fp;
+    unsigned slot, slot_size = W->compiler->slot_size;
+    uint8_t slots[slot_size + 1];
+    block_t **I;
+    IR_t **x, **e;
+
+    memset(slots, 0, slot_size + 1);
+    ARRAY_size(W->targets) = 0;
+    for (I = begin; I != end; I++) {
+        FOR_EACH_ARRAY((*I)->insts, x, e) {
+            IR_t *ir = *x;
+            if (moz_cnez_may_fail(ir)) {
+                moz_cnez_add_target(W, ir->fail);
+            }
+            switch (ir->type) {
+            case IJump:
+                moz_cnez_add_target(W, ((IJump_t *)ir)->v.target);
+                break;
+            case ITableJump: {
+                unsigned i;
+                ITableJump_t *tbl = (ITableJump_t *)ir;
+                for (i = 0; i < moz_cnez_table_size(tbl); i++) {
+                    moz_cnez_add_target(W, tbl->targets[i]);
+                }
+                break;
+            }
+            case IPLoad: case IPLoadR: case IPStore: case IPStoreR:
+                slots[((IPLoad_t *)ir)->slot] = 1;
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    fprintf(fp, "\n/* %.*s */\nstatic int ", decl->name.len, decl->name.str);
+    moz_cnez_write_func_name(W, decl);
+    fprintf(fp, "(ParsingContext ctx)\n{\n    char *cur = ctx->cur;\n");
+    for (slot = 0; slot < slot_size; slot++) {
+        if (slots[slot]) {
+            fprintf(fp, "    char *pos%u;\n", slot);
+        }
+    }
+    for (I = begin; I != end; I++) {
+        if (moz_cnez_is_target(W, *I)) {
+            fprintf(fp, "L%u:\n", (*I)->id);
+        }
+        FOR_EACH_ARRAY((*I)->insts, x, e) {
+            moz_cnez_write_ir(W, *x);
+        }
+    }
+    fprintf(fp, "}\n");
+}
+
+int moz_cnez_module_emit(moz_compiler_t *C, FILE *fp)
+{
+    moz_cnez_writer_t W;
+    block_t **I, **E, **begin;
+    decl_t **decl, **decl_end, *start = NULL;
+    IR_t **x, **e;
+    pstring_t **str, **str_end;
+    bitset_t *set, *set_end;
+    unsigned i;
+
+    FOR_EACH_ARRAY(C->blocks, I, E) {
+        FOR_EACH_ARRAY((*I)->insts, x, e) {
+            if (!moz_cnez_supported(*x)) {
+                return 0;
+            }
+        }
+    }
+    W.compiler = C;
+    W.fp = fp;
+    ARRAY_init(block_ptr_t, &W.targets, 4);
+
+    fprintf(fp, "/* generated by mozvm. build with src/cli/cnez_main.c and libnez */\n");
+    fprintf(fp, "#include <stdio.h>\n#include <stdlib.h>\n#include <string.h>\n");
+    fprintf(fp, "#include \"memory.h\"\n#include \"cli/cnez.h\"\n\n");
+    fprintf(fp, "#define CNEZ_ENABLE_AST_CONSTRUCTION 1\n");
+    fprintf(fp, "#define CNEZ_FLAG_TABLE_SIZE 0\n#define CNEZ_MEMO_SIZE 0\n\n");
+
+    fprintf(fp, "const char *global_tag_list[] = {\n");
+    FOR_EACH_ARRAY(C->tags, str, str_end) {
+        fprintf(fp, "    ");
+        moz_cnez_write_cstr(fp, (*str)->str, (*str)->len);
+        fprintf(fp, ",\n");
+    }
+    fprintf(fp, "    NULL\n};\n\n");
+    i = 0;
+    FOR_EACH_ARRAY(C->strs, str, str_end) {
+        fprintf(fp, "static const char str%u[] = ", i++);
+        moz_cnez_write_cstr(fp, (*str)->str, (*str)->len);
+        fprintf(fp, ";\n");
+    }
+    i = 0;
+    FOR_EACH_ARRAY(C->sets, set, set_end) {
+        uint8_t table[256];
+        unsigned c;
+        for (c = 0; c < 256; c++) {
+            table[c] = bitset_get(set, c);
+        }
+        moz_cnez_write_table(fp, "set", i++, table);
+    }
+    FOR_EACH_ARRAY(C->blocks, I, E) {
+        FOR_EACH_ARRAY((*I)->insts, x, e) {
+            if ((*x)->type == ITableJump) {
+                ITableJump_t *tbl = (ITableJump_t *)*x;
+                moz_cnez_write_table(fp, "jump", tbl->tblId, tbl->jumps);
+            }
+        }
+    }
+
+    fprintf(fp, "\n");
+    FOR_EACH_ARRAY(C->decls, decl, decl_end) {
+        if (MOZ_RC_COUNT(*decl) > 0) {
+            fprintf(fp, "static int ");
+            moz_cnez_write_func_name(&W, *decl);
+            fprintf(fp, "(ParsingContext ctx);\n");
+            start = start ? start : *decl;
+        }
+    }
+    begin = NULL;
+    FOR_EACH_ARRAY(C->blocks, I, E) {
+        if ((*I)->type & BLOCK_ENTRY) {
+            if (begin) {
+                FOR_EACH_ARRAY(C->decls, decl, decl_end) {
+                    if ((*decl)->inst == *begin) {
+                        moz_cnez_write_func(&W, *decl, begin, I);
+                    }
+                }
+            }
+            begin = I;
+        }
+    }
+    if (begin) {
+        FOR_EACH_ARRAY(C->decls, decl, decl_end) {
+            if ((*decl)->inst == *begin) {
+                moz_cnez_write_func(&W, *decl, begin, E);
+            }
+        }
+    }
+
+    fprintf(fp, "\nstatic int pFile(ParsingContext ctx)\n{\n    return ");
+    moz_cnez_write_func_name(&W, start);
+    fprintf(fp, "(ctx);\n}\n\n#include \"cli/cnez_main.c\"\n");
+    ARRAY_dispose(block_ptr_t, &W.targets);
+    return 1;
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,6 +1,7 @@
 #include "libnez/ast.h"
 #include "libnez/symtable.h"
 #include "libnez/memo.h"
+#include <stdio.h>
 
 #ifndef MOZ_MODULE_H
 #define MOZ_MODULE_H
@@ -21,6 +22,15 @@ struct moz_module_t {
 struct moz_compiler_t;
 /* Internal API */
 moz_module_t *moz_vm2_module_compile(struct moz_compiler_t *C);
+/* Choice counters of the last parses for moz_compiler_compile_profiled,
+ * 0 unless built with MOZVM_PROFILE_INST */
+int moz_vm2_module_write_profile(moz_module_t *M, FILE *fp);
+/* .moz bytecode for mozvm_loader_load_syntax, or NULL if C uses an
+ * expression vm1 cannot express. The caller frees the buffer. */
+uint8_t *moz_vm1_module_emit(struct moz_compiler_t *C, unsigned *size);
+/* C source of a parser for src/cli/cnez_main.c, 0 if C uses an
+ * instruction the C backend does not support */
+int moz_cnez_module_emit(struct moz_compiler_t *C, FILE *fp);
 
 #ifdef __cplusplus
 }
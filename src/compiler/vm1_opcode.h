@@ -0,0 +1,73 @@
+/****************************************************************************
+ * Copyright (c) 2016, Masahiro Ide <imasahiro9 at gmail.com>
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ***************************************************************************/
+
+#ifndef MOZ_VM1_OPCODE_H
+#define MOZ_VM1_OPCODE_H
+
+/* Opcodes of vm1/instruction.h the .moz emitter uses. That header cannot be
+ * included by the compiler since its enum MozOpcode and expr_type_t both
+ * define Byte, Any, Str, Set, ... loader.c checks every entry against
+ * MozOpcode at compile time. */
+#define MOZ1_OP_EACH(F) \
+    F(Fail,      1)\
+    F(Alt,       2)\
+    F(Succ,      3)\
+    F(Jump,      4)\
+    F(Call,      5)\
+    F(Ret,       6)\
+    F(Pos,       7)\
+    F(Back,      8)\
+    F(Skip,      9)\
+    F(Byte,     10)\
+    F(Any,      11)\
+    F(Str,      12)\
+    F(Set,      13)\
+    F(NByte,    14)\
+    F(NAny,     15)\
+    F(NStr,     16)\
+    F(NSet,     17)\
+    F(OByte,    18)\
+    F(OStr,     20)\
+    F(OSet,     21)\
+    F(RByte,    22)\
+    F(RStr,     24)\
+    F(RSet,     25)\
+    F(First,    27)\
+    F(TPush,    31)\
+    F(TPop,     32)\
+    F(TNew,     34)\
+    F(TCapture, 35)\
+    F(TTag,     36)\
+    F(SOpen,    43)\
+    F(SClose,   44)\
+    F(Label,   127)
+
+enum moz_vm1_opcode {
+#define MOZ1_DEFINE_OPCODE(OP, N) MOZ1_##OP = N,
+    MOZ1_OP_EACH(MOZ1_DEFINE_OPCODE)
+#undef MOZ1_DEFINE_OPCODE
+    MOZ1_OPCODE_MAX
+};
+
+#endif /* end of include guard */
@@ -101,6 +101,17 @@ static inline int bitset_equal(bitset_t *set1, bitset_t *set2)
     return memcmp(set1, set2, sizeof(*set1)) == 0;
 }
 
+static inline int bitset_disjoint(bitset_t *set1, bitset_t *set2)
+{
+    unsigned i;
+    for (i = 0; i < 256 / BITS; i++) {
+        if (set1->data[i] & set2->data[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,5 +1,7 @@
 #include "ast.h"
+#include "core/pstring.h"
 #include <stdio.h>
+#include <string.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -57,7 +59,9 @@ AstMachine *AstMachine_init(unsigned log_size, const char *source)
     ARRAY_ensureSize(AstLog, &ast->logs, log_size);
     ast->last_linked = NULL;
     ast->source = source;
+    ast->tag_list = NULL;
     ast->parsed = NULL;
+    memset(&ast->stream, 0, sizeof(ast->stream));
     return ast;
 }
 
@@ -109,6 +113,9 @@ static void AstMachine_dumpLog(AstMachine *ast)
         case TypePush:
             fprintf(stderr, "[%d] %02d push()\n", i, id);
             break;
+        case TypeStart:
+            fprintf(stderr, "[%d] %02d start()\n", i, id);
+            break;
         case TypeLink:
             fprintf(stderr, "[%d] %02d link(%d,%d)\n",
                     i, id, cur->i.idx, cur->shift[1]);
@@ -174,6 +181,16 @@ void ast_log_pop(AstMachine *ast, uint16_t labelId)
     ast_log(ast, TypePop, (mozpos_t)(uintptr_t)labelId, 0);
 }
 
+long ast_start_tx(AstMachine *ast)
+{
+    long tx = ARRAY_size(ast->logs);
+    if (ast->stream.handler) {
+        /* marks a pending commit; ast_stream_flush never passes it */
+        ast_log(ast, TypeStart, 0, 0);
+    }
+    return tx;
+}
+
 void ast_log_link(AstMachine *ast, uint16_t labelId, Node *node)
 {
     union ast_log_index i;
@@ -185,40 +202,89 @@ void ast_log_link(AstMachine *ast, uint16_t labelId, Node *node)
     ast->last_linked = node;
 }
 
+#ifdef MOZVM_MEMORY_USE_RCGC
+static void ast_release_links(AstLog *cur, AstLog *tail)
+{
+    for (; cur <= tail; ++cur) {
+        if(GetTag(cur) == TypeLink) {
+            Node *o = GetNode(cur);
+            if (o) {
+                NODE_GC_RELEASE(o);
+                cur->e.ref = NULL;
+            }
+        }
+    }
+}
+#endif
+
 void ast_rollback_tx(AstMachine *ast, long tx)
 {
 #ifdef MOZVM_MEMORY_USE_RCGC
     unsigned len = ARRAY_size(ast->logs);
     if (tx < len) {
-        AstLog *cur = ARRAY_n(ast->logs, tx);
-        AstLog *tail = ARRAY_last(ast->logs);
-        for (; cur <= tail; ++cur) {
-            if(GetTag(cur) == TypeLink) {
-                Node *o = GetNode(cur);
-                if (o) {
-                    NODE_GC_RELEASE(o);
-                    cur->e.ref = NULL;
-                }
-            }
-        }
+        ast_release_links(ARRAY_n(ast->logs, tx), ARRAY_last(ast->logs));
     }
 #endif
     ARRAY_size(ast->logs) = tx;
 }
 
-Node *constructLeft(AstMachine *ast, AstLog *cur, AstLog *tail,
-        mozpos_t spos, mozpos_t epos, long objSize,
+/* Append a copy of logs[begin..end) (the current seed of a left-recursive
+ * production) so that it can be linked again by the next growing step. */
+void ast_log_copy(AstMachine *ast, long begin, long end)
+{
+    long i;
+    ARRAY_ensureSize(AstLog, &ast->logs, end - begin);
+    for (i = begin; i < end; i++) {
+        AstLog *log = ARRAY_END(ast->logs);
+        *log = *ARRAY_n(ast->logs, i);
+        if (GetTag(log) == TypeLink && GetNode(log)) {
+            NODE_GC_RETAIN(GetNode(log));
+        }
+        ARRAY_size(ast->logs) += 1;
+    }
+}
+
+/* Remove logs[begin..end) and shift the following logs down */
+void ast_log_drop(AstMachine *ast, long begin, long end)
+{
+    unsigned len = ARRAY_size(ast->logs);
+    if (begin >= end) {
+        return;
+    }
+#ifdef MOZVM_MEMORY_USE_RCGC
+    ast_release_links(ARRAY_n(ast->logs, begin), ARRAY_n(ast->logs, end - 1));
+#endif
+    memmove(ARRAY_n(ast->logs, begin), ARRAY_n(ast->logs, end),
+            sizeof(AstLog) * (len - end));
+    ARRAY_size(ast->logs) = len - (end - begin);
+}
+
+/* Build a node from logs[cur..tail]. If dst is not NULL, the node is
+ * initialized in place (used to materialize a lazy node). */
+Node *constructLeft(const char *source, const char **tag_list, Node *dst,
+        AstLog *cur, AstLog *tail, mozpos_t spos, mozpos_t epos, long objSize,
         const char *tag, const char *value)
 {
     long len = epos - spos;
     unsigned n = 0;
-    Node *newnode = Node_new(tag,
-#ifndef MOZVM_USE_POINTER_AS_POS_REGISTER
-            ast->source +
+    Node *newnode = dst;
+#ifdef MOZVM_USE_POINTER_AS_POS_REGISTER
+    const char *str = spos;
+    (void)source;
+#else
+    const char *str = source + spos;
 #endif
-            spos, len, objSize, value);
+    if (newnode) {
+        Node_init(newnode, tag, str, len, objSize, value);
+    }
+    else {
+        newnode = Node_new(tag, str, len, objSize, value);
+    }
 
     if(objSize == 0) {
+#ifdef MOZVM_NODE_MERKLE_DIGEST
+        Node_merkle_update(newnode, tag_list);
+#endif
         return newnode;
     }
     for (; cur <= tail; ++cur) {
@@ -239,12 +305,18 @@ Node *constructLeft(AstMachine *ast, AstLog *cur, AstLog *tail,
             cur += shift;
         }
     }
+#ifdef MOZVM_NODE_MERKLE_DIGEST
+    Node_merkle_update(newnode, tag_list);
+#else
+    (void)tag_list;
+#endif
     return newnode;
 }
 
-static Node *ast_create_node(AstMachine *ast, AstLog *cur, AstLog *pushed)
+static Node *ast_create_node(const char *source, const char **tag_list,
+        AstLog *cur, AstLog *tail, AstLog *pushed, Node *dst)
 {
-    AstLog *head, *tail;
+    AstLog *head;
     mozpos_t spos, epos;
     Node *tmp;
     const char *tag = NULL;
@@ -253,7 +325,6 @@ static Node *ast_create_node(AstMachine *ast, AstLog *cur, AstLog *pushed)
     long shift = 0;
 
     head = cur;
-    tail = ARRAY_last(ast->logs);
     spos = GetPos(cur); epos = spos;
 #ifdef AST_DEBUG
     fprintf(stderr, "createNode.start id=%d\n", cur->id);
@@ -278,7 +349,7 @@ static Node *ast_create_node(AstMachine *ast, AstLog *cur, AstLog *pushed)
             value = (const char *)cur->i.pos;
             break;
         case TypeLeftFold:
-            tmp = constructLeft(ast, head, cur, spos, epos, objSize, tag, value);
+            tmp = constructLeft(source, tag_list, NULL, head, cur, spos, epos, objSize, tag, value);
             NODE_GC_RETAIN(tmp);
             tag = (const char *)cur->e.val;
             cur->e.ref = tmp;
@@ -292,15 +363,17 @@ static Node *ast_create_node(AstMachine *ast, AstLog *cur, AstLog *pushed)
             break;
         case TypePop:
             assert(pushed != NULL);
-            tmp = constructLeft(ast, head, cur, spos, epos, objSize, tag, value);
+            tmp = constructLeft(source, tag_list, NULL, head, cur, spos, epos, objSize, tag, value);
             NODE_GC_RETAIN(tmp);
             pushed->e.ref = tmp;
             pushed->i.tag = cur->i.tag;
             pushed->shift = cur - pushed;
             SetTag(pushed, TypeLink);
             return tmp;
+        case TypeStart:
+            break;
         case TypePush:
-            tmp = ast_create_node(ast, cur + 1, cur);
+            tmp = ast_create_node(source, tag_list, cur + 1, tail, cur, NULL);
             assert(GetTag(cur) == TypeLink);
             /* fallthrough */
         case TypeLink:
@@ -310,10 +383,49 @@ static Node *ast_create_node(AstMachine *ast, AstLog *cur, AstLog *pushed)
             break;
         }
     }
-    tmp = constructLeft(ast, head, tail, spos, epos, objSize, tag, value);
+    tmp = constructLeft(source, tag_list, dst, head, tail, spos, epos, objSize, tag, value);
     return tmp;
 }
 
+#ifdef MOZVM_AST_LAZY_NODE
+/* A committed log span [tx, size) kept aside until the node is read. */
+typedef struct AstThunk {
+    NodeThunk base;
+    const char *source;
+    const char **tag_list;
+    unsigned size;
+    AstLog logs[1];
+} AstThunk;
+
+static void ast_thunk_force(Node *o, NodeThunk *thunk)
+{
+    AstThunk *t = (AstThunk *)thunk;
+    ast_create_node(t->source, t->tag_list, t->logs, t->logs + t->size - 1, NULL, o);
+}
+
+static void ast_thunk_dispose(NodeThunk *thunk)
+{
+    AstThunk *t = (AstThunk *)thunk;
+    ast_release_links(t->logs, t->logs + t->size - 1);
+    VM_FREE(t);
+}
+
+static Node *ast_create_lazy_node(AstMachine *ast, AstLog *cur, long tx)
+{
+    unsigned size = ARRAY_size(ast->logs) - tx;
+    AstThunk *t = (AstThunk *)VM_MALLOC(sizeof(AstThunk) + sizeof(AstLog) * (size - 1));
+    t->base.fn_force = ast_thunk_force;
+    t->base.fn_dispose = ast_thunk_dispose;
+    t->source = ast->source;
+    t->tag_list = ast->tag_list;
+    t->size = size;
+    memcpy(t->logs, cur, sizeof(AstLog) * size);
+    /* the references held by Link logs are moved to the thunk */
+    ARRAY_size(ast->logs) = tx;
+    return Node_new_lazy(&t->base);
+}
+#endif
+
 void ast_commit_tx(AstMachine *ast, uint16_t labelId, long tx)
 {
     AstLog *cur;
@@ -323,8 +435,12 @@ void ast_commit_tx(AstMachine *ast, uint16_t labelId, long tx)
     fprintf(stderr, "0: %ld %d\n", tx, ARRAY_size(ast->logs)-1);
     AstMachine_dumpLog(ast);
 #endif
-    Node *node = ast_create_node(ast, cur, NULL);
+#ifdef MOZVM_AST_LAZY_NODE
+    Node *node = ast_create_lazy_node(ast, cur, tx);
+#else
+    Node *node = ast_create_node(ast->source, ast->tag_list, cur, ARRAY_last(ast->logs), NULL, NULL);
     ast_rollback_tx(ast, tx);
+#endif
     if (node) {
         ast_log_link(ast, labelId, node);
     }
@@ -337,6 +453,10 @@ Node *ast_get_parsed_node(AstMachine *ast)
     if (ast->parsed) {
         return ast->parsed;
     }
+    if (ast->stream.handler) {
+        ast_stream_finish(ast);
+        return NULL;
+    }
 #ifdef AST_DEBUG
     AstMachine_dumpLog(ast);
 #endif
@@ -347,7 +467,7 @@ Node *ast_get_parsed_node(AstMachine *ast)
     tail = ARRAY_last(ast->logs);
     for (; cur <= tail; ++cur) {
         if (GetTag(cur) == TypeNew) {
-            parsed = ast_create_node(ast, cur, NULL);
+            parsed = ast_create_node(ast->source, ast->tag_list, cur, tail, NULL, NULL);
             break;
         }
     }
@@ -357,12 +477,196 @@ Node *ast_get_parsed_node(AstMachine *ast)
     return parsed;
 }
 
+/* streaming */
+typedef struct AstStreamFrame {
+    Node *node;
+    unsigned index;
+} AstStreamFrame;
+
+DEF_ARRAY_T_OP(AstStreamFrame);
+
+static void ast_stream_capture(AstEventHandler *h, mozpos_t pos, unsigned len, const char *value)
+{
+    if (value) {
+        h->fn_capture(h, (mozpos_t)value, pstring_length(value));
+    }
+    else {
+        h->fn_capture(h, pos, len);
+    }
+}
+
+static void ast_stream_emit_node(AstMachine *ast, Node *o)
+{
+    AstEventHandler *h = ast->stream.handler;
+    ARRAY(AstStreamFrame) stack;
+    AstStreamFrame frame;
+    ARRAY_init(AstStreamFrame, &stack, 16);
+    frame.node = Node_force(o);
+    frame.index = 0;
+    h->fn_open(h, o->tag, (mozpos_t)o->pos);
+    ARRAY_add(AstStreamFrame, &stack, &frame);
+    while (ARRAY_size(stack) > 0) {
+        AstStreamFrame *top = ARRAY_last(stack);
+        Node *node = top->node;
+        if (top->index < Node_length(node)) {
+            Node *child = Node_get(node, top->index++);
+            if (child) {
+                Node_force(child);
+                h->fn_link(h, child->labelId);
+                h->fn_open(h, child->tag, (mozpos_t)child->pos);
+                frame.node = child;
+                frame.index = 0;
+                ARRAY_add(AstStreamFrame, &stack, &frame);
+            }
+        }
+        else {
+            ast_stream_capture(h, (mozpos_t)node->pos, node->len, node->value);
+            h->fn_close(h, node->tag);
+            ARRAY_size(stack) -= 1;
+        }
+    }
+    ARRAY_dispose(AstStreamFrame, &stack);
+}
+
+static void ast_stream_open_root(AstMachine *ast)
+{
+    struct ast_stream *stream = &ast->stream;
+    if (!stream->opened) {
+        stream->opened = 1;
+        stream->handler->fn_open(stream->handler, stream->tag, stream->spos);
+    }
+}
+
+/* Emit root-level logs in [stream.pos, tx). Stops at a pending commit
+ * (TypeStart) and, unless the parse is finished, at a Push or LeftFold
+ * whose extent is not known yet. */
+static void ast_stream_emit(AstMachine *ast, long tx, int finish)
+{
+    struct ast_stream *stream = &ast->stream;
+    AstLog *head = ARRAY_n(ast->logs, stream->pos);
+    AstLog *cur  = head;
+    AstLog *tail = ARRAY_n(ast->logs, tx);
+    for (; cur < tail; ++cur) {
+        Node *node;
+        switch(GetTag(cur)) {
+        case TypeNew:
+            if (!stream->opened) {
+                stream->rooted = 1;
+                stream->spos = stream->epos = GetPos(cur);
+            }
+            break;
+        case TypeCapture:
+            stream->epos = GetPos(cur);
+            break;
+        case TypeTag:
+            stream->tag = (const char *)cur->i.pos;
+            break;
+        case TypeReplace:
+            stream->value = (const char *)cur->i.pos;
+            break;
+        case TypeStart:
+            goto L_stop;
+        case TypeLeftFold:
+            /* the nodes already emitted would become a child of a new node */
+            if (finish && stream->opened && stream->handler->fn_error) {
+                stream->handler->fn_error(stream->handler,
+                        "left folding at the top level is not supported in streaming mode");
+            }
+            goto L_stop;
+        case TypePop:
+            assert(0 && "unbalanced push/pop");
+            goto L_stop;
+        case TypePush:
+            if (!finish) {
+                goto L_stop;
+            }
+            ast_create_node(ast->source, ast->tag_list, cur + 1, ARRAY_last(ast->logs), cur, NULL);
+            assert(GetTag(cur) == TypeLink);
+            /* fallthrough */
+        case TypeLink:
+            node = GetNode(cur);
+            if (node) {
+                ast_stream_open_root(ast);
+                stream->handler->fn_link(stream->handler, cur->i.labelId);
+                ast_stream_emit_node(ast, node);
+                NODE_GC_RELEASE(node);
+                cur->e.ref = NULL;
+            }
+            cur += cur->shift;
+            break;
+        }
+    }
+L_stop:
+    stream->pos = cur - ARRAY_BEGIN(ast->logs);
+}
+
+static void ast_stream_reset(struct ast_stream *stream)
+{
+    AstEventHandler *handler = stream->handler;
+    memset(stream, 0, sizeof(*stream));
+    stream->handler = handler;
+}
+
+void ast_set_event_handler(AstMachine *ast, AstEventHandler *handler)
+{
+    assert(ARRAY_size(ast->logs) == 0);
+    ast->stream.handler = handler;
+    ast_stream_reset(&ast->stream);
+}
+
+void ast_stream_flush(AstMachine *ast, long tx)
+{
+    ast_stream_emit(ast, tx, 0);
+}
+
+void ast_stream_finish(AstMachine *ast)
+{
+    struct ast_stream *stream = &ast->stream;
+    AstEventHandler *h = stream->handler;
+    long size = ARRAY_size(ast->logs);
+    if (!stream->opened) {
+        AstLog *cur  = ARRAY_n(ast->logs, stream->pos);
+        AstLog *tail = ARRAY_END(ast->logs);
+        for (; cur < tail; ++cur) {
+            if (GetTag(cur) == TypeLeftFold) {
+                /* nothing is emitted yet; build the whole tree instead */
+                Node *node = NULL;
+                for (cur = ARRAY_BEGIN(ast->logs); cur < tail; ++cur) {
+                    if (GetTag(cur) == TypeNew) {
+                        node = ast_create_node(ast->source, ast->tag_list, cur, tail - 1, NULL, NULL);
+                        break;
+                    }
+                }
+                if (node) {
+                    NODE_GC_RETAIN(node);
+                    ast_stream_emit_node(ast, node);
+                    NODE_GC_RELEASE(node);
+                }
+                ast_rollback_tx(ast, 0);
+                ast_stream_reset(stream);
+                return;
+            }
+        }
+    }
+    ast_stream_emit(ast, size, 1);
+    if (stream->rooted) {
+        ast_stream_open_root(ast);
+        ast_stream_capture(h, stream->spos, stream->epos - stream->spos, stream->value);
+        h->fn_close(h, stream->tag);
+    }
+    ast_rollback_tx(ast, 0);
+    ast_stream_reset(stream);
+}
+
 #ifdef MOZVM_MEMORY_USE_MSGC
 void ast_trace(void *p, NodeVisitor *visitor)
 {
     AstMachine *ast = (AstMachine *) p;
     AstLog *cur = ARRAY_n(ast->logs, 0);
     AstLog *tail = ARRAY_last(ast->logs);
+    if (ast->parsed) {
+        visitor->fn_visit(visitor, ast->parsed);
+    }
     for (; cur <= tail; ++cur) {
         if(GetTag(cur) == TypeLink) {
             Node *o = GetNode(cur);
@@ -19,6 +19,7 @@ typedef enum AstLogType {
     TypeNew      = 6,
     TypeLink     = 7,
     TypeCapture  = 8,
+    TypeStart    = 9,
 } AstLogType;
 
 // #define AST_DEBUG 1
@@ -50,11 +51,41 @@ typedef struct AstLog {
 DEF_ARRAY_STRUCT0(AstLog, unsigned);
 DEF_ARRAY_T(AstLog);
 
+/* SAX-style callbacks. For each node: open(tag, pos), then link(label)
+ * followed by the events of each child, then capture(pos, len) with the
+ * text (or the replaced value) of the node, then close(tag). The root may
+ * be opened before its tag is parsed, in that case open receives NULL and
+ * the tag is reported by close.
+ * A left folding at the top level ({$ ...} after the root) cannot be
+ * streamed once children of the root are reported: the root is closed,
+ * the rest of the tree is dropped and error (if not NULL) is called. */
+typedef struct AstEventHandler AstEventHandler;
+struct AstEventHandler {
+    void (*fn_open)(AstEventHandler *h, const char *tag, mozpos_t pos);
+    void (*fn_capture)(AstEventHandler *h, mozpos_t pos, unsigned len);
+    void (*fn_link)(AstEventHandler *h, int labelId);
+    void (*fn_close)(AstEventHandler *h, const char *tag);
+    void (*fn_error)(AstEventHandler *h, const char *msg);
+};
+
+struct ast_stream {
+    AstEventHandler *handler;
+    long pos; /* logs before pos are already emitted */
+    int rooted;
+    int opened;
+    mozpos_t spos;
+    mozpos_t epos;
+    const char *tag;
+    const char *value;
+};
+
 struct AstMachine {
     ARRAY(AstLog) logs;
     Node *last_linked;
     Node *parsed;
     const char *source;
+    const char **tag_list; /* resolves labels for Node_merkle_update() */
+    struct ast_stream stream;
 };
 
 typedef struct AstMachine AstMachine;
@@ -66,12 +97,20 @@ static inline void AstMachine_setSource(AstMachine *ast, const char *source)
     ast->source = source;
 }
 
+static inline void AstMachine_setTagList(AstMachine *ast, const char **tag_list)
+{
+    ast->tag_list = tag_list;
+}
+
 static inline long ast_save_tx(AstMachine *ast)
 {
     return ARRAY_size(ast->logs);
 }
 
+long ast_start_tx(AstMachine *ast);
 void ast_rollback_tx(AstMachine *ast, long tx);
+void ast_log_copy(AstMachine *ast, long begin, long end);
+void ast_log_drop(AstMachine *ast, long begin, long end);
 void ast_commit_tx(AstMachine *ast, uint16_t labelId, long tx);
 void ast_log_replace(AstMachine *ast, const char *str);
 void ast_log_capture(AstMachine *ast, mozpos_t pos);
@@ -88,6 +127,32 @@ static inline Node *ast_get_last_linked_node(AstMachine *ast)
 }
 
 Node *ast_get_parsed_node(AstMachine *ast);
+
+/* Streaming mode. Once a handler is set, children of the root node are
+ * reported to the handler as soon as the VM guarantees that their logs can
+ * no longer be rolled back, and released right after. ast_get_parsed_node
+ * then reports the rest of the tree and returns NULL.
+ * Only vm1 calls ast_stream_commit (in ISucc and ISkip, once no frame is
+ * left to roll back to). vm2 and mozvm do not, so with them every event
+ * is reported by ast_get_parsed_node at the end of the parse. */
+void ast_set_event_handler(AstMachine *ast, AstEventHandler *handler);
+void ast_stream_flush(AstMachine *ast, long tx);
+void ast_stream_finish(AstMachine *ast);
+
+/* vm1 tests this before looking for a committed frame, so that parses
+ * without a handler pay one predictable branch */
+static inline int ast_is_streaming(AstMachine *ast)
+{
+    return __builtin_expect(ast->stream.handler != NULL, 0);
+}
+
+/* logs before tx are irrevocably committed */
+static inline void ast_stream_commit(AstMachine *ast, long tx)
+{
+    if (ast->stream.handler && ast->stream.pos < tx) {
+        ast_stream_flush(ast, tx);
+    }
+}
 #ifdef MOZVM_MEMORY_USE_MSGC
 void ast_trace(void *p, NodeVisitor *visitor);
 #endif
@@ -1,6 +1,4 @@
 #include "symtable.h"
-#define KHASH_USE_FNV1A 1
-#include "khash.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -21,10 +19,51 @@ MOZVM_SYMTBL_PROFILE_EACH(MOZVM_PROFILE_DECL);
 
 DEF_ARRAY_OP(entry_t);
 
+#define SYMTBL_INIT_BUCKET_SIZE 16
+#define SYMTBL_INIT_TABLE_SIZE  4
+
+static inline unsigned symtable_bucket(symtable_t *tbl, unsigned tblId, unsigned hash)
+{
+    return (hash ^ (tblId * 0x9E3779B1U)) & tbl->bucket_mask;
+}
+
+static void symtable_init_buckets(symtable_t *tbl, unsigned size)
+{
+    unsigned i;
+    tbl->buckets = (int *)VM_MALLOC(sizeof(int) * size);
+    tbl->bucket_mask = size - 1;
+    for (i = 0; i < size; i++) {
+        tbl->buckets[i] = -1;
+    }
+}
+
+static void symtable_ensure_table(symtable_t *tbl, unsigned tblId)
+{
+    unsigned i, size = tbl->table_size;
+    if (tblId < size) {
+        return;
+    }
+    while (size <= tblId) {
+        size *= 2;
+    }
+    tbl->last = (int *)VM_REALLOC(tbl->last, sizeof(int) * size);
+    for (i = tbl->table_size; i < size; i++) {
+        tbl->last[i] = -1;
+    }
+    tbl->table_size = size;
+}
+
 symtable_t *symtable_init()
 {
+    unsigned i;
     symtable_t *tbl = (symtable_t *)VM_MALLOC(sizeof(*tbl));
     ARRAY_init(entry_t, &tbl->table, 4);
+    tbl->last = (int *)VM_MALLOC(sizeof(int) * SYMTBL_INIT_TABLE_SIZE);
+    tbl->table_size = SYMTBL_INIT_TABLE_SIZE;
+    for (i = 0; i < SYMTBL_INIT_TABLE_SIZE; i++) {
+        tbl->last[i] = -1;
+    }
+    symtable_init_buckets(tbl, SYMTBL_INIT_BUCKET_SIZE);
     tbl->state = 0;
     return tbl;
 }
@@ -32,9 +71,21 @@ symtable_t *symtable_init()
 void symtable_dispose(symtable_t *tbl)
 {
     ARRAY_dispose(entry_t, &tbl->table);
+    VM_FREE(tbl->last);
+    VM_FREE(tbl->buckets);
     VM_FREE(tbl);
 }
 
+void symtable_reset(symtable_t *tbl)
+{
+    /* undoing every entry restores all chain heads to -1 in O(size),
+     * whatever the number of buckets is */
+    if (ARRAY_size(tbl->table) > 0) {
+        symtable_undo(tbl, 0);
+    }
+    tbl->state = 0;
+}
+
 void symtable_print_stats()
 {
 #ifdef MOZVM_PROFILE
@@ -43,16 +94,68 @@ void symtable_print_stats()
     MOZVM_SYMTBL_PROFILE_EACH(MOZVM_PROFILE_SHOW);
 }
 
-static void symtable_push(symtable_t *tbl, const char *tag, unsigned hash, token_t *t)
+static inline int symtable_last_entry(symtable_t *tbl, unsigned tblId)
+{
+    return tblId < tbl->table_size ? tbl->last[tblId] : -1;
+}
+
+static void symtable_rehash(symtable_t *tbl)
+{
+    unsigned i, size = ARRAY_size(tbl->table);
+    VM_FREE(tbl->buckets);
+    symtable_init_buckets(tbl, (tbl->bucket_mask + 1) * 2);
+    for (i = 0; i < size; i++) {
+        entry_t *e = ARRAY_n(tbl->table, i);
+        unsigned idx = symtable_bucket(tbl, e->tblId, e->hash);
+        e->prev_hash = tbl->buckets[idx];
+        tbl->buckets[idx] = i;
+    }
+}
+
+void symtable_reserve(symtable_t *tbl, unsigned entries, unsigned tables)
+{
+    if (tables > 0) {
+        symtable_ensure_table(tbl, tables - 1);
+    }
+    ARRAY_ensureSize(entry_t, &tbl->table, entries);
+    while (entries > (tbl->bucket_mask + 1) * 2) {
+        symtable_rehash(tbl);
+    }
+}
+
+static void symtable_push(symtable_t *tbl, unsigned tblId, unsigned hash, token_t *t)
 {
     entry_t entry;
+    entry_t *prev;
+    unsigned idx;
+    int cur = ARRAY_size(tbl->table);
+
+    symtable_ensure_table(tbl, tblId);
+    prev = tbl->last[tblId] < 0 ? NULL : ARRAY_n(tbl->table, tbl->last[tblId]);
+
     entry.state = tbl->state++;
     entry.hash = hash;
-    entry.tag = tag;
+    entry.tblId = tblId;
+    entry.prev_tbl = tbl->last[tblId];
     if (t) {
         token_copy(&entry.sym, t);
+        entry.mask = prev ? prev->mask : -1;
+        entry.symbol = cur;
+    }
+    else {
+        entry.sym.s = NULL;
+        entry.sym.len = 0;
+        entry.mask = cur;
+        entry.symbol = prev ? prev->symbol : -1;
     }
+    idx = symtable_bucket(tbl, tblId, hash);
+    entry.prev_hash = tbl->buckets[idx];
+    tbl->buckets[idx] = cur;
+    tbl->last[tblId] = cur;
     ARRAY_add(entry_t, &tbl->table, &entry);
+    if (ARRAY_size(tbl->table) > (tbl->bucket_mask + 1) * 2) {
+        symtable_rehash(tbl);
+    }
 #ifdef MOZVM_PROFILE
     if (max_symtbl_size < ARRAY_size(tbl->table)) {
         max_symtbl_size = ARRAY_size(tbl->table);
@@ -60,80 +163,87 @@ static void symtable_push(symtable_t *tbl, const char *tag, unsigned hash, token
 #endif
 }
 
-void symtable_add_symbol_mask(symtable_t *tbl, const char *tableName)
+void symtable_undo(symtable_t *tbl, long saved)
+{
+    /* entries are popped in LIFO order, so each popped entry is still
+     * the head of its table chain and of its bucket chain */
+    entry_t *head = ARRAY_n(tbl->table, saved);
+    entry_t *cur = ARRAY_last(tbl->table);
+    for (; cur >= head; --cur) {
+        unsigned idx = symtable_bucket(tbl, cur->tblId, cur->hash);
+        tbl->last[cur->tblId] = cur->prev_tbl;
+        tbl->buckets[idx] = cur->prev_hash;
+    }
+    ARRAY_size(tbl->table) = saved;
+}
+
+void symtable_add_symbol_mask(symtable_t *tbl, unsigned tblId)
 {
     MOZVM_PROFILE_INC(SYMTBL_MASK);
-    symtable_push(tbl, tableName, 0, NULL);
+    symtable_push(tbl, tblId, 0, NULL);
 }
 
-void symtable_add_symbol(symtable_t *tbl, const char *tableName, token_t *captured)
+void symtable_add_symbol(symtable_t *tbl, unsigned tblId, token_t *captured)
 {
-    unsigned hash = fnv1a(captured->s, captured->len);
+    unsigned hash = token_hash(captured->s, captured->len);
     MOZVM_PROFILE_INC(SYMTBL_ADD);
-    symtable_push(tbl, tableName, hash, captured);
+    symtable_push(tbl, tblId, hash, captured);
 }
 
-int symtable_has_symbol(symtable_t *tbl, const char *tableName)
+int symtable_has_symbol(symtable_t *tbl, unsigned tblId)
 {
-    entry_t *cur, *head;
+    int last;
     MOZVM_PROFILE_INC(SYMTBL_HAS);
 
-    if (ARRAY_size(tbl->table) == 0) {
+    last = symtable_last_entry(tbl, tblId);
+    if (last < 0) {
         return 0;
     }
-    cur = ARRAY_last(tbl->table);
-    head = ARRAY_get(entry_t, &tbl->table, 0);
-    for (; cur >= head; --cur) {
-        if (cur->tag == tableName) {
-            return cur->sym.s != NULL;
-        }
-    }
-    return 0;
+    return ARRAY_n(tbl->table, last)->sym.s != NULL;
 }
 
-int symtable_get_symbol(symtable_t *tbl, const char *tableName, token_t *t)
+int symtable_get_symbol(symtable_t *tbl, unsigned tblId, token_t *t)
 {
-    entry_t *cur, *head;
+    int last;
     MOZVM_PROFILE_INC(SYMTBL_GET);
 
-    if (ARRAY_size(tbl->table) == 0) {
+    last = symtable_last_entry(tbl, tblId);
+    if (last < 0) {
         return 0;
     }
-    cur = ARRAY_last(tbl->table);
-    head = ARRAY_get(entry_t, &tbl->table, 0);
-    for (; cur >= head; --cur) {
-        if (cur->tag == tableName) {
-            if (cur->sym.s != NULL) {
-                token_copy(t, &cur->sym);
-                return 1;
-            }
-        }
+    last = ARRAY_n(tbl->table, last)->symbol;
+    if (last < 0) {
+        return 0;
     }
-    return 0;
+    token_copy(t, &ARRAY_n(tbl->table, last)->sym);
+    return 1;
 }
 
-int symtable_contains(symtable_t *tbl, const char *tableName, token_t *t)
+int symtable_contains(symtable_t *tbl, unsigned tblId, token_t *t)
 {
-    entry_t *cur, *head;
+    entry_t *last;
     unsigned hash;
+    int cur;
 
     MOZVM_PROFILE_INC(SYMTBL_CONTAIN);
 
-    if (ARRAY_size(tbl->table) == 0) {
+    cur = symtable_last_entry(tbl, tblId);
+    if (cur < 0) {
         return 0;
     }
-    hash = fnv1a(t->s, t->len);
-    cur = ARRAY_last(tbl->table);
-    head = ARRAY_get(entry_t, &tbl->table, 0);
-    for (; cur >= head; --cur) {
-        if (cur->tag == tableName) {
-            if (cur->sym.s == NULL) {
-                return 0;
-            }
-            if (hash == cur->hash && token_equal(t, &cur->sym)) {
-                return 1;
-            }
+    last = ARRAY_n(tbl->table, cur);
+    if (last->sym.s == NULL) {
+        return 0;
+    }
+    /* only entries added after the latest mask are visible */
+    hash = token_hash(t->s, t->len);
+    cur = tbl->buckets[symtable_bucket(tbl, tblId, hash)];
+    while (cur > last->mask) {
+        entry_t *e = ARRAY_n(tbl->table, cur);
+        if (e->tblId == tblId && e->hash == hash && token_equal(t, &e->sym)) {
+            return 1;
         }
+        cur = e->prev_hash;
     }
     return 0;
 }
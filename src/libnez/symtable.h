@@ -11,8 +11,13 @@ extern "C" {
 typedef struct symtable_entry_t {
     unsigned state;
     unsigned hash;
-    const char *tag;
+    unsigned tblId;
     token_t sym;
+    /* index chains (-1 terminates a chain) */
+    int prev_tbl;  /* previous entry of the same table */
+    int prev_hash; /* previous entry in the same bucket */
+    int mask;      /* latest mask of the same table (at or before) */
+    int symbol;    /* latest non-mask entry of the same table (at or before) */
 } entry_t;
 
 DEF_ARRAY_STRUCT0(entry_t, unsigned);
@@ -21,19 +26,28 @@ DEF_ARRAY_T(entry_t);
 struct symtable_t {
     unsigned state;
     ARRAY(entry_t) table;
+    int *last;         /* latest entry of each table, indexed by tblId */
+    unsigned table_size;
+    int *buckets;      /* latest entry of each (tblId, hash) bucket */
+    unsigned bucket_mask;
 };
 
 typedef struct symtable_t symtable_t;
 
 symtable_t *symtable_init();
 void symtable_dispose(symtable_t *tbl);
+/* drops every entry but keeps the allocated capacity for the next parse */
+void symtable_reset(symtable_t *tbl);
+/* grows the table to hold `entries` symbols of `tables` tables */
+void symtable_reserve(symtable_t *tbl, unsigned entries, unsigned tables);
 void symtable_print_stats();
 
-void symtable_add_symbol_mask(symtable_t *tbl, const char *tableName);
-void symtable_add_symbol(symtable_t *tbl, const char *tableName, token_t *captured);
-int symtable_has_symbol(symtable_t *tbl, const char *tableName);
-int symtable_get_symbol(symtable_t *tbl, const char *tableName, token_t *t);
-int symtable_contains(symtable_t *tbl, const char *tableName, token_t *t);
+void symtable_add_symbol_mask(symtable_t *tbl, unsigned tblId);
+void symtable_add_symbol(symtable_t *tbl, unsigned tblId, token_t *captured);
+int symtable_has_symbol(symtable_t *tbl, unsigned tblId);
+int symtable_get_symbol(symtable_t *tbl, unsigned tblId, token_t *t);
+int symtable_contains(symtable_t *tbl, unsigned tblId, token_t *t);
+void symtable_undo(symtable_t *tbl, long saved);
 
 static inline long symtable_savepoint(symtable_t *tbl)
 {
@@ -42,7 +56,9 @@ static inline long symtable_savepoint(symtable_t *tbl)
 
 static inline void symtable_rollback(symtable_t *tbl, long saved)
 {
-    ARRAY_size(tbl->table) = saved;
+    if (saved < (long)ARRAY_size(tbl->table)) {
+        symtable_undo(tbl, saved);
+    }
     // if (saved == 0) {
     //     tbl->state = 0;
     // }
@@ -1,6 +1,9 @@
 #ifndef TOKEN_H
 #define TOKEN_H
 
+#include <stdint.h>
+#include <string.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -27,34 +30,92 @@ static inline unsigned token_length(token_t *t)
     return t->len;
 }
 
-static inline int token_equal(token_t *t1, token_t *t2)
+/* Unaligned loads. Callers guarantee that [p, p + 8) (or 4) is readable;
+ * the helpers below never read outside [s, s + len). */
+static inline uint64_t token_load64(const char *p)
 {
-    const char *s1, *s2;
-    const char *e1;
-    if (t1->len != t2->len) {
-        return 0;
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t token_load32(const char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/* Word-at-a-time compare: whole words first, then one (possibly
+ * overlapping) word aligned to the end of the token. */
+static inline int token_memeq(const char *s1, const char *s2, unsigned len)
+{
+    unsigned i;
+    if (len >= 8) {
+        for (i = 0; i + 8 <= len; i += 8) {
+            if (token_load64(s1 + i) != token_load64(s2 + i)) {
+                return 0;
+            }
+        }
+        return token_load64(s1 + len - 8) == token_load64(s2 + len - 8);
+    }
+    if (len >= 4) {
+        return token_load32(s1) == token_load32(s2) &&
+            token_load32(s1 + len - 4) == token_load32(s2 + len - 4);
     }
-    s1 = t1->s;
-    s2 = t2->s;
-    e1 = s1 + t1->len;
-    while (s1 < e1) {
-        if (*s1++ != *s2++) {
+    for (i = 0; i < len; i++) {
+        if (s1[i] != s2[i]) {
             return 0;
         }
     }
     return 1;
 }
 
+static inline int token_equal(token_t *t1, token_t *t2)
+{
+    if (t1->len != t2->len) {
+        return 0;
+    }
+    return token_memeq(t1->s, t2->s, t1->len);
+}
+
+/* s must have at least token_length(t) readable bytes */
 static inline int token_equal_string(token_t *t, const char *s)
 {
-    const char *s1 = t->s;
-    const char *e1 = s1 + t->len;
-    while (s1 < e1) {
-        if (*s1++ != *s++) {
-            return 0;
+    return token_memeq(t->s, s, t->len);
+}
+
+static inline uint64_t token_mix(uint64_t h, uint64_t v)
+{
+    h = (h ^ v) * 0x9E3779B185EBCA87ULL;
+    return h ^ (h >> 31);
+}
+
+/* Hash tuned for short identifiers: one multiply per 8 bytes, with the
+ * tail read as overlapping words (or 3 sampled bytes) so short keys cost
+ * a single step. The length seeds the hash, so overlapping tails of
+ * different lengths do not collide trivially. */
+static inline unsigned token_hash(const char *s, unsigned len)
+{
+    uint64_t h = 0x27D4EB2F165667C5ULL ^ (len * 0xC2B2AE3D27D4EB4FULL);
+    unsigned i = 0;
+    for (; i + 8 <= len; i += 8) {
+        h = token_mix(h, token_load64(s + i));
+    }
+    if (i < len) {
+        unsigned rem = len - i;
+        uint64_t v;
+        if (rem >= 4) {
+            v = token_load32(s + i) | ((uint64_t)token_load32(s + len - 4) << 32);
+        }
+        else {
+            v = (uint8_t)s[i] | ((uint64_t)(uint8_t)s[i + rem / 2] << 8) |
+                ((uint64_t)(uint8_t)s[len - 1] << 16);
         }
+        h = token_mix(h, v);
     }
-    return 1;
+    h *= 0x165667B19E3779F9ULL;
+    return (unsigned)(h ^ (h >> 32));
 }
 
 #ifdef __cplusplus
@@ -35,6 +35,18 @@ extern "C" {
 
 #define MOZVM_MOZVM1_OPCODE_SIZE 1
 #include "vm_inst.h"
+#include "compiler/vm1_opcode.h"
+
+#ifdef __cplusplus
+#define MOZ1_STATIC_ASSERT(COND, MSG) static_assert(COND, MSG)
+#else
+#define MOZ1_STATIC_ASSERT(COND, MSG) _Static_assert(COND, MSG)
+#endif
+/* The compiler emits .moz files with its own copy of the opcodes */
+#define MOZ1_CHECK_OPCODE(OP, N) \
+    MOZ1_STATIC_ASSERT((int)MOZ1_##OP == (int)OP, "vm1_opcode.h is out of sync: " #OP);
+MOZ1_OP_EACH(MOZ1_CHECK_OPCODE)
+#undef MOZ1_CHECK_OPCODE
 
 // #define LOADER_DEBUG 1
 
@@ -552,9 +564,8 @@ static uint16_t mozvm_loader_load_inst(mozvm_loader_t *L, input_stream_t *is, in
     CASE_(SIsDef) {
         uint16_t tblId = read16(is);
         uint16_t strId = read16(is);
-        tag_t *impl1 = L->R->C.tables[tblId];
         const char *impl2 = L->R->C.strs[strId];
-        mozvm_loader_write_id(L, MOZVM_SMALL_TAG_INST, tblId, (void *)impl1);
+        mozvm_loader_write16(L, tblId);
         mozvm_loader_write_id(L, MOZVM_SMALL_STRING_INST, strId, (void *)impl2);
         break;
     }
@@ -565,8 +576,7 @@ static uint16_t mozvm_loader_load_inst(mozvm_loader_t *L, input_stream_t *is, in
     CASE_(SIs);
     CASE_(SIsa) {
         uint16_t tblId = read16(is);
-        tag_t *impl = L->R->C.tables[tblId];
-        mozvm_loader_write_id(L, MOZVM_SMALL_TAG_INST, tblId, (void *)impl);
+        mozvm_loader_write16(L, tblId);
         break;
     }
     CASE_(SDefNum) {
@@ -860,6 +870,7 @@ static moz_inst_t *mozvm_loader_load_syntax2(mozvm_loader_t *L, const uint8_t *m
             fprintf(stderr, "tag%d %s\n", i, bc->tags[i]);
 #endif
         }
+        AstMachine_setTagList(L->R->ast, bc->tags);
     }
     bc->table_size = read16(&is);
     if (bc->table_size > 0) {
@@ -874,10 +885,12 @@ static moz_inst_t *mozvm_loader_load_syntax2(mozvm_loader_t *L, const uint8_t *m
 #endif
         }
     }
+    symtable_reserve(L->R->table, 0, bc->table_size);
 
     mozvm_loader_load(L, &is, opt);
 #ifdef MOZVM_PROFILE_INST
     L->R->C.profile = (long *)VM_CALLOC(1, sizeof(long) * ARRAY_size(L->buf));
+    L->R->C.profile_size = ARRAY_size(L->buf);
 #endif
     inst = mozvm_loader_freeze(L);
 #ifdef LOADER_DEBUG
@@ -1200,11 +1213,11 @@ L_dump_table:
                 break;
             }
             CASE_(SIsDef) {
-                TAG_t    tagId = *(TAG_t *)(p + 1);
-                STRING_t strId = *(STRING_t *)(p + 1 + sizeof(TAG_t));
-                tag_t      *impl1 = TBL_GET_IMPL(L->R, tagId);
+                TBL_t    tblId = *(TBL_t *)(p + 1);
+                STRING_t strId = *(STRING_t *)(p + 1 + sizeof(TBL_t));
+                tag_t      *impl1 = TBL_GET_IMPL(L->R, tblId);
                 const char *impl2 = STRING_GET_IMPL(L->R, strId);
-                OP_PRINT("%p %s", impl1, impl2);
+                OP_PRINT("%s %s", impl1, impl2);
                 break;
             }
 
@@ -1214,9 +1227,9 @@ L_dump_table:
             CASE_(SMatch);
             CASE_(SIs);
             CASE_(SIsa) {
-                TAG_t tagId = *(TAG_t *)(p + 1);
-                tag_t *impl = TBL_GET_IMPL(L->R, tagId);
-                OP_PRINT("%p", impl);
+                TBL_t tblId = *(TBL_t *)(p + 1);
+                tag_t *impl = TBL_GET_IMPL(L->R, tblId);
+                OP_PRINT("%s", impl);
                 break;
             }
             CASE_(SDefNum) {
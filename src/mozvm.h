@@ -34,6 +34,14 @@ typedef struct moz_production_t {
 #endif
 } moz_production_t;
 
+/* growing seed of a left-recursive production (see ILrEnter in vm2) */
+typedef struct moz_lr_seed_t {
+    mozpos_t pos;
+    mozpos_t end;
+    long tx;
+    long seed_tx;
+} moz_lr_seed_t;
+
 typedef struct mozvm_constant_t {
     bitset_t *sets;
     const char **tags;
@@ -52,12 +60,15 @@ typedef struct mozvm_constant_t {
     uint16_t tag_size;
     uint16_t table_size;
     uint16_t prod_size;
+    uint16_t lr_size;
 
     unsigned inst_size;
     unsigned memo_size;
     unsigned input_size;
 #ifdef MOZVM_PROFILE_INST
+    /* vm1: executions of each instruction, vm2: ICount counters */
     long *profile;
+    unsigned profile_size;
 #endif
 } mozvm_constant_t;
 
@@ -75,6 +86,7 @@ typedef struct moz_runtime_t {
 #ifdef MOZVM_USE_DYNAMIC_DEACTIVATION
     MemoPoint *memo_points;
 #endif
+    moz_lr_seed_t *seeds;
 #ifdef MOZVM_ENABLE_JIT
     jit_context_t *jit_context;
 #endif
@@ -26,6 +26,8 @@ extern "C" {
 
 // AstMachine
 #define MOZ_AST_MACHINE_DEFAULT_LOG_SIZE 128
+/* build AST nodes on first access: cmake -DMOZVM_AST_LAZY_NODE=ON */
+// #define MOZVM_AST_LAZY_NODE 1
 
 // Memo
 #define MOZ_MEMO_DEFAULT_WINDOW_SIZE 32
@@ -36,6 +38,13 @@ extern "C" {
 
 // Runtime
 #define MOZ_DEFAULT_STACK_SIZE  (1024)
+#if defined(__cplusplus) && __cplusplus >= 201103L
+#define MOZVM_THREAD_LOCAL thread_local
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define MOZVM_THREAD_LOCAL _Thread_local
+#else
+#define MOZVM_THREAD_LOCAL __thread
+#endif
 
 // jump table
 #define MOZ_JMPTABLE_SIZE 256
@@ -43,13 +52,31 @@ extern "C" {
 
 // node
 #define MOZVM_SMALL_ARRAY_LIMIT 2
+/* node memory manager: reference counting (default), bitmap mark-sweep GC
+ * or Boehm GC. Selected with -DMOZVM_NODE_GC=RCGC|MSGC at cmake time. */
+#if !defined(MOZVM_MEMORY_USE_RCGC) && !defined(MOZVM_MEMORY_USE_MSGC) && \
+    !defined(MOZVM_MEMORY_USE_BOEHM_GC)
 #define MOZVM_MEMORY_USE_RCGC  1
-// #define MOZVM_MEMORY_USE_MSGC  1
+#endif
+#ifdef MOZVM_MEMORY_USE_MSGC
+/* sticky mark bits: minor GCs only trace young nodes */
+#define MOZVM_MSGC_GENERATIONAL 1
+/* maximum number of threads marking a large heap (1 disables) */
+#define MOZVM_MSGC_MARK_THREADS 4
+/* sweep segments on a background thread */
+#define MOZVM_MSGC_CONCURRENT_SWEEP 1
+#endif
 #define MOZVM_NODE_ARENA_SIZE  8
 #define MOZVM_NODE_USE_MEMPOOL 1
 #define MOZVM_USE_FREE_LIST 1
-// #define MOZVM_MEMORY_USE_BOEHM_GC 1
 #define MOZVM_ENABLE_NODE_DIGEST 1
+/* Node_digest uses xxh128 unless MD5 (as written by nez) is selected */
+#if !defined(MOZVM_NODE_DIGEST_USE_MD5) && !defined(MOZVM_NODE_DIGEST_USE_XXH128)
+#define MOZVM_NODE_DIGEST_USE_XXH128 1
+#endif
+/* cache a 128-bit subtree digest in every node built from the AST log:
+ * cmake -DMOZVM_NODE_MERKLE_DIGEST=ON */
+// #define MOZVM_NODE_MERKLE_DIGEST 1
 #define MOZVM_ENABLE_NEZTEST 1
 
 // VM / bytecode
@@ -103,13 +130,15 @@ typedef const char tag_t;
 #if MOZVM_SMALL_TAG_INST
 typedef uint16_t TAG_t;
 #define TAG_GET_IMPL(runtime, ID) runtime->C.tags[(ID)]
-#define TBL_GET_IMPL(runtime, ID) runtime->C.tables[(ID)]
 #else
 typedef tag_t *TAG_t;
 #define TAG_GET_IMPL(runtime, ID) (ID)
-#define TBL_GET_IMPL(runtime, ID) (ID)
 #endif
 
+/* symbol tables are always referred by their index in C.tables */
+typedef uint16_t TBL_t;
+#define TBL_GET_IMPL(runtime, ID) runtime->C.tables[(ID)]
+
 #if MOZVM_SMALL_BITSET_INST
 typedef uint16_t BITSET_t;
 #define BITSET_GET_IMPL(runtime, ID) &(runtime->C.sets[(ID)])
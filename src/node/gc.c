@@ -35,6 +35,21 @@
 #include "config.h"
 #endif
 
+#if defined(MOZVM_MSGC_MARK_THREADS) && MOZVM_MSGC_MARK_THREADS > 1
+#define USE_PARALLEL_MARK 1
+#endif
+#ifdef MOZVM_MSGC_CONCURRENT_SWEEP
+#define USE_CONCURRENT_SWEEP 1
+#endif
+#if defined(USE_PARALLEL_MARK) || defined(USE_CONCURRENT_SWEEP)
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
 // #define GCDEBUG 1
 // #define GCSTAT 1
 
@@ -51,8 +66,13 @@ extern "C" {
 /* memory config */
 
 #define GC_USE_DEFERREDSWEEP 1
+#ifdef MOZVM_MSGC_GENERATIONAL
+#define USE_GENERATIONAL_GC 1
+#endif
 // #define USE_SAFEPOINT_POLICY 1
-#define SUBHEAP_DEFAULT_SEGPOOL_SIZE (128)/* 128 * SEGMENT_SIZE(128k) = 16MB*/
+#ifndef SUBHEAP_DEFAULT_SEGPOOL_SIZE
+#define SUBHEAP_DEFAULT_SEGPOOL_SIZE (64)/* 64 * SEGMENT_SIZE(128k) = 8MB*/
+#endif
 #define SUBHEAP_KLASS_MIN  5 /* 1 <<  5 == 32 */
 #define SUBHEAP_KLASS_MAX 12 /* 1 << 12 == 4096 */
 #define SEGMENT_LEVEL 3
@@ -69,8 +89,25 @@ extern "C" {
 #define ALIGN(X,N)  (((X)+((N)-1))&(~((N)-1)))
 #define CEIL(F)     (F-(int)(F) > 0 ? (int)(F+1) : (int)(F))
 
+#ifdef USE_PARALLEL_MARK
+/* heaps smaller than this are marked by the allocating thread only */
+#ifndef PARALLEL_MARK_MIN_HEAP_SIZE
+#define PARALLEL_MARK_MIN_HEAP_SIZE (64 * MB_)
+#endif
+/* a worker shares half of its mark stack once it holds this many objects */
+#define PARALLEL_MARK_SHARE_SIZE 64
+#endif
+#if defined(USE_PARALLEL_MARK) || defined(USE_CONCURRENT_SWEEP)
+/* number of CPUs the GC threads are sized for */
+#ifndef GC_ONLINE_CPUS
+#define GC_ONLINE_CPUS sysconf(_SC_NPROCESSORS_ONLN)
+#endif
+#endif
+
 #ifdef USE_GENERATIONAL_GC
 #define MINOR_COUNT 16
+/* number of minor GCs run between two major GCs */
+#define MINOR_GC_PER_MAJOR_GC 8
 #endif
 
 #define BITMAP_FULL ((uintptr_t)(-1))
@@ -182,6 +219,10 @@ struct SubHeap {
     Segment **seglist;
     unsigned seglist_size;
     unsigned seglist_max;
+#ifdef USE_CONCURRENT_SWEEP
+    unsigned sweep_size; /* seglist[0, sweep_size) is owned by the sweeper */
+    bool sweeping;
+#endif
 };
 
 #define for_each_heap(H, I, HEAPS) \
@@ -209,8 +250,21 @@ struct HeapManager {
     bitmap_t flags;
     SubHeap heaps[SUBHEAP_KLASS_MAX+1];
     MarkStack mstack;
+#ifdef USE_PARALLEL_MARK
+    MarkStack worker_mstack[MOZVM_MSGC_MARK_THREADS - 1];
+    unsigned mark_threads;
+#endif
+#ifdef USE_CONCURRENT_SWEEP
+    pthread_t sweeper;
+    pthread_mutex_t sweep_lock;
+    pthread_cond_t sweep_cond;
+    bool concurrent_sweep;
+    bool sweep_pending;
+    bool sweep_shutdown;
+#endif
 #if defined(USE_GENERATIONAL_GC)
     ARRAY(BitMapPtr)  remember_sets;
+    unsigned minor_gc_count;
 #endif
     Segment *segmentList;
     ARRAY(SegmentPtr) segment_pool_a;
@@ -349,9 +403,9 @@ static const unsigned int SegmentNodeCount_GC_MARGIN[] = {
     CEIL(SEGMENT_BLOCK_COUNT(11)*MARGINE), CEIL(SEGMENT_BLOCK_COUNT(12)*MARGINE),
 };
 
-static bitmap_t bitmap_empty = BITMAP_FULL;
-static bitmap_t *bitmap_dummy = &bitmap_empty;
-static Segment segment_dummy = {
+/* allocation sentinels, written by the owner of each heap manager */
+static MOZVM_THREAD_LOCAL bitmap_t bitmap_empty = BITMAP_FULL;
+static MOZVM_THREAD_LOCAL Segment segment_dummy = {
     {0}, 0, 0, 0, 0,
 #ifdef USE_GENERATIONAL_GC
     {0}, 0, 0,
@@ -497,10 +551,8 @@ static const unsigned BM_SIZE[] = {
 #define gc_stat(fmt, ...)  fprintf(stderr, "(%s:%d) " fmt "\n" , __func__, __LINE__,  ## __VA_ARGS__)
 #endif
 
-#define Object_SetTenure(o) KFlag_Set(uintptr_t,(o)->flag, 1,1)
-#define Object_SetYoung(o)  KFlag_Set(uintptr_t,(o)->flag, 1,0)
-#define Object_isTenure(o) (KFlag_Is(uintptr_t, (o)->flag, 1))
-#define Object_isYoung(o)  (!Object_isTenure(o))
+#define Object_SetTenure(o) ((o)->_flag |= NODE_GC_TENURE)
+#define Object_isTenure(o)  (((o)->_flag & NODE_GC_TENURE) != 0)
 
 enum gc_mode {
 #define GC_MINOR_FLAG 0
@@ -519,10 +571,16 @@ static kObject *bm_malloc_internal(HeapManager *mng, size_t n);
 static void bitmapMarkingGC(HeapManager *mng, enum gc_mode mode);
 static HeapManager *HeapManager_init(size_t heap_size);
 static void HeapManager_delete(HeapManager *mng);
+static void HeapManager_reset(HeapManager *mng);
 static void HeapManager_final_free(HeapManager *mng);
 static inline void bmgc_Object_free(kObject *o);
 static bool findNextFreeNode(AllocationPointer *p);
 static void BMGC_dump(HeapManager *mng);
+#ifdef USE_CONCURRENT_SWEEP
+static Segment *ConcurrentSweeper_next(HeapManager *mng, SubHeap *h);
+static void *ConcurrentSweeper_run(void *arg);
+static void ConcurrentSweeper_wait(HeapManager *mng);
+#endif
 
 /* ------------------------------------------------------------------------ */
 /* malloc */
@@ -535,7 +593,21 @@ static void THROW_OutOfMemory(size_t size)
 static void *call_malloc_aligned(size_t size, size_t align)
 {
     void *block = NULL;
-#if defined(HAVE_POSIX_MEMALIGN)
+#if defined(HAVE_MMAP)
+    /* anonymous pages are zero-filled on first touch, so the heap does not
+     * need an explicit bzero and untouched segments stay out of the RSS */
+    char *head, *aligned;
+    head = (char *)mmap(NULL, size + align, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (head == MAP_FAILED)
+        return NULL;
+    aligned = (char *)((((uintptr_t)head + align - 1) / align) * align);
+    if (aligned != head) {
+        munmap(head, aligned - head);
+    }
+    munmap(aligned + size, (head + align) - aligned);
+    block = aligned;
+#elif defined(HAVE_POSIX_MEMALIGN)
     int ret = posix_memalign(&block, align, size);
     (void)ret;
 #elif defined(HAVE_MEMALIGN)
@@ -564,7 +636,9 @@ static void *call_malloc_aligned(size_t size, size_t align)
 
 static void call_free_aligned(void *block, size_t size)
 {
-#if defined(HAVE_POSIX_MEMALIGN) || defined(HAVE_MEMALIGN)
+#if defined(HAVE_MMAP)
+    munmap(block, size);
+#elif defined(HAVE_POSIX_MEMALIGN) || defined(HAVE_MEMALIGN)
     free(block);
 #elif defined(K_USING_WINDOWS_)
     VirtualFree(block, 0, MEM_RELEASE);
@@ -659,6 +733,15 @@ static void mstack_push(MarkStack *mstack, kObject *ref)
     mstack->tail = ntail;
 }
 
+static void mstack_dispose(MarkStack *mstack)
+{
+    if(mstack->capacity > 0) {
+        do_free(mstack->stack,  (mstack->capacity + 1) * sizeof(kObject *));
+        mstack->stack    = NULL;
+        mstack->capacity = 0;
+    }
+}
+
 static kObject *mstack_next(MarkStack *mstack)
 {
     kObject *ref = NULL;
@@ -789,11 +872,19 @@ static bool fetchSegment(SubHeap *h, unsigned klass)
     return true;
 }
 
+static inline Segment *freelist_next(HeapManager *mng, SubHeap *h)
+{
+#ifdef USE_CONCURRENT_SWEEP
+    return ConcurrentSweeper_next(mng, h);
+#else
+    return freelist_isEmpty(h) ? NULL : freelist_pop(h);
+#endif
+}
+
 static bool nextSegment(HeapManager *mng, SubHeap *h, AllocationPointer *p)
 {
     Segment *seg;
-    while(h->freelist != NULL) {
-        seg = freelist_pop(h);
+    while((seg = freelist_next(mng, h)) != NULL) {
         assert(seg->live_count < SegmentNodeCount[h->heap_klass]);
         p->seg = seg;
         BITPTRS_INIT(h->p.bitptrs, seg, h->heap_klass);
@@ -964,7 +1055,8 @@ static void *tryAlloc(HeapManager *mng, SubHeap *h)
     prefetch_(temp, 0, 0);
     isEmpty = inc(p, h);
 
-#ifdef USE_GENERATIONAL_GC
+#if defined(USE_GENERATIONAL_GC) && !defined(USE_CONCURRENT_SWEEP)
+    /* h->freelist may be filled by the sweeper, so skip this hint there */
     bitmap_set(&mng->flags, GC_MAJOR_FLAG,
             (mng->segmentList == NULL && h->freelist == NULL && isEmpty));
 #else
@@ -986,11 +1078,15 @@ static bool Heap_Init(HeapManager *mng, SubHeap *h, int klass)
     h->seglist_max  = HEAP_SEGMENTLIST_INIT_SIZE;
     h->seglist  = (Segment**)(do_malloc(sizeof(Segment**)*h->seglist_max));
     h->freelist = NULL;
+#ifdef USE_CONCURRENT_SWEEP
+    h->sweep_size = 0;
+    h->sweeping = false;
+#endif
     h->p.bitptrs[0].idx  = 0;
     h->p.bitptrs[0].mask = 1;
     h->p.seg = &segment_dummy;
     for (i = 0; i < SEGMENT_LEVEL; ++i) {
-        h->p.seg->base[i] = (bitmap_t *)bitmap_dummy;
+        h->p.seg->base[i] = &bitmap_empty;
     }
     return true;
 }
@@ -1022,11 +1118,17 @@ static Segment *SegmentPool_Init(size_t size, AllocationNode *block)
 }
 
 #if defined(USE_GENERATIONAL_GC)
+/* one bit for each MIN_ALIGN block of the heap */
+static size_t RememberSet_size(size_t heap_size)
+{
+    return heap_size / MIN_ALIGN / BITS * sizeof(bitmap_t);
+}
+
 static void dispatchRememberSet(HeapManager *mng, size_t heap_size, AllocationNode *block)
 {
     NodeHeader *head;
     Segment *seg = mng->segmentList;
-    bitmap_t *map = (bitmap_t *)do_malloc(heap_size / (MIN_ALIGN) / sizeof(bitmap_t));
+    bitmap_t *map = (bitmap_t *)do_malloc(RememberSet_size(heap_size));
     ARRAY_add(BitMapPtr,  &mng->remember_sets, map);
     while(seg) {
         head = (NodeHeader *) block;
@@ -1049,6 +1151,11 @@ static void SegmentPool_dispose(Segment *pool, size_t size)
         if(seg->base[0]) {
             DeleteBitMap(seg->base[0], seg->heap_klass);
         }
+#ifdef USE_GENERATIONAL_GC
+        if(seg->snapshots[0]) {
+            DeleteBitMap(seg->snapshots[0], seg->heap_klass);
+        }
+#endif
     }
     do_free(pool, sizeof(Segment) * size);
 }
@@ -1064,7 +1171,9 @@ static void HeapManager_ExpandHeap(HeapManager *mng, size_t list_size)
         THROW_OutOfMemory(heap_size);
     }
     managed_heap_end = (char *)managed_heap + heap_size;
+#ifndef HAVE_MMAP
     do_bzero(managed_heap, heap_size);
+#endif
 #if defined(GCDEBUG) && defined(GCSTAT)
     global_gc_stat.managed_heap = (AllocationNode *) managed_heap;
     global_gc_stat.managed_heap_end = (AllocationNode *) managed_heap_end;
@@ -1103,6 +1212,7 @@ static HeapManager *HeapManager_init(size_t list_size)
     ARRAY_init(size_t, &mng->segment_size_a, 1);
 #if defined(USE_GENERATIONAL_GC)
     ARRAY_init(BitMapPtr, &mng->remember_sets, 1);
+    mng->minor_gc_count = 0;
 #endif
 
     HeapManager_ExpandHeap(mng, list_size);
@@ -1110,6 +1220,30 @@ static HeapManager *HeapManager_init(size_t list_size)
         Heap_Init(mng, (mng->heaps+i), i);
     }
     ARRAY_init(GCRoot, &mng->roots, 1);
+#if defined(USE_PARALLEL_MARK) || defined(USE_CONCURRENT_SWEEP)
+    {
+        long cpus = GC_ONLINE_CPUS;
+#ifdef USE_PARALLEL_MARK
+        mng->mark_threads = MOZVM_MSGC_MARK_THREADS;
+        if(cpus > 0 && cpus < MOZVM_MSGC_MARK_THREADS) {
+            mng->mark_threads = (unsigned)cpus;
+        }
+#endif
+#ifdef USE_CONCURRENT_SWEEP
+        /* a sweeper sharing the only CPU just delays the allocator */
+        mng->concurrent_sweep = cpus > 1;
+        mng->sweep_pending  = false;
+        mng->sweep_shutdown = false;
+        if(mng->concurrent_sweep) {
+            pthread_mutex_init(&mng->sweep_lock, NULL);
+            pthread_cond_init(&mng->sweep_cond, NULL);
+            if(pthread_create(&mng->sweeper, NULL, ConcurrentSweeper_run, mng) != 0) {
+                THROW_OutOfMemory(0);
+            }
+        }
+#endif
+    }
+#endif
     return mng;
 }
 
@@ -1120,12 +1254,23 @@ static void HeapManager_delete(HeapManager *mng)
     void **p;
     SubHeap *h;
 
-    if(mng->mstack.capacity > 0) {
-        MarkStack mstack = mng->mstack;
-        do_free(mstack.stack,  (mstack.capacity + 1) * sizeof(kObject *));
-        mng->mstack.stack    = NULL;
-        mng->mstack.capacity = 0;
+#ifdef USE_CONCURRENT_SWEEP
+    if(mng->concurrent_sweep) {
+        pthread_mutex_lock(&mng->sweep_lock);
+        mng->sweep_shutdown = true;
+        pthread_cond_broadcast(&mng->sweep_cond);
+        pthread_mutex_unlock(&mng->sweep_lock);
+        pthread_join(mng->sweeper, NULL);
+        pthread_mutex_destroy(&mng->sweep_lock);
+        pthread_cond_destroy(&mng->sweep_cond);
+    }
+#endif
+    mstack_dispose(&mng->mstack);
+#ifdef USE_PARALLEL_MARK
+    for (i = 0; i < MOZVM_MSGC_MARK_THREADS - 1; i++) {
+        mstack_dispose(&mng->worker_mstack[i]);
     }
+#endif
 
     HeapManager_final_free(mng);
 
@@ -1143,7 +1288,14 @@ static void HeapManager_delete(HeapManager *mng)
     FOR_EACH_ARRAY_(mng->managed_heap_a, p, i) {
         size_t *size = ARRAY_n(mng->heap_size_a, i);
         call_free_aligned(*p, *size);
+#if defined(USE_GENERATIONAL_GC)
+        do_free(ARRAY_get(BitMapPtr, &mng->remember_sets, i),
+                RememberSet_size(*size));
+#endif
     }
+#if defined(USE_GENERATIONAL_GC)
+    ARRAY_dispose(BitMapPtr, &mng->remember_sets);
+#endif
     ARRAY_dispose(size_t,  &mng->heap_size_a);
     ARRAY_dispose(VoidPtr, &mng->managed_heap_a);
     ARRAY_dispose(VoidPtr, &mng->managed_heap_end_a);
@@ -1151,6 +1303,55 @@ static void HeapManager_delete(HeapManager *mng)
     do_free(mng, sizeof(*mng));
 }
 
+/* frees every object and returns all segments to the segment list. The
+ * heap memory, the roots and the sweeper thread are kept for the next
+ * document. */
+static void HeapManager_reset(HeapManager *mng)
+{
+    size_t i, j;
+    SubHeap *h;
+
+#ifdef USE_CONCURRENT_SWEEP
+    ConcurrentSweeper_wait(mng);
+#endif
+    HeapManager_final_free(mng);
+    for_each_heap(h, i, mng->heaps) {
+        Heap_dispose(mng->heaps+i);
+        Heap_Init(mng, (mng->heaps+i), i);
+    }
+
+    mng->segmentList = NULL;
+    for (i = ARRAY_size(mng->segment_pool_a); i-- > 0;) {
+        Segment *pool = ARRAY_get(SegmentPtr, &mng->segment_pool_a, i);
+        size_t size = ARRAY_get(size_t, &mng->segment_size_a, i);
+        for (j = size; j-- > 0;) {
+            Segment *seg = pool + j;
+            if(seg->base[0]) {
+                DeleteBitMap(seg->base[0], seg->heap_klass);
+                seg->base[0] = NULL;
+            }
+#ifdef USE_GENERATIONAL_GC
+            if(seg->snapshots[0]) {
+                DeleteBitMap(seg->snapshots[0], seg->heap_klass);
+                seg->snapshots[0] = NULL;
+            }
+            seg->tenure_live_count = 0;
+#endif
+            seg->live_count = 0;
+            seg->next = mng->segmentList;
+            mng->segmentList = seg;
+        }
+#if defined(USE_GENERATIONAL_GC)
+        do_bzero(ARRAY_get(BitMapPtr, &mng->remember_sets, i),
+                RememberSet_size(ARRAY_get(size_t, &mng->heap_size_a, i)));
+#endif
+    }
+#if defined(USE_GENERATIONAL_GC)
+    mng->minor_gc_count = 0;
+#endif
+    mng->flags = 0;
+}
+
 static SubHeap *findSubHeapBySize(HeapManager *mng, size_t n)
 {
     unsigned klass = SizeToKlass(n);
@@ -1180,6 +1381,12 @@ static bool DBG_CHECK_OBJECT_IN_HEAP(kObject *o, SubHeap *h)
 static void deferred_sweep(HeapManager *mng, kObject *o)
 {
 #ifdef GC_USE_DEFERREDSWEEP
+#ifdef USE_CONCURRENT_SWEEP
+    if(mng->concurrent_sweep) {
+        /* already released by the sweeper */
+        return;
+    }
+#endif
 #if GCSTAT
     NodeHeader *head = (NodeHeader *) (((uintptr_t)o) & ~(SEGMENT_SIZE - 1UL));
     global_gc_stat.collected[head->klass] += 1;
@@ -1190,8 +1397,27 @@ static void deferred_sweep(HeapManager *mng, kObject *o)
 #endif
 }
 
-#define minorGC(mng) bitmapMarkingGC(mng, GC_MAJOR)
-#define majorGC(mng) bitmapMarkingGC(mng, GC_MINOR)
+#define minorGC(mng) bitmapMarkingGC(mng, GC_MINOR)
+#define majorGC(mng) bitmapMarkingGC(mng, GC_MAJOR)
+
+/* Minor GCs keep the mark bits of the last GC (sticky mark bits), so only
+ * objects allocated since then are traced and swept. A major GC is run
+ * every MINOR_GC_PER_MAJOR_GC cycles, or when a minor GC cannot free
+ * enough space. */
+static void bmgc_collect(HeapManager *mng)
+{
+#ifdef USE_GENERATIONAL_GC
+    if(mng->minor_gc_count < MINOR_GC_PER_MAJOR_GC) {
+        mng->minor_gc_count += 1;
+        minorGC(mng);
+        if(!bitmap_get(&mng->flags, GC_MAJOR_FLAG)) {
+            return;
+        }
+    }
+    mng->minor_gc_count = 0;
+#endif
+    majorGC(mng);
+}
 
 static kObject *bm_malloc_internal(HeapManager *mng, size_t n)
 {
@@ -1218,13 +1444,7 @@ static kObject *bm_malloc_internal(HeapManager *mng, size_t n)
     HeapManager_ExpandHeap(mng, SUBHEAP_DEFAULT_SEGPOOL_SIZE*2);
     newSegment(mng, h);
 #else
-#ifdef USE_GENERATIONAL_GC
-    minorGC(mng);
-    temp = tryAlloc(mng, h);
-#endif
-    if(temp != NULL)
-        goto L_finaly;
-    majorGC(mng);
+    bmgc_collect(mng);
 #endif /* defined(USE_SAFEPOINT_POLICY) */
     temp = (kObject *)tryAlloc(mng, h);
     if(temp == NULL) {
@@ -1484,7 +1704,9 @@ static void NodeVisitor_visitRange(NodeVisitor *visitor, kObject **begin, kObjec
     struct GCVisitor *gv = (struct GCVisitor *)visitor;
     kObject **itr;
     for (itr = begin; itr != end; ++itr) {
-        mark_mstack(gv->mng, *itr, gv->mstack);
+        if (*itr) {
+            mark_mstack(gv->mng, *itr, gv->mstack);
+        }
     }
 }
 
@@ -1495,85 +1717,262 @@ static void RememberSet_Add(kObject *o)
     uintptr_t offset = ((uintptr_t)o &  (SEGMENT_SIZE - 1UL)) >> SUBHEAP_KLASS_MIN;
     NodeHeader *head = (NodeHeader *) addr;
     bitmap_t *map = head->remember_set;
-#ifdef DEBUG_WRITE_BARRIER
-    int ret = bitmap_get(map+(offset/BITS), offset%BITS);
-    if(ret == 0 && Object_isTenure(o)) {
-        fprintf(stderr, "W %p\n", o);
+    bitmap_set(map+(offset/BITS), offset, 1);
+}
+
+static void Node_reftrace(Node *o, NodeVisitor *visitor);
+
+/* trace tenured objects written since the last GC, then forget them */
+static void RememberSet_Reftrace(HeapManager *mng, NodeVisitor *visitor)
+{
+    size_t i, j;
+    for (i = 0; i < ARRAY_size(mng->remember_sets); i++) {
+        bitmap_t *map = ARRAY_get(BitMapPtr, &mng->remember_sets, i);
+        char *heap = (char *)ARRAY_get(VoidPtr, &mng->managed_heap_a, i);
+        size_t size = ARRAY_get(size_t, &mng->heap_size_a, i) / MIN_ALIGN / BITS;
+        for (j = 0; j < size; j++) {
+            bitmap_t bm = map[j];
+            while(bm != 0) {
+                uintptr_t offset = j * BITS + CTZ(bm);
+                bm &= bm - 1;
+                Node_reftrace((kObject *)(heap + (offset << SUBHEAP_KLASS_MIN)), visitor);
+            }
+            map[j] = 0;
+        }
+    }
+}
+
+static void RememberSet_Clear(HeapManager *mng)
+{
+    size_t i;
+    for (i = 0; i < ARRAY_size(mng->remember_sets); i++) {
+        size_t size = ARRAY_get(size_t, &mng->heap_size_a, i);
+        do_bzero(ARRAY_get(BitMapPtr, &mng->remember_sets, i), RememberSet_size(size));
     }
+}
 #endif
 
-#ifdef USE_GENERATIONAL_GC
-    bitmap_set(map+(offset/BITS), offset%BITS, Object_isTenure(o));
-#else
+static void NodeManager_mark_root(HeapManager *mng, NodeVisitor *visitor);
+static void Node_reftrace(Node *o, NodeVisitor *visitor);
+
+static void bmgc_gc_mark_root(HeapManager *mng, NodeVisitor *visitor)
+{
+    NodeManager_mark_root(mng, visitor);
+}
+
+#ifdef USE_PARALLEL_MARK
+/* Work-stealing parallel mark. Each worker drains its own mark stack and
+ * moves the bottom half of it to a shared buffer when the buffer is
+ * empty; idle workers take a whole shared buffer from another worker.
+ * Mark bits and live counts are updated with atomic operations. */
+typedef struct ParallelMarker ParallelMarker;
+
+typedef struct MarkWorker {
+    struct GCVisitor visitor;
+    ParallelMarker *marker;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    kObject **shared;
+    size_t shared_size;
+    size_t shared_capacity;
+} MarkWorker;
+
+struct ParallelMarker {
+    MarkWorker workers[MOZVM_MSGC_MARK_THREADS];
+    unsigned size;
+    unsigned idle;
+};
+
+static void bitmap_mark_atomic(bitmap_t bm, Segment *seg, uintptr_t idx)
+{
+    size_t i;
+    for (i = 1; i < SEGMENT_LEVEL-1 && BM_IS_FULL(bm); ++i) {
+        uintptr_t bpidx, bpmask;
+        BITPTR_INIT_(bpidx, bpmask, idx);
+        bm = __atomic_or_fetch(SEG_BITMAP_N(seg, i, bpidx), bpmask, __ATOMIC_RELAXED);
+        idx /= BITS;
+    }
+}
+
+static void mark_mstack_atomic(HeapManager *mng, kObject *o, MarkStack *mstack)
+{
     Segment *seg;
     int index, klass;
     uintptr_t bpidx, bpmask;
+    bitmap_t *bm, old;
     OBJECT_LOAD_BLOCK_INFO(o, seg, index, klass);
     BITPTR_INIT_(bpidx, bpmask, index);
-    bitmap_t *bm  = SEG_TRACE_BITMAP_N(seg, 0, bpidx);
-    bitmap_set(map+(offset/BITS), offset%BITS, !BM_TEST(*bm, bpmask));
+    bm = SEG_BITMAP_N(seg, 0, bpidx);
+
+    assert(DBG_CHECK_OBJECT_IN_SEGMENT(o, seg));
+    if(BM_TEST(__atomic_load_n(bm, __ATOMIC_RELAXED), bpmask)) {
+        return;
+    }
+    old = __atomic_fetch_or(bm, bpmask, __ATOMIC_RELAXED);
+    if(BM_TEST(old, bpmask)) {
+        return;
+    }
+#ifdef USE_GENERATIONAL_GC
+    Object_SetTenure(o);
 #endif
-}
+    bitmap_mark_atomic(old | bpmask, seg, bpidx);
+    __atomic_fetch_add(&seg->live_count, 1, __ATOMIC_RELAXED);
+    mstack_push(mstack, o);
+#ifdef GCSTAT
+    __atomic_fetch_add(&global_gc_stat.marked[klass], 1, __ATOMIC_RELAXED);
 #endif
+}
 
-#ifdef USE_GENERATIONAL_GC
-static void Kwrite_barrier(kObject *parent)
+static void ParallelVisitor_visit(NodeVisitor *visitor, kObject *object)
 {
-    RememberSet_Add(parent);
+    struct GCVisitor *gv = (struct GCVisitor *)visitor;
+    mark_mstack_atomic(gv->mng, object, gv->mstack);
 }
 
-static void KupdateObjectField(kObject *parent, kObject *oldValPtr, kObject *newVal)
+static void ParallelVisitor_visitRange(NodeVisitor *visitor, kObject **begin, kObject **end)
 {
-    Kwrite_barrier(parent);
+    struct GCVisitor *gv = (struct GCVisitor *)visitor;
+    kObject **itr;
+    for (itr = begin; itr != end; ++itr) {
+        if (*itr) {
+            mark_mstack_atomic(gv->mng, *itr, gv->mstack);
+        }
+    }
 }
-#endif
 
-#if defined(USE_GENERATIONAL_GC)
-static void RememberSet_Reftrace(HeapManager *mng, KObjectVisitor *visitor)
+static void MarkWorker_share(MarkWorker *w)
 {
-    size_t i;
-    bitmap_t *x;
-    FOR_EACH_ARRAY_(mng->remember_sets, i) {
-        uintptr_t base_Address = (uintptr_t) ARRAY_n(mng->managed_heap_a, i);
-        size_t bitmap_size = ARRAY_n(mng->heap_size_a, i) / (MIN_ALIGN * BITS);
-        bitmap_t *base = x;
-        bitmap_t *m = base;
-        bitmap_t *e = m + bitmap_size;
-        for (; m != e; base+=BITS, base_Address +=
-#if SIZEOF_VOIDP*8 == 64
-                (SEGMENT_SIZE)
-#else
-                (SEGMENT_SIZE/sizeof(void *))
-#endif
-            ) {
-            for (; m < base + BITS; ++m) {
-                bitmap_t b = (*m);
-                while(b != 0) {
-                    uintptr_t index, offset;
-                    index = CTZ(b);
-                    b ^= 1UL << index;
-                    offset = (m - base) * BITS + index;
-                    kObject *o = (kObject *)(base_Address + (offset << SUBHEAP_KLASS_MIN));
-#ifdef DEBUG_WRITE_BARRIER
-                    fprintf(stderr, "R %p\n", o);
-#endif
-                    KLIB kObjectProto_Reftrace(o, visitor);
-                }
-                bitmap_reset(m, 0);
-            }
+    MarkStack *mstack = w->visitor.mstack;
+    size_t half = mstack->tail / 2;
+    if(mstack->tail < PARALLEL_MARK_SHARE_SIZE ||
+            __atomic_load_n(&w->shared_size, __ATOMIC_RELAXED) != 0) {
+        return;
+    }
+    pthread_mutex_lock(&w->lock);
+    if(w->shared_capacity < half) {
+        size_t oldSize = sizeof(kObject *) * w->shared_capacity;
+        w->shared_capacity = mstack->capacity + 1;
+        w->shared = (kObject **)do_realloc(w->shared, oldSize,
+                sizeof(kObject *) * w->shared_capacity);
+    }
+    memcpy(w->shared, mstack->stack, sizeof(kObject *) * half);
+    memmove(mstack->stack, mstack->stack + half,
+            sizeof(kObject *) * (mstack->tail - half));
+    mstack->tail -= half;
+    __atomic_store_n(&w->shared_size, half, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&w->lock);
+}
+
+static bool MarkWorker_take(MarkWorker *w, MarkWorker *victim)
+{
+    size_t i, size;
+    if(__atomic_load_n(&victim->shared_size, __ATOMIC_ACQUIRE) == 0) {
+        return false;
+    }
+    pthread_mutex_lock(&victim->lock);
+    size = victim->shared_size;
+    for (i = 0; i < size; i++) {
+        mstack_push(w->visitor.mstack, victim->shared[i]);
+    }
+    __atomic_store_n(&victim->shared_size, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&victim->lock);
+    return size != 0;
+}
+
+static bool MarkWorker_steal(MarkWorker *w)
+{
+    ParallelMarker *pm = w->marker;
+    unsigned i, id = w - pm->workers;
+    for (i = 0; i < pm->size; i++) {
+        if(MarkWorker_take(w, &pm->workers[(id + i) % pm->size])) {
+            return true;
         }
     }
+    return false;
 }
 
-#endif
+static void *MarkWorker_run(void *arg)
+{
+    MarkWorker *w = (MarkWorker *)arg;
+    ParallelMarker *pm = w->marker;
+    kObject *ref;
+    while(1) {
+        while((ref = mstack_next(w->visitor.mstack)) != NULL) {
+            Node_reftrace(ref, &w->visitor.base);
+            MarkWorker_share(w);
+        }
+        if(MarkWorker_steal(w)) {
+            continue;
+        }
+        /* an idle worker has an empty shared buffer, so the mark is
+         * complete once every worker is idle */
+        __atomic_add_fetch(&pm->idle, 1, __ATOMIC_SEQ_CST);
+        while(1) {
+            if(__atomic_load_n(&pm->idle, __ATOMIC_SEQ_CST) == pm->size) {
+                return NULL;
+            }
+            __atomic_sub_fetch(&pm->idle, 1, __ATOMIC_SEQ_CST);
+            if(MarkWorker_steal(w)) {
+                break;
+            }
+            __atomic_add_fetch(&pm->idle, 1, __ATOMIC_SEQ_CST);
+            sched_yield();
+        }
+    }
+    return NULL;
+}
 
-static void NodeManager_mark_root(HeapManager *mng, NodeVisitor *visitor);
-static void Node_reftrace(Node *o, NodeVisitor *visitor);
+static bool ParallelMarker_enabled(HeapManager *mng)
+{
+    size_t i, heap_size = 0;
+    if(mng->mark_threads < 2) {
+        return false;
+    }
+    for (i = 0; i < ARRAY_size(mng->heap_size_a); i++) {
+        heap_size += ARRAY_get(size_t, &mng->heap_size_a, i);
+    }
+    return heap_size >= PARALLEL_MARK_MIN_HEAP_SIZE;
+}
 
-static void bmgc_gc_mark_root(HeapManager *mng, NodeVisitor *visitor)
+/* marks everything reachable from the objects on mng->mstack */
+static void ParallelMarker_mark(HeapManager *mng)
 {
-    NodeManager_mark_root(mng, visitor);
+    ParallelMarker pm;
+    unsigned i;
+    pm.size = mng->mark_threads;
+    pm.idle = 0;
+    for (i = 0; i < pm.size; i++) {
+        MarkWorker *w = &pm.workers[i];
+        w->visitor.base.fn_visit = ParallelVisitor_visit;
+        w->visitor.base.fn_visit_range = ParallelVisitor_visitRange;
+        w->visitor.mng = mng;
+        w->visitor.mstack = (i == 0) ? &mng->mstack
+            : mstack_init(&mng->worker_mstack[i - 1]);
+        w->marker = &pm;
+        w->shared = NULL;
+        w->shared_size = 0;
+        w->shared_capacity = 0;
+        pthread_mutex_init(&w->lock, NULL);
+    }
+    for (i = 1; i < pm.size; i++) {
+        MarkWorker *w = &pm.workers[i];
+        if(pthread_create(&w->thread, NULL, MarkWorker_run, w) != 0) {
+            THROW_OutOfMemory(0);
+        }
+    }
+    MarkWorker_run(&pm.workers[0]);
+    for (i = 0; i < pm.size; i++) {
+        MarkWorker *w = &pm.workers[i];
+        if(i > 0) {
+            pthread_join(w->thread, NULL);
+        }
+        pthread_mutex_destroy(&w->lock);
+        if(w->shared) {
+            do_free(w->shared, sizeof(kObject *) * w->shared_capacity);
+        }
+    }
 }
+#endif
 
 static void bmgc_gc_mark(HeapManager *mng, enum gc_mode mode)
 {
@@ -1587,9 +1986,18 @@ static void bmgc_gc_mark(HeapManager *mng, enum gc_mode mode)
 
     bmgc_gc_mark_root(mng, &visitor.base);
 #ifdef USE_GENERATIONAL_GC
-    if(mode & GC_MINOR) {
+    if(mode & GC_MAJOR) {
+        RememberSet_Clear(mng);
+    }
+    else {
         RememberSet_Reftrace(mng, &visitor.base);
     }
+#endif
+#ifdef USE_PARALLEL_MARK
+    if(ParallelMarker_enabled(mng)) {
+        ParallelMarker_mark(mng);
+        return;
+    }
 #endif
     ref = mstack_next(mstack);
     if(unlikely(ref == 0))
@@ -1604,40 +2012,165 @@ static void bmgc_gc_mark(HeapManager *mng, enum gc_mode mode)
     tail  = &e->next;\
 } while(0)
 
-static void rearrangeSegList(SubHeap *h, unsigned klass, bitmap_t *checkFull)
+/* Counts the free blocks left in each segment of the heap and returns
+ * true when the heap has to grow. With deferred, the segments are swept
+ * later by the concurrent sweeper, which also rebuilds the freelist. */
+static bool rearrangeSegList(SubHeap *h, unsigned klass, bool deferred)
 {
-    size_t i, count_dead = 0;
-    Segment *unfilled = NULL, **unfilled_tail = &unfilled;
+    size_t i, count_dead = 0, unfilled = 0;
+    Segment *list = NULL, **tail = &list;
 
     if(h->seglist_size < 1)
-        return;
+        return false;
     for (i = 0; i < h->seglist_size; i++) {
         Segment *seg = h->seglist[i];
         size_t dead = SegmentNodeCount[klass] - seg->live_count;
         count_dead += dead;
+        unfilled += (dead > 0);
+        if(deferred)
+            continue;
         if(dead > 0)
-            LIST_PUSH(unfilled_tail, seg);
+            LIST_PUSH(tail, seg);
 #ifdef USE_GENERATIONAL_GC
         SAVE_SNAPSHOT(seg);
         SAVE_LIVECOUNT(seg);
 #endif
     }
-    *unfilled_tail = NULL;
-    h->freelist = unfilled;
-    fetchSegment(h, klass);
-    bitmap_set(checkFull, klass,
-            (count_dead < SegmentNodeCount[klass] && h->freelist == NULL));
+    if(!deferred) {
+        *tail = NULL;
+        h->freelist = list;
+        fetchSegment(h, klass);
+    }
+    return count_dead < SegmentNodeCount[klass] && unfilled <= 1;
+}
+
+#ifdef USE_CONCURRENT_SWEEP
+/* Concurrent sweep: the collecting thread only decides whether the heap
+ * has to grow. A background thread walks the segments, frees the child
+ * arrays of dead nodes, saves the generational snapshot and hands every
+ * segment with free blocks to the allocator as soon as it is swept. The
+ * allocator waits only when its size class has no swept segment left. */
+static void sweepSegment(Segment *seg, unsigned klass)
+{
+    bitmap_t *bm0;
+    bitmap_t *b0 = (bitmap_t *) seg->base[0];
+    bitmap_t *l0 = b0 + SegmentBitMapCount[klass];
+    for (bm0 = b0; bm0 < l0; ++bm0) {
+        b0_final_sweep(*bm0, bm0 - b0, seg);
+    }
+#ifdef USE_GENERATIONAL_GC
+    SAVE_SNAPSHOT(seg);
+    SAVE_LIVECOUNT(seg);
+#endif
 }
 
-static void bmgc_gc_sweep(HeapManager *mng)
+static void *ConcurrentSweeper_run(void *arg)
+{
+    HeapManager *mng = (HeapManager *)arg;
+    SubHeap *h;
+    size_t i, j;
+    pthread_mutex_lock(&mng->sweep_lock);
+    while(1) {
+        while(!mng->sweep_pending && !mng->sweep_shutdown) {
+            pthread_cond_wait(&mng->sweep_cond, &mng->sweep_lock);
+        }
+        if(!mng->sweep_pending) {
+            break;
+        }
+        pthread_mutex_unlock(&mng->sweep_lock);
+        for_each_heap(h, j, mng->heaps) {
+            for (i = 0; i < h->sweep_size; i++) {
+                Segment *seg = h->seglist[i];
+                sweepSegment(seg, j);
+                if(seg->live_count < SegmentNodeCount[j]) {
+                    pthread_mutex_lock(&mng->sweep_lock);
+                    seg->next = h->freelist;
+                    h->freelist = seg;
+                    pthread_cond_broadcast(&mng->sweep_cond);
+                    pthread_mutex_unlock(&mng->sweep_lock);
+                }
+            }
+            pthread_mutex_lock(&mng->sweep_lock);
+            h->sweeping = false;
+            pthread_cond_broadcast(&mng->sweep_cond);
+            pthread_mutex_unlock(&mng->sweep_lock);
+        }
+        pthread_mutex_lock(&mng->sweep_lock);
+        mng->sweep_pending = false;
+        pthread_cond_broadcast(&mng->sweep_cond);
+    }
+    pthread_mutex_unlock(&mng->sweep_lock);
+    return NULL;
+}
+
+/* hands the segments allocated so far to the sweeper. Must be called
+ * before the heaps get new segments. */
+static void ConcurrentSweeper_prepare(HeapManager *mng)
+{
+    size_t i;
+    SubHeap *h;
+    for_each_heap(h, i, mng->heaps) {
+        h->sweep_size = h->seglist_size;
+        h->sweeping = true;
+        h->freelist = NULL;
+        h->p.bitptrs[0].idx  = 0;
+        h->p.bitptrs[0].mask = 1;
+        h->p.seg = &segment_dummy;
+    }
+}
+
+static void ConcurrentSweeper_start(HeapManager *mng)
+{
+    pthread_mutex_lock(&mng->sweep_lock);
+    mng->sweep_pending = true;
+    pthread_cond_broadcast(&mng->sweep_cond);
+    pthread_mutex_unlock(&mng->sweep_lock);
+}
+
+static void ConcurrentSweeper_wait(HeapManager *mng)
+{
+    if(!mng->concurrent_sweep) {
+        return;
+    }
+    pthread_mutex_lock(&mng->sweep_lock);
+    while(mng->sweep_pending) {
+        pthread_cond_wait(&mng->sweep_cond, &mng->sweep_lock);
+    }
+    pthread_mutex_unlock(&mng->sweep_lock);
+}
+
+static Segment *ConcurrentSweeper_next(HeapManager *mng, SubHeap *h)
+{
+    Segment *seg;
+    if(!mng->concurrent_sweep) {
+        return freelist_isEmpty(h) ? NULL : freelist_pop(h);
+    }
+    pthread_mutex_lock(&mng->sweep_lock);
+    while(h->freelist == NULL && h->sweeping) {
+        pthread_cond_wait(&mng->sweep_cond, &mng->sweep_lock);
+    }
+    seg = h->freelist;
+    if(seg != NULL) {
+        h->freelist = seg->next;
+    }
+    pthread_mutex_unlock(&mng->sweep_lock);
+    return seg;
+}
+#endif
+
+static void bmgc_gc_sweep(HeapManager *mng, enum gc_mode mode)
 {
     bitmap_t checkFull = 0;
+    bool deferred = false;
     size_t i, j;
     SubHeap *h;
 
+#ifdef USE_CONCURRENT_SWEEP
+    deferred = mng->concurrent_sweep;
+#endif
     for_each_heap(h, j, mng->heaps) {
 #ifndef GC_USE_DEFERREDSWEEP
-        for (i = 0; i < h->seglist_size; i++) {
+        for (i = 0; !deferred && i < h->seglist_size; i++) {
             Segment *seg = h->seglist[i];
             bitmap_t *bm0;
             bitmap_t *b0 = (bitmap_t *) seg->base[0];
@@ -1650,24 +2183,43 @@ static void bmgc_gc_sweep(HeapManager *mng)
                 h->heap_klass,
                 global_gc_stat.collected[h->heap_klass]);
 #endif
-        rearrangeSegList(h, j, &checkFull);
+        bitmap_set(&checkFull, j, rearrangeSegList(h, j, deferred));
     }
 
-    if(checkFull) {
 #ifdef USE_GENERATIONAL_GC
+    if(checkFull) {
         bitmap_set(&mng->flags, GC_MAJOR_FLAG, 1);
+        if(mode == GC_MINOR) {
+            /* tenured objects may be dead; collect them before growing */
+            return;
+        }
+    }
 #endif
+#ifdef USE_CONCURRENT_SWEEP
+    if(deferred) {
+        ConcurrentSweeper_prepare(mng);
+    }
+#endif
+    if(checkFull) {
         HeapManager_ExpandHeap(mng, SUBHEAP_DEFAULT_SEGPOOL_SIZE*2);
         for_each_heap(h, i, mng->heaps) {
             if(bitmap_get(&checkFull, i))
                 newSegment(mng, h);
         }
     }
+#ifdef USE_CONCURRENT_SWEEP
+    if(deferred) {
+        ConcurrentSweeper_start(mng);
+    }
+#endif
 }
 
 static void bitmapMarkingGC(HeapManager *mng, enum gc_mode mode)
 {
     gc_info("GC starting");
+#ifdef USE_CONCURRENT_SWEEP
+    ConcurrentSweeper_wait(mng);
+#endif
     bitmap_reset(&mng->flags, 0);
     bmgc_gc_Init(mng, mode);
 #ifdef GCSTAT
@@ -1678,7 +2230,7 @@ static void bitmapMarkingGC(HeapManager *mng, enum gc_mode mode)
 #endif
     bmgc_gc_mark(mng, mode);
 
-    bmgc_gc_sweep(mng);
+    bmgc_gc_sweep(mng, mode);
 
 #ifdef GCSTAT
     SubHeap *h;
@@ -1701,7 +2253,7 @@ static inline void bmgc_Object_free(kObject *o)
 {
     unsigned len = Node_length(o);
     if (len > MOZVM_SMALL_ARRAY_LIMIT) {
-        ARRAY_dispose(NodePtr, &o->entry.array);
+        node_array_dispose(o);
     }
     do_bzero((void *)o, sizeof(kObject));
 #ifdef GCSTAT
@@ -1714,19 +2266,25 @@ static inline void bmgc_Object_free(kObject *o)
 #endif
 }
 
-static HeapManager *g_manager = NULL;
+static MOZVM_THREAD_LOCAL HeapManager *g_manager = NULL;
 
 void NodeManager_init()
 {
     size_t default_size = SUBHEAP_DEFAULT_SEGPOOL_SIZE;
- #ifdef GCSTAT
-	// global_gc_stat.fp = fopen("KONOHA_BMGC_INFO", "a");
+    if (g_manager != NULL) {
+        return;
+    }
+#ifdef GCSTAT
+    // global_gc_stat.fp = fopen("KONOHA_BMGC_INFO", "a");
 #endif
-   g_manager = HeapManager_init(default_size);
+    g_manager = HeapManager_init(default_size);
 }
 
 void NodeManager_dispose()
 {
+    if (g_manager == NULL) {
+        return;
+    }
     HeapManager_delete(g_manager);
     g_manager = NULL;
 #ifdef GCSTAT
@@ -1736,23 +2294,51 @@ void NodeManager_dispose()
 
 void NodeManager_reset()
 {
-    NodeManager_dispose();
-    NodeManager_init();
+    if (g_manager == NULL) {
+        NodeManager_init();
+        return;
+    }
+    HeapManager_reset(g_manager);
 }
 
 void NodeManager_print_stats()
 {
 }
 
+#ifdef USE_GENERATIONAL_GC
+void NodeManager_write_barrier(Node *o)
+{
+    RememberSet_Add(o);
+}
+#endif
+
 void NodeManager_add_gc_root(void *ptr, f_trace f)
 {
-    HeapManager *mng = g_manager;
+    HeapManager *mng;
     GCRoot root;
+    /* a runtime may be created before the node manager */
+    NodeManager_init();
+    mng = g_manager;
     root.ptr = ptr;
     root.trace = f;
     ARRAY_add(GCRoot, &mng->roots, &root);
 }
 
+void NodeManager_remove_gc_root(void *ptr)
+{
+    HeapManager *mng = g_manager;
+    GCRoot *x, *e;
+    if (mng == NULL) {
+        return;
+    }
+    FOR_EACH_ARRAY(mng->roots, x, e) {
+        if (x->ptr == ptr) {
+            ARRAY_remove(GCRoot, &mng->roots, x - ARRAY_BEGIN(mng->roots));
+            return;
+        }
+    }
+}
+
 static void NodeManager_mark_root(HeapManager *mng, NodeVisitor *visitor)
 {
     GCRoot *x, *e;
@@ -21,6 +21,32 @@ MOZVM_NODE_PROFILE_EACH(MOZVM_PROFILE_DECL);
 // #define DEBUG2 1
 
 static inline Node *node_alloc();
+static inline NodePtr *node_array_alloc(unsigned capacity);
+static inline void node_array_free(NodePtr *list, unsigned capacity);
+
+#define NODE_ARRAY_MIN_CAPACITY 4
+
+static inline unsigned node_array_capacity(unsigned size)
+{
+    unsigned capacity = NODE_ARRAY_MIN_CAPACITY;
+    while (capacity < size) {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+static inline void node_array_init(Node *o, unsigned size)
+{
+    unsigned capacity = node_array_capacity(size);
+    o->entry.array.list = node_array_alloc(capacity);
+    o->entry.array.capacity = capacity;
+    o->entry.array.size = size;
+}
+
+static inline void node_array_dispose(Node *o)
+{
+    node_array_free(o->entry.array.list, o->entry.array.capacity);
+}
 
 Node *Node_new(const char *tag, const char *str, unsigned len, unsigned elm_size, const char *value)
 {
@@ -30,25 +56,58 @@ Node *Node_new(const char *tag, const char *str, unsigned len, unsigned elm_size
     fprintf(stderr, "A %p %d\n", o, elm_size);
 #endif
     NODE_GC_INIT(o);
+    Node_init(o, tag, str, len, elm_size, value);
+    return o;
+}
+
+void Node_init(Node *o, const char *tag, const char *str, unsigned len, unsigned elm_size, const char *value)
+{
+#ifdef MOZVM_AST_LAZY_NODE
+    o->thunk = NULL;
+#endif
     o->tag = tag;
     o->pos = str;
     o->len = len;
     o->value = value;
+#ifdef MOZVM_NODE_MERKLE_DIGEST
+    o->digest[0] = o->digest[1] = 0;
+#endif
     o->entry.raw.size = elm_size;
     if (elm_size > MOZVM_SMALL_ARRAY_LIMIT) {
-        unsigned i;
-        ARRAY_init(NodePtr, &o->entry.array, elm_size);
-        for (i = 0; i < elm_size; i++) {
-            ARRAY_add(NodePtr, &o->entry.array, NULL);
-        }
+        node_array_init(o, elm_size);
+        memset(o->entry.array.list, 0, sizeof(NodePtr) * elm_size);
     }
     else {
         o->entry.raw.ary[0] = NULL;
         o->entry.raw.ary[1] = NULL;
     }
+}
+
+#ifdef MOZVM_AST_LAZY_NODE
+Node *Node_new_lazy(NodeThunk *thunk)
+{
+    Node *o = Node_new(NULL, NULL, 0, 0, NULL);
+    o->thunk = thunk;
     return o;
 }
 
+void Node_force_thunk(Node *o)
+{
+    NodeThunk *thunk = o->thunk;
+    o->thunk = NULL;
+    thunk->fn_force(o, thunk);
+    thunk->fn_dispose(thunk);
+}
+
+static inline void Node_dispose_thunk(Node *o)
+{
+    if (o->thunk) {
+        o->thunk->fn_dispose(o->thunk);
+        o->thunk = NULL;
+    }
+}
+#endif
+
 Node *Node_get(Node *o, unsigned index)
 {
     unsigned len = Node_length(o);
@@ -78,6 +137,7 @@ void Node_set(Node *o, unsigned index, uint16_t labelId, Node *n)
     }
 #endif
     n->labelId = labelId;
+    NODE_GC_WRITE_BARRIER(o);
     while (index >= Node_length(o)) {
         Node_append(o, NULL);
     }
@@ -96,18 +156,27 @@ void Node_append(Node *o, Node *n)
     MOZVM_PROFILE_INC(NODE_APPEND);
     if (n) {
         NODE_GC_RETAIN(n);
+        NODE_GC_WRITE_BARRIER(o);
     }
     if (len > MOZVM_SMALL_ARRAY_LIMIT) {
-        ARRAY_ensureSize(NodePtr, &o->entry.array, 1);
-        ARRAY_add(NodePtr, &o->entry.array, n);
+        unsigned capacity = o->entry.array.capacity;
+        if (len == capacity) {
+            NodePtr *list = node_array_alloc(capacity * 2);
+            memcpy(list, o->entry.array.list, sizeof(NodePtr) * len);
+            node_array_free(o->entry.array.list, capacity);
+            o->entry.array.list = list;
+            o->entry.array.capacity = capacity * 2;
+        }
+        o->entry.array.list[len] = n;
+        o->entry.array.size += 1;
     }
     else if (len == 2) {
         Node *e0 = o->entry.raw.ary[0];
         Node *e1 = o->entry.raw.ary[1];
-        ARRAY_init(NodePtr, &o->entry.array, 3);
-        ARRAY_add(NodePtr, &o->entry.array, e0);
-        ARRAY_add(NodePtr, &o->entry.array, e1);
-        ARRAY_add(NodePtr, &o->entry.array, n);
+        node_array_init(o, 3);
+        o->entry.array.list[0] = e0;
+        o->entry.array.list[1] = e1;
+        o->entry.array.list[2] = n;
     }
     else if (len == 1) {
         o->entry.raw.size += 1;
@@ -125,19 +194,38 @@ static inline const char *Node_label(Node *o, const char **tag_list)
     return tag_list[o->labelId];
 }
 
+/* Tree walkers below never recurse. Dead nodes are chained through their
+ * tag field (as the free list does), so deep TLeftFold trees cannot
+ * overflow the C stack. */
+#define NODE_PENDING_PUSH(O) do {\
+    (O)->tag = (const char *)pending; \
+    pending = (O); \
+} while (0)
+
 void Node_free(Node *o)
 {
-    unsigned i, len = Node_length(o);
-    MOZVM_PROFILE_INC(NODE_FREE);
-
-    for (i = 0; i < len; i++) {
-        Node *node= ARRAY_get(NodePtr, &o->entry.array, i);
-        Node_free(node);
-    }
-    if (len > MOZVM_SMALL_ARRAY_LIMIT) {
-        ARRAY_dispose(NodePtr, &o->entry.array);
+    Node *pending = NULL;
+    NODE_PENDING_PUSH(o);
+    while (pending) {
+        unsigned i, len;
+        o = pending;
+        pending = (Node *)o->tag;
+        MOZVM_PROFILE_INC(NODE_FREE);
+#ifdef MOZVM_AST_LAZY_NODE
+        Node_dispose_thunk(o);
+#endif
+        len = Node_length(o);
+        for (i = 0; i < len; i++) {
+            Node *node = Node_get(o, i);
+            if (node) {
+                NODE_PENDING_PUSH(node);
+            }
+        }
+        if (len > MOZVM_SMALL_ARRAY_LIMIT) {
+            node_array_dispose(o);
+        }
+        VM_FREE(o);
     }
-    VM_FREE(o);
 }
 
 #ifdef NODE_USE_NODE_PRINT
@@ -149,34 +237,68 @@ static void print_indent(unsigned level)
     }
 }
 
-static void Node_print2(Node *o, const char **tag_list, unsigned level)
-{
-    unsigned i, len = Node_length(o);
+typedef struct NodeFrame {
+    Node *node;
+    unsigned index;
+} NodeFrame;
+
+DEF_ARRAY_T_OP(NodeFrame);
 
+/* prints "#tag" and either the text or an opening bracket. Returns true
+ * if the node has children to be printed. */
+static int Node_print_header(Node *o, unsigned level)
+{
+    unsigned len = Node_length(o);
     print_indent(level);
     fprintf(stderr, "#%s", o->tag);
     if (len == 0) {
         fprintf(stderr, "['%.*s']", o->len, o->pos);
-        return;
+        return 0;
     }
-    else {
-        fprintf(stderr, "[\n");
+    fprintf(stderr, "[\n");
+    return 1;
+}
 
-        for (i = 0; i < len; i++) {
-            Node *node = Node_get(o, i);
-            assert(node != o);
-            //print_indent(level + 1);
+static void Node_print2(Node *o, const char **tag_list, unsigned level)
+{
+    ARRAY(NodeFrame) stack;
+    NodeFrame frame;
+    if (!Node_print_header(o, level)) {
+        return;
+    }
+    ARRAY_init(NodeFrame, &stack, 16);
+    frame.node = o;
+    frame.index = 0;
+    ARRAY_add(NodeFrame, &stack, &frame);
+    while (ARRAY_size(stack) > 0) {
+        NodeFrame *top = ARRAY_last(stack);
+        unsigned depth = level + ARRAY_size(stack) - 1;
+        if (top->index < Node_length(top->node)) {
+            Node *node = Node_get(top->node, top->index++);
+            assert(node != top->node);
             if (node) {
-                Node_print2(node, tag_list, level + 1);
+                if (Node_print_header(node, depth + 1)) {
+                    frame.node = node;
+                    frame.index = 0;
+                    ARRAY_add(NodeFrame, &stack, &frame);
+                    continue;
+                }
             }
             else {
                 fprintf(stderr, "null");
             }
             fprintf(stderr, "\n");
         }
-        print_indent(level);
-        fprintf(stderr, "]");
+        else {
+            ARRAY_size(stack) -= 1;
+            print_indent(depth);
+            fprintf(stderr, "]");
+            if (ARRAY_size(stack) > 0) {
+                fprintf(stderr, "\n");
+            }
+        }
     }
+    ARRAY_dispose(NodeFrame, &stack);
 }
 
 void Node_print(Node *o, const char **tag_list)
@@ -187,50 +309,73 @@ void Node_print(Node *o, const char **tag_list)
 #endif
 
 #ifdef MOZVM_ENABLE_NODE_DIGEST
+#ifdef MOZVM_NODE_DIGEST_USE_MD5
 #include "md5.c"
+typedef md5_state_t digest_state_t;
+#define digest_init(CTX)             md5_init(CTX)
+#define digest_append(CTX, DATA, N)  md5_append(CTX, (const md5_byte_t *)(DATA), N)
+#define digest_finish(CTX, OUT)      md5_finish(CTX, OUT)
+#else
+#include "xxh128.c"
+typedef xxh128_state_t digest_state_t;
+#define digest_init(CTX)             xxh128_init(CTX)
+#define digest_append(CTX, DATA, N)  xxh128_append(CTX, (const uint8_t *)(DATA), N)
+#define digest_finish(CTX, OUT)      xxh128_finish(CTX, OUT)
+#endif
 
-static void Node_digest2(Node *o, const char **tag_list, md5_state_t *ctx)
+static void Node_digest2(Node *o, const char **tag_list, digest_state_t *ctx)
 {
-    unsigned i, len = Node_length(o);
-    md5_append(ctx, (unsigned char *)"#", 1);
-    if (o->tag) {
-        unsigned tlen = pstring_length(o->tag);
-        md5_append(ctx, (unsigned char *)o->tag, tlen);
-    }
-
-    for (i = 0; i < len; i++) {
-        Node *node = Node_get(o, i);
-        assert(node != o);
-        if (node) {
+    ARRAY(NodePtr) stack;
+    ARRAY_init(NodePtr, &stack, 16);
+    ARRAY_add(NodePtr, &stack, o);
+    while (ARRAY_size(stack) > 0) {
+        unsigned i, len;
+        Node *node = ARRAY_pop(NodePtr, &stack);
+        if (node != o) {
             const char *label = Node_label(node, tag_list);
             if (label[0] != 0) {
-                md5_append(ctx, (unsigned char *)"$", 1);
-                md5_append(ctx, (unsigned char *)label, pstring_length(label));
+                digest_append(ctx, "$", 1);
+                digest_append(ctx, label, pstring_length(label));
             }
-            Node_digest2(node, tag_list, ctx);
         }
-    }
-    if (len == 0) {
-        if (o->value) {
-            unsigned slen = pstring_length(o->value);
-            assert(0 && "XXX: need to test");
-            md5_append(ctx, (unsigned char *)o->value, slen);
+        len = Node_length(node);
+        digest_append(ctx, "#", 1);
+        if (node->tag) {
+            unsigned tlen = pstring_length(node->tag);
+            digest_append(ctx, node->tag, tlen);
         }
-        else {
-            md5_append(ctx, (unsigned char *)o->pos, o->len);
+        if (len == 0) {
+            if (node->value) {
+                unsigned slen = pstring_length(node->value);
+                assert(0 && "XXX: need to test");
+                digest_append(ctx, node->value, slen);
+            }
+            else {
+                digest_append(ctx, node->pos, node->len);
+            }
+            continue;
+        }
+        /* push in reverse order so that children are visited left to right */
+        for (i = len; i > 0; i--) {
+            Node *child = Node_get(node, i - 1);
+            assert(child != node);
+            if (child) {
+                ARRAY_add(NodePtr, &stack, child);
+            }
         }
     }
+    ARRAY_dispose(NodePtr, &stack);
 }
 
 void Node_digest(Node *o, const char **tag_list, unsigned char buf[32])
 {
     int i;
-    md5_state_t ctx;
+    digest_state_t ctx;
     unsigned char tmp[16];
     unsigned char *p = buf;
-    md5_init(&ctx);
+    digest_init(&ctx);
     Node_digest2(o, tag_list, &ctx);
-    md5_finish(&ctx, tmp);
+    digest_finish(&ctx, tmp);
     for (i = 0; i < 16; i++) {
         uint8_t d = tmp[i];
         *p++ = "0123456789abcdef"[(d >> 4) & 0xf];
@@ -239,50 +384,283 @@ void Node_digest(Node *o, const char **tag_list, unsigned char buf[32])
 }
 #endif
 
+#ifdef MOZVM_NODE_MERKLE_DIGEST
+#include "xxh128.c"
+
+/* Per-node hash for the Merkle digest. A node only contributes a few
+ * short fields, so instead of the striped xxh128 it folds 16-byte blocks
+ * into two lanes with the XXH3 mid-size mixer (a 128-bit multiply per
+ * lane, secret selected by block index). */
+typedef struct merkle_state_t {
+    uint64_t lo, hi;
+    unsigned blocks;
+    unsigned buffered;
+    uint64_t len;
+    uint8_t buffer[16];
+} merkle_state_t;
+
+static inline void merkle_init(merkle_state_t *s)
+{
+    s->lo = XXH_PRIME64_1;
+    s->hi = XXH_PRIME64_2;
+    s->blocks = 0;
+    s->buffered = 0;
+    s->len = 0;
+}
+
+static inline void merkle_block(merkle_state_t *s, const uint8_t *p)
+{
+    const uint8_t *k = xxh_secret + (s->blocks % 10) * 16;
+    uint64_t a = xxh_read64(p);
+    uint64_t b = xxh_read64(p + 8);
+    s->lo += xxh_mul128_fold64(a ^ xxh_read64(k), b ^ xxh_read64(k + 8));
+    s->hi += xxh_mul128_fold64(b ^ xxh_read64(k + 16), (a ^ xxh_read64(k + 24)) + s->lo);
+    s->lo ^= b;
+    s->blocks++;
+}
+
+static inline void merkle_append(merkle_state_t *s, const uint8_t *p, unsigned len)
+{
+    s->len += len;
+    if (s->buffered > 0) {
+        while (len > 0 && s->buffered < 16) {
+            s->buffer[s->buffered++] = *p++;
+            len--;
+        }
+        if (s->buffered < 16) {
+            return;
+        }
+        merkle_block(s, s->buffer);
+        s->buffered = 0;
+    }
+    for (; len >= 16; p += 16, len -= 16) {
+        merkle_block(s, p);
+    }
+    memcpy(s->buffer, p, len);
+    s->buffered = len;
+}
+
+static inline void merkle_finish(merkle_state_t *s, uint64_t digest[2])
+{
+    uint64_t lo, hi;
+    if (s->buffered > 0) {
+        memset(s->buffer + s->buffered, 0, 16 - s->buffered);
+        merkle_block(s, s->buffer);
+    }
+    lo = xxh_avalanche(s->lo + s->len * XXH_PRIME64_1);
+    hi = xxh_avalanche(s->hi ^ (s->len * XXH_PRIME64_4 + lo));
+    digest[0] = hi;
+    digest[1] = lo;
+}
+
+void Node_merkle_update(Node *o, const char **tag_list)
+{
+    merkle_state_t ctx;
+    unsigned i, len = Node_length(o);
+    merkle_init(&ctx);
+    merkle_append(&ctx, (const uint8_t *)"#", 1);
+    if (o->tag) {
+        merkle_append(&ctx, (const uint8_t *)o->tag, pstring_length(o->tag));
+    }
+    if (len == 0) {
+        merkle_append(&ctx, (const uint8_t *)"=", 1);
+        if (o->value) {
+            merkle_append(&ctx, (const uint8_t *)o->value, pstring_length(o->value));
+        }
+        else if (o->len > 0) {
+            merkle_append(&ctx, (const uint8_t *)o->pos, o->len);
+        }
+    }
+    for (i = 0; i < len; i++) {
+        uint8_t buf[17];
+        unsigned j;
+        Node *child = Node_get(o, i);
+        if (child == NULL) {
+            continue;
+        }
+        if (tag_list && child->labelId != NODE_LABEL_UNDEF) {
+            const char *label = Node_label(child, tag_list);
+            if (label[0] != 0) {
+                merkle_append(&ctx, (const uint8_t *)"$", 1);
+                merkle_append(&ctx, (const uint8_t *)label, pstring_length(label));
+            }
+        }
+        buf[0] = '@';
+        for (j = 0; j < 8; j++) {
+            buf[1 + j] = (uint8_t)(child->digest[0] >> (8 * j));
+            buf[9 + j] = (uint8_t)(child->digest[1] >> (8 * j));
+        }
+        merkle_append(&ctx, buf, 17);
+    }
+    merkle_finish(&ctx, o->digest);
+}
+
+void Node_merkle_digest(Node *o, unsigned char buf[32])
+{
+    int i;
+    unsigned char *p = buf;
+    for (i = 0; i < 16; i++) {
+        uint8_t d = (uint8_t)(o->digest[i / 8] >> (56 - 8 * (i % 8)));
+        *p++ = "0123456789abcdef"[(d >> 4) & 0xf];
+        *p++ = "0123456789abcdef"[0xf & d];
+    }
+}
+
+static inline int node_digest_equal(Node *a, Node *b)
+{
+    return a->digest[0] == b->digest[0] && a->digest[1] == b->digest[1];
+}
+
+static int node_shape_equal(Node *a, Node *b)
+{
+    if (Node_length(a) != Node_length(b) || Node_length(a) == 0) {
+        return 0;
+    }
+    if (a->tag == b->tag) {
+        return 1;
+    }
+    return a->tag && b->tag && pstring_equal(a->tag, b->tag);
+}
+
+unsigned Node_diff(Node *a, Node *b, f_node_diff fn, void *ctx)
+{
+    unsigned diff = 0;
+    ARRAY(NodePtr) stack;
+    ARRAY_init(NodePtr, &stack, 16);
+    ARRAY_add(NodePtr, &stack, a);
+    ARRAY_add(NodePtr, &stack, b);
+    while (ARRAY_size(stack) > 0) {
+        unsigned i, pushed = 0, relabeled = 0;
+        Node *y = ARRAY_pop(NodePtr, &stack);
+        Node *x = ARRAY_pop(NodePtr, &stack);
+        if (x == y || (x && y && node_digest_equal(x, y))) {
+            continue;
+        }
+        if (x && y && node_shape_equal(x, y)) {
+            /* push in reverse order so that pairs are reported left to right */
+            for (i = Node_length(x); i > 0; i--) {
+                Node *cx = Node_get(x, i - 1);
+                Node *cy = Node_get(y, i - 1);
+                /* a label lives in the child but is hashed into the parent:
+                 * both trees use the tag list of the same grammar */
+                if (cx && cy && cx->labelId != cy->labelId) {
+                    relabeled++;
+                }
+                if (cx == cy || (cx && cy && node_digest_equal(cx, cy))) {
+                    continue;
+                }
+                ARRAY_add(NodePtr, &stack, cx);
+                ARRAY_add(NodePtr, &stack, cy);
+                pushed++;
+            }
+        }
+        if (pushed == 0 || relabeled > 0) {
+            /* leaves, different shapes, or labels differ (reported before
+             * the children that are descended into) */
+            fn(x, y, ctx);
+            diff++;
+        }
+    }
+    ARRAY_dispose(NodePtr, &stack);
+    return diff;
+}
+#endif
+
 #ifdef MOZVM_MEMORY_USE_RCGC
+#ifdef MOZVM_NODE_USE_MEMPOOL
+/* Objects are bump-allocated from the current page. Size class 0 is Node
+ * (recycled through free_list), classes 1-4 are child arrays of 4, 8, 16
+ * and 32 entries (recycled through array_free_list). Larger arrays use
+ * VM_MALLOC. */
+#define PAGE_SIZE (MOZVM_NODE_ARENA_SIZE * 4096)
+#define NODE_ARRAY_CLASS_SIZE 4
+#define NODE_ARRAY_MAX_CAPACITY (NODE_ARRAY_MIN_CAPACITY << (NODE_ARRAY_CLASS_SIZE - 1))
+
+struct page_header {
+    struct page_header *next;
+};
+#ifdef MOZVM_PROFILE
+#define PAGE_OBJECT_SIZE ((PAGE_SIZE - sizeof(struct page_header)) / sizeof(Node))
+#endif
+#endif
+
+/* All allocator state is per thread, so that each thread can own a
+ * runtime without sharing (and corrupting) a single pool. */
+typedef struct NodeManager {
 #if defined(MOZVM_USE_FREE_LIST) || defined(MOZVM_NODE_USE_MEMPOOL)
-static Node *free_list = NULL;
+    Node *free_list;
 #endif
+#ifdef MOZVM_NODE_USE_MEMPOOL
+    size_t free_object_count;
+    struct page_header *current_page;
+    char *page_cur;
+    char *page_end;
+    NodePtr *array_free_list[NODE_ARRAY_CLASS_SIZE];
+#ifdef MOZVM_PROFILE
+    uint64_t max_arena_size;
+    uint64_t arena_size;
+#endif
+#endif
+} NodeManager;
+
+static MOZVM_THREAD_LOCAL NodeManager node_manager;
 
 #ifdef MOZVM_NODE_USE_MEMPOOL
-static size_t free_object_count = 0;
-static struct page_header *current_page = NULL;
+static void alloc_page(NodeManager *mng)
+{
+    struct page_header *h = (struct page_header *)malloc(PAGE_SIZE);
+    h->next = mng->current_page;
+    mng->current_page = h;
+    mng->page_cur = (char *)(h + 1);
+    mng->page_end = (char *)h + PAGE_SIZE;
 #ifdef MOZVM_PROFILE
-static uint64_t max_arena_size = 0;
-static uint64_t arena_size = 0;
+    mng->arena_size += 1;
 #endif
+}
 
-struct page {
-#define PAGE_OBJECT_SIZE (MOZVM_NODE_ARENA_SIZE * 4096 / sizeof(Node)-1)
-    Node nodes[PAGE_OBJECT_SIZE+1];
-};
+static inline void *page_alloc(NodeManager *mng, size_t size)
+{
+    void *p;
+    if (mng->page_cur + size > mng->page_end) {
+        alloc_page(mng);
+    }
+    p = mng->page_cur;
+    mng->page_cur += size;
+    return p;
+}
 
-struct page_header {
-    struct page_header *next;
-};
+static inline unsigned node_array_class(unsigned capacity)
+{
+    return LOG2(capacity) - LOG2(NODE_ARRAY_MIN_CAPACITY);
+}
 
-static struct page *alloc_page()
+static inline NodePtr *node_array_alloc(unsigned capacity)
 {
-    struct page *p = (struct page *)calloc(1, sizeof(*p));
-    struct page_header *h = (struct page_header *)p;
-    Node *head = p->nodes + 1;
-    Node *cur  = head;
-    Node *tail = p->nodes + PAGE_OBJECT_SIZE;
+    NodeManager *mng = &node_manager;
+    NodePtr *list;
+    unsigned klass;
+    if (capacity > NODE_ARRAY_MAX_CAPACITY) {
+        return (NodePtr *)VM_MALLOC(sizeof(NodePtr) * capacity);
+    }
+    klass = node_array_class(capacity);
+    if ((list = mng->array_free_list[klass]) != NULL) {
+        mng->array_free_list[klass] = (NodePtr *)list[0];
+        return list;
+    }
+    return (NodePtr *)page_alloc(mng, sizeof(NodePtr) * capacity);
+}
 
-    h->next = current_page;
-    current_page = h;
-    assert(free_object_count == 0);
-    while (cur < tail) {
-        cur->tag = (const char *)(cur + 1);
-        ++cur;
+static inline void node_array_free(NodePtr *list, unsigned capacity)
+{
+    NodeManager *mng = &node_manager;
+    unsigned klass;
+    if (capacity > NODE_ARRAY_MAX_CAPACITY) {
+        VM_FREE(list);
+        return;
     }
-    free_object_count += PAGE_OBJECT_SIZE;
-    tail->tag = (const char *)(free_list);
-    free_list = head;
-#ifdef MOZVM_PROFILE
-    arena_size += 1;
-#endif
-    return p;
+    klass = node_array_class(capacity);
+    list[0] = (NodePtr)mng->array_free_list[klass];
+    mng->array_free_list[klass] = list;
 }
 #endif
 
@@ -298,35 +676,34 @@ void NodeManager_init()
     (void)offset1; (void)offset2;
 #endif
 #ifdef MOZVM_NODE_USE_MEMPOOL
-    alloc_page();
+    alloc_page(&node_manager);
 #endif
 }
 
 void NodeManager_dispose()
 {
+    NodeManager *mng = &node_manager;
 #ifdef MOZVM_NODE_USE_MEMPOOL
 #ifdef MOZVM_PROFILE
-    if (max_arena_size < arena_size) {
-        max_arena_size = arena_size;
+    uint64_t max_arena_size = mng->max_arena_size;
+    if (max_arena_size < mng->arena_size) {
+        max_arena_size = mng->arena_size;
     }
 #endif
-    while (current_page) {
-        struct page_header *next = current_page->next;
-        free(current_page);
-        current_page = next;
+    while (mng->current_page) {
+        struct page_header *next = mng->current_page->next;
+        free(mng->current_page);
+        mng->current_page = next;
+    }
+    memset(mng, 0, sizeof(*mng));
 #ifdef MOZVM_PROFILE
-        arena_size -= 1;
+    mng->max_arena_size = max_arena_size;
 #endif
-    }
-
-    free_list = NULL;
-    free_object_count = 0;
-    current_page = NULL;
 #elif defined(MOZVM_USE_FREE_LIST)
-    while (free_list) {
-        Node *next = (Node)free_list->tag;
-        VM_FREE(free_list);
-        free_list = next;
+    while (mng->free_list) {
+        Node *next = (Node *)mng->free_list->tag;
+        VM_FREE(mng->free_list);
+        mng->free_list = next;
     }
 #ifdef NODE_CHECK_MALLOC
     if (malloc_size) {
@@ -335,12 +712,13 @@ void NodeManager_dispose()
     }
 #endif
 #endif /*MOZVM_NODE_USE_MEMPOOL*/
+    (void)mng;
 }
 
 void NodeManager_print_stats()
 {
 #ifdef MOZVM_PROFILE
-    fprintf(stderr, "%-10s %llu\n", "MAX_ARENA_SIZE", max_arena_size);
+    fprintf(stderr, "%-10s %llu\n", "MAX_ARENA_SIZE", (unsigned long long)node_manager.max_arena_size);
     fprintf(stderr, "%-10s %lu\n", "NODE_PER_ARENA", PAGE_OBJECT_SIZE);
 #endif
     MOZVM_NODE_PROFILE_EACH(MOZVM_PROFILE_SHOW);
@@ -355,71 +733,91 @@ void NodeManager_reset()
 static inline Node *node_alloc()
 {
     Node *o;
+#if defined(MOZVM_USE_FREE_LIST) || defined(MOZVM_NODE_USE_MEMPOOL)
+    NodeManager *mng = &node_manager;
+    if ((o = mng->free_list) != NULL) {
+        mng->free_list = (Node *)o->tag;
 #ifdef MOZVM_NODE_USE_MEMPOOL
-    if (free_list == NULL) {
-        alloc_page();
-    }
-    o = free_list;
-    free_list = (Node *)o->tag;
-    free_object_count -= 1;
-    return o;
-#else
-#if MOZVM_USE_FREE_LIST
-    if (free_list) {
-        o = free_list;
-        free_list = (Node)o->tag;
+        mng->free_object_count -= 1;
+#endif
         return o;
     }
-#endif /*MOZVM_USE_FREE_LIST*/
-    o = (Node) VM_MALLOC(sizeof(struct _Node));
+#endif
+#ifdef MOZVM_NODE_USE_MEMPOOL
+    return (Node *)page_alloc(mng, sizeof(Node));
+#else
+    o = (Node *) VM_MALLOC(sizeof(Node));
     return o;
 #endif
 }
 
 static inline void node_free(Node *o)
 {
+#if defined(MOZVM_USE_FREE_LIST) || defined(MOZVM_NODE_USE_MEMPOOL)
+    NodeManager *mng = &node_manager;
+#endif
     assert(o->MOZ_RC_FIELD == 0);
 #ifdef DEBUG2
     memset(o, 0xa, sizeof(*o));
 #endif
     o->MOZ_RC_FIELD = -1;
-#ifdef MOZVM_USE_FREE_LIST
-    o->tag = (const char *)free_list;
+#if defined(MOZVM_USE_FREE_LIST) || defined(MOZVM_NODE_USE_MEMPOOL)
+    o->tag = (const char *)mng->free_list;
 #ifdef DEBUG2
-    fprintf(stderr, "F %p -> %p\n", o, free_list);
+    fprintf(stderr, "F %p -> %p\n", o, mng->free_list);
+#endif
+    mng->free_list = o;
 #endif
-    free_list = o;
-#endif /*MOZVM_USE_FREE_LIST*/
 #ifdef MOZVM_NODE_USE_MEMPOOL
-    free_object_count += 1;
+    mng->free_object_count += 1;
 #endif
 #if !defined(MOZVM_USE_FREE_LIST) && !defined(MOZVM_NODE_USE_MEMPOOL)
     VM_FREE(o);
 #endif
 }
 
-
 void Node_sweep(Node *o)
 {
-    // FIXME stack over flow
-    unsigned i, len = Node_length(o);
+    Node *pending = NULL;
     assert(o->MOZ_RC_FIELD == 0);
-    for (i = 0; i < len; i++) {
-        Node *node= Node_get(o, i);
-        if (node) {
-            NODE_GC_RELEASE(node);
+    NODE_PENDING_PUSH(o);
+    while (pending) {
+        unsigned i, len;
+        o = pending;
+        pending = (Node *)o->tag;
+#ifdef MOZVM_AST_LAZY_NODE
+        Node_dispose_thunk(o);
+#endif
+        len = Node_length(o);
+        for (i = 0; i < len; i++) {
+            Node *node = Node_get(o, i);
+            if (node) {
+                MOZ_RC_RELEASE(node, NODE_PENDING_PUSH);
+            }
         }
+        if (len > MOZVM_SMALL_ARRAY_LIMIT) {
+            node_array_dispose(o);
+        }
+        MOZVM_PROFILE_INC(NODE_SWEEP);
+        node_free(o);
     }
-    if (len > MOZVM_SMALL_ARRAY_LIMIT) {
-        ARRAY_dispose(NodePtr, &o->entry.array);
-    }
-    MOZVM_PROFILE_INC(NODE_SWEEP);
-    node_free(o);
 }
 #elif defined(MOZVM_MEMORY_USE_MSGC)
 #include "gc.c"
 #endif
 
+#if !defined(MOZVM_MEMORY_USE_RCGC) || !defined(MOZVM_NODE_USE_MEMPOOL)
+static inline NodePtr *node_array_alloc(unsigned capacity)
+{
+    return (NodePtr *)VM_MALLOC(sizeof(NodePtr) * capacity);
+}
+
+static inline void node_array_free(NodePtr *list, unsigned capacity)
+{
+    VM_FREE(list);
+}
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -25,6 +25,7 @@ DEF_ARRAY_T(NodePtr);
 #define NODE_GC_INIT(O)          ((void)O)
 #define NODE_GC_RETAIN(O)        ((void)O)
 #define NODE_GC_RELEASE(O)       ((void)O)
+#define NODE_GC_WRITE_BARRIER(O) ((void)O)
 // #define NODE_GC_WRITE(DST, SRC) *(DST) = (SRC)
 
 #elif defined(MOZVM_MEMORY_USE_RCGC)
@@ -33,6 +34,7 @@ DEF_ARRAY_T(NodePtr);
 #define NODE_GC_INIT(O)    MOZ_RC_INIT(O)
 #define NODE_GC_RETAIN(O)  MOZ_RC_RETAIN(O)
 #define NODE_GC_RELEASE(O) MOZ_RC_RELEASE(O, Node_sweep)
+#define NODE_GC_WRITE_BARRIER(O) ((void)O)
 
 #if 0
 #define NODE_GC_WRITE(DST, SRC) do {\
@@ -46,6 +48,18 @@ DEF_ARRAY_T(NodePtr);
 #define NODE_GC_INIT(O) (O)->_flag = 0
 #define NODE_GC_RETAIN(O)
 #define NODE_GC_RELEASE(O)
+#ifdef MOZVM_MSGC_GENERATIONAL
+#define NODE_GC_TENURE 1U
+/* records a tenured node that is about to point to a (possibly young) node */
+#define NODE_GC_WRITE_BARRIER(O) do {\
+    if ((O)->_flag & NODE_GC_TENURE) {\
+        NodeManager_write_barrier(O);\
+    }\
+} while (0)
+void NodeManager_write_barrier(Node *o);
+#else
+#define NODE_GC_WRITE_BARRIER(O) ((void)O)
+#endif
 typedef struct NodeVisitor NodeVisitor;
 struct NodeVisitor {
     void (*fn_visit)(NodeVisitor *visitor, Node *object);
@@ -56,6 +70,23 @@ struct NodeVisitor {
 #error node gc
 #endif
 
+#ifdef MOZVM_AST_LAZY_NODE
+#ifndef MOZVM_MEMORY_USE_RCGC
+#error MOZVM_AST_LAZY_NODE requires MOZVM_MEMORY_USE_RCGC
+#endif
+#ifdef MOZVM_NODE_MERKLE_DIGEST
+#error MOZVM_NODE_MERKLE_DIGEST cannot be used with MOZVM_AST_LAZY_NODE
+#endif
+/* A thunk is attached to a node whose fields are not yet built. The first
+ * access through Node_force() (or any Node_* accessor) calls fn_force to
+ * fill the node in place, then fn_dispose to release the thunk. */
+typedef struct NodeThunk NodeThunk;
+struct NodeThunk {
+    void (*fn_force)(Node *o, NodeThunk *thunk);
+    void (*fn_dispose)(NodeThunk *thunk);
+};
+#endif
+
 struct Node {
     NODE_GC_HEADER;
     const char *tag;
@@ -70,16 +101,40 @@ struct Node {
         } raw;
         ARRAY(NodePtr) array;
     } entry;
+#ifdef MOZVM_AST_LAZY_NODE
+    NodeThunk *thunk;
+#endif
+#ifdef MOZVM_NODE_MERKLE_DIGEST
+    uint64_t digest[2];
+#endif
 };
 
 #define NODE_LABEL_UNDEF ((int)(-1))
 
+#ifdef MOZVM_AST_LAZY_NODE
+void Node_force_thunk(Node *o);
+Node *Node_new_lazy(NodeThunk *thunk);
+#endif
+
+/* Fields of a node (tag, pos, len, value) must only be read after
+ * Node_force(). It is a no-op unless MOZVM_AST_LAZY_NODE is enabled. */
+static inline Node *Node_force(Node *o)
+{
+#ifdef MOZVM_AST_LAZY_NODE
+    if (o->thunk) {
+        Node_force_thunk(o);
+    }
+#endif
+    return o;
+}
+
 static inline unsigned Node_length(Node *o)
 {
-    return o->entry.raw.size;
+    return Node_force(o)->entry.raw.size;
 }
 
 Node *Node_new(const char *tag, const char *str, unsigned len, unsigned elm_size, const char *value);
+void Node_init(Node *o, const char *tag, const char *str, unsigned len, unsigned elm_size, const char *value);
 void Node_free(Node *o);
 void Node_append(Node *o, Node *n);
 Node *Node_get(Node *o, unsigned index);
@@ -95,12 +150,36 @@ void Node_sweep(Node *o);
 #ifdef MOZVM_MEMORY_USE_MSGC
 typedef void (*f_trace)(void *p, NodeVisitor *v);
 void NodeManager_add_gc_root(void *ptr, f_trace f);
+void NodeManager_remove_gc_root(void *ptr);
 #endif
 
 #ifdef MOZVM_ENABLE_NODE_DIGEST
+/* Writes 32 hex digits of a 128-bit hash of the tree (xxh128, or MD5 with
+ * MOZVM_NODE_DIGEST_USE_MD5). Nodes are serialized in pre-order, children
+ * left to right, NULL children skipped:
+ *   ["$" label]  (non-root nodes with a non-empty label)
+ *   "#" [tag]
+ *   text         (leaves only: value if set, otherwise the captured input) */
 void Node_digest(Node *o, const char **tag_list, unsigned char buf[32]);
 #endif
 
+#ifdef MOZVM_NODE_MERKLE_DIGEST
+/* o->digest is a hash of o's tag, its text (leaves) or the labels and
+ * cached digests of its children. constructLeft() fills it bottom-up;
+ * trees built by hand must call Node_merkle_update() on children first. */
+void Node_merkle_update(Node *o, const char **tag_list);
+/* 32 hex digits of the cached digest of o (O(1)) */
+void Node_merkle_digest(Node *o, unsigned char buf[32]);
+
+/* Calls fn on each innermost pair of nodes whose subtrees differ, only
+ * descending into children whose digests differ (one side is NULL when a
+ * child is missing). A pair whose children carry different labels is
+ * reported itself, then its differing children are still descended into.
+ * Returns the number of reported pairs (0 if equal). */
+typedef void (*f_node_diff)(Node *a, Node *b, void *ctx);
+unsigned Node_diff(Node *a, Node *b, f_node_diff fn, void *ctx);
+#endif
+
 void NodeManager_init();
 void NodeManager_dispose();
 void NodeManager_print_stats();
@@ -0,0 +1,203 @@
+/*
+ * Streaming 128-bit non-cryptographic hash used by Node_digest.
+ *
+ * The core follows XXH3 (64-byte stripes folded into eight 64-bit
+ * accumulators, scrambled once per block of 16 stripes, then merged into
+ * two avalanched 64-bit halves). The accumulate loop is written lane by
+ * lane so that compilers vectorize it (pmuludq on SSE2/AVX2).
+ * It is NOT bit-compatible with the reference XXH3_128bits(): the last
+ * partial stripe is zero padded and the total length is folded into the
+ * merge instead of re-reading the tail, and short inputs take the same
+ * path as long ones. Digests are stable across hosts and endianness.
+ */
+#ifndef XXH128_INCLUDED
+#define XXH128_INCLUDED
+
+#include <stdint.h>
+#include <string.h>
+
+#define XXH_STRIPE_LEN        64
+#define XXH_ACC_NB            8
+#define XXH_SECRET_SIZE       192
+#define XXH_SECRET_CONSUME    8
+#define XXH_STRIPES_PER_BLOCK ((XXH_SECRET_SIZE - XXH_STRIPE_LEN) / XXH_SECRET_CONSUME)
+#define XXH_BUFFER_SIZE       (XXH_STRIPE_LEN * 4)
+
+#define XXH_PRIME32_1 0x9E3779B1U
+#define XXH_PRIME32_2 0x85EBCA77U
+#define XXH_PRIME32_3 0xC2B2AE3DU
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+static const uint8_t xxh_secret[XXH_SECRET_SIZE] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+typedef struct xxh128_state_t {
+    uint64_t acc[XXH_ACC_NB];
+    uint64_t total_len;
+    unsigned stripes;  /* stripes consumed in the current block */
+    unsigned buffered; /* bytes waiting in buffer */
+    uint8_t buffer[XXH_BUFFER_SIZE];
+} xxh128_state_t;
+
+static inline uint64_t xxh_read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline uint64_t xxh_mul128_fold64(uint64_t a, uint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+    uint64_t lo_lo = (a & 0xFFFFFFFF) * (b & 0xFFFFFFFF);
+    uint64_t hi_lo = (a >> 32) * (b & 0xFFFFFFFF);
+    uint64_t lo_hi = (a & 0xFFFFFFFF) * (b >> 32);
+    uint64_t hi_hi = (a >> 32) * (b >> 32);
+    uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+    uint64_t upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+    uint64_t lower = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+    return lower ^ upper;
+#endif
+}
+
+static inline uint64_t xxh_avalanche(uint64_t h)
+{
+    h ^= h >> 37;
+    h *= 0x165667919E3779F9ULL;
+    h ^= h >> 32;
+    return h;
+}
+
+static inline void xxh_accumulate_512(uint64_t *acc, const uint8_t *input, const uint8_t *secret)
+{
+    unsigned i;
+    for (i = 0; i < XXH_ACC_NB; i++) {
+        uint64_t data_val = xxh_read64(input + 8 * i);
+        uint64_t data_key = data_val ^ xxh_read64(secret + 8 * i);
+        acc[i ^ 1] += data_val;
+        acc[i] += (data_key & 0xFFFFFFFF) * (data_key >> 32);
+    }
+}
+
+static inline void xxh_scramble(uint64_t *acc, const uint8_t *secret)
+{
+    unsigned i;
+    for (i = 0; i < XXH_ACC_NB; i++) {
+        uint64_t a = acc[i];
+        a ^= a >> 47;
+        a ^= xxh_read64(secret + 8 * i);
+        acc[i] = a * XXH_PRIME32_1;
+    }
+}
+
+static inline void xxh_consume_stripes(xxh128_state_t *s, const uint8_t *input, unsigned n)
+{
+    while (n-- > 0) {
+        xxh_accumulate_512(s->acc, input, xxh_secret + s->stripes * XXH_SECRET_CONSUME);
+        input += XXH_STRIPE_LEN;
+        if (++s->stripes == XXH_STRIPES_PER_BLOCK) {
+            xxh_scramble(s->acc, xxh_secret + XXH_SECRET_SIZE - XXH_STRIPE_LEN);
+            s->stripes = 0;
+        }
+    }
+}
+
+static inline void xxh128_init(xxh128_state_t *s)
+{
+    s->acc[0] = XXH_PRIME32_3;
+    s->acc[1] = XXH_PRIME64_1;
+    s->acc[2] = XXH_PRIME64_2;
+    s->acc[3] = XXH_PRIME64_3;
+    s->acc[4] = XXH_PRIME64_4;
+    s->acc[5] = XXH_PRIME32_2;
+    s->acc[6] = XXH_PRIME64_5;
+    s->acc[7] = XXH_PRIME32_1;
+    s->total_len = 0;
+    s->stripes = 0;
+    s->buffered = 0;
+}
+
+static inline void xxh128_append(xxh128_state_t *s, const uint8_t *data, unsigned len)
+{
+    if (len == 0) {
+        return;
+    }
+    s->total_len += len;
+    if (s->buffered + len < XXH_BUFFER_SIZE) {
+        memcpy(s->buffer + s->buffered, data, len);
+        s->buffered += len;
+        return;
+    }
+    if (s->buffered > 0) {
+        unsigned fill = XXH_BUFFER_SIZE - s->buffered;
+        memcpy(s->buffer + s->buffered, data, fill);
+        xxh_consume_stripes(s, s->buffer, XXH_BUFFER_SIZE / XXH_STRIPE_LEN);
+        data += fill;
+        len  -= fill;
+        s->buffered = 0;
+    }
+    /* long captured text is consumed in place */
+    if (len >= XXH_STRIPE_LEN) {
+        unsigned n = len / XXH_STRIPE_LEN;
+        xxh_consume_stripes(s, data, n);
+        data += n * XXH_STRIPE_LEN;
+        len  -= n * XXH_STRIPE_LEN;
+    }
+    memcpy(s->buffer, data, len);
+    s->buffered = len;
+}
+
+static inline uint64_t xxh_merge_accs(const uint64_t *acc, const uint8_t *secret, uint64_t start)
+{
+    uint64_t result = start;
+    unsigned i;
+    for (i = 0; i < XXH_ACC_NB / 2; i++) {
+        result += xxh_mul128_fold64(acc[2 * i]     ^ xxh_read64(secret + 16 * i),
+                                    acc[2 * i + 1] ^ xxh_read64(secret + 16 * i + 8));
+    }
+    return xxh_avalanche(result);
+}
+
+static inline void xxh128_finish(xxh128_state_t *s, uint8_t digest[16])
+{
+    uint64_t lo, hi;
+    unsigned i;
+    if (s->buffered > 0) {
+        unsigned n = (s->buffered + XXH_STRIPE_LEN - 1) / XXH_STRIPE_LEN;
+        memset(s->buffer + s->buffered, 0, n * XXH_STRIPE_LEN - s->buffered);
+        xxh_consume_stripes(s, s->buffer, n);
+        s->buffered = 0;
+    }
+    lo = xxh_merge_accs(s->acc, xxh_secret + 11, s->total_len * XXH_PRIME64_1);
+    hi = xxh_merge_accs(s->acc, xxh_secret + XXH_SECRET_SIZE - 64 - 11,
+                        ~(s->total_len * XXH_PRIME64_2));
+    /* canonical form: big-endian high half, then low half */
+    for (i = 0; i < 8; i++) {
+        digest[i]     = (uint8_t)(hi >> (56 - 8 * i));
+        digest[i + 8] = (uint8_t)(lo >> (56 - 8 * i));
+    }
+}
+
+#endif /* XXH128_INCLUDED */
@@ -44,19 +44,26 @@ moz_runtime_t *moz_runtime_init(unsigned memo)
 void moz_runtime_reset1(moz_runtime_t *r)
 {
     unsigned memo = r->C.memo_size;
+#ifdef MOZVM_MEMORY_USE_MSGC
+    NodeManager_remove_gc_root(r->ast);
+    NodeManager_remove_gc_root(r->memo);
+#endif
     AstMachine_dispose(r->ast);
-    symtable_dispose(r->table);
+    symtable_reset(r->table);
     memo_dispose(r->memo);
 #ifdef MOZVM_ENABLE_JIT
     mozvm_jit_reset(r);
 #endif
 
     r->ast = AstMachine_init(MOZ_AST_MACHINE_DEFAULT_LOG_SIZE, NULL);
-    r->table = symtable_init();
+    AstMachine_setTagList(r->ast, r->C.tags);
     r->memo = memo_init(MOZ_MEMO_DEFAULT_WINDOW_SIZE, memo);
 #ifdef MOZVM_USE_DYNAMIC_DEACTIVATION
     memset(r->memo_points, 0, sizeof(MemoPoint) * memo);
 #endif
+    if (r->seeds) {
+        memset(r->seeds, 0, sizeof(moz_lr_seed_t) * r->C.lr_size);
+    }
     r->stack = &r->stack_[0] + 0xf;
     r->fp = r->stack;
 }
@@ -72,12 +79,19 @@ void moz_runtime_reset2(moz_runtime_t *r)
 void moz_runtime_dispose(moz_runtime_t *r)
 {
     unsigned i;
+#ifdef MOZVM_MEMORY_USE_MSGC
+    NodeManager_remove_gc_root(r->ast);
+    NodeManager_remove_gc_root(r->memo);
+#endif
     AstMachine_dispose(r->ast);
     symtable_dispose(r->table);
     memo_dispose(r->memo);
 #ifdef MOZVM_USE_DYNAMIC_DEACTIVATION
     VM_FREE(r->memo_points);
 #endif
+    if (r->seeds) {
+        VM_FREE(r->seeds);
+    }
     if (r->C.jumps) {
         VM_FREE(r->C.jumps);
     }
@@ -265,6 +265,7 @@ long moz_runtime_parse(moz_runtime_t *runtime, const char *str, const moz_inst_t
 #define read_STRING_t(PC)  *((STRING_t *)PC);  PC += sizeof(STRING_t)
 #define read_BITSET_t(PC)  *((BITSET_t *)PC);  PC += sizeof(BITSET_t)
 #define read_TAG_t(PC)     *((TAG_t *)PC);     PC += sizeof(TAG_t)
+#define read_TBL_t(PC)     *((TBL_t *)PC);     PC += sizeof(TBL_t)
 #define read_JMPTBL_t(PC)  *((JMPTBL_t *)PC);  PC += sizeof(JMPTBL_t)
 
 #define OP_CASE_(OP) LABEL(OP): PROFILE_INST(PC-1); MOZVM_PROFILE_INC(INST_COUNT);
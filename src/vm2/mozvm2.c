@@ -82,6 +82,7 @@ int moz_vm2_runtime_parse(moz_runtime_t *runtime,
     long *FP = runtime->fp;
 
     const unsigned char *CURRENT = head;
+    const unsigned char *REG[MOZ_IR_REGISTER_SIZE];
     runtime->head = runtime->cur = head;
     runtime->tail = tail;
 #define SET_POS(P)    CURRENT = (P)
@@ -119,6 +120,7 @@ int moz_vm2_runtime_parse(moz_runtime_t *runtime,
 #define read_STRING_t(PC)  *((STRING_t *)PC);  PC += sizeof(STRING_t)
 #define read_BITSET_t(PC)  *((BITSET_t *)PC);  PC += sizeof(BITSET_t)
 #define read_TAG_t(PC)     *((TAG_t *)PC);     PC += sizeof(TAG_t)
+#define read_TBL_t(PC)     *((TBL_t *)PC);     PC += sizeof(TBL_t)
 #define read_JMPTBL_t(PC)  *((JMPTBL_t *)PC);  PC += sizeof(JMPTBL_t)
     DISPATCH_START(PC);
 #include "vm2_core.c"
@@ -0,0 +1,71 @@
+#include "node/node.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+/* shallow trees, as most documents produce: Node_digest and releasing a
+ * tree should not be slower than the recursive walkers were.
+ * usage: bench_node [trees] [depth] [fanout] */
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static Node *new_tree(const char *text, unsigned depth, unsigned fanout)
+{
+    unsigned i;
+    Node *o;
+    if (depth == 0) {
+        return Node_new(NULL, text, 4, 0, NULL);
+    }
+    o = Node_new(NULL, text, 4, fanout, NULL);
+    for (i = 0; i < fanout; i++) {
+        Node_set(o, i, 0, new_tree(text + i % 4, depth - 1, fanout));
+    }
+    return o;
+}
+
+int main(int argc, char const* argv[])
+{
+    unsigned trees  = argc > 1 ? atoi(argv[1]) : 200000;
+    unsigned depth  = argc > 2 ? atoi(argv[2]) : 3;
+    unsigned fanout = argc > 3 ? atoi(argv[3]) : 4;
+    const char *tags[] = { "" };
+    const char text[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+    double build = 0, digest = 0, release = 0, t;
+    unsigned i;
+    Node *root = NULL;
+#ifdef MOZVM_ENABLE_NODE_DIGEST
+    unsigned char buf[32];
+#endif
+
+    if (depth > 6 || fanout == 0) {
+        fprintf(stderr, "usage: %s [trees] [depth <= 6] [fanout > 0]\n", argv[0]);
+        return 1;
+    }
+    NodeManager_init();
+    for (i = 0; i < trees; i++) {
+        t = now();
+        root = new_tree(text, depth, fanout);
+        NODE_GC_RETAIN(root);
+        build += now() - t;
+#ifdef MOZVM_ENABLE_NODE_DIGEST
+        t = now();
+        Node_digest(root, tags, buf);
+        digest += now() - t;
+#endif
+        t = now();
+        NODE_GC_RELEASE(root);
+        release += now() - t;
+    }
+    NodeManager_dispose();
+    printf("%u trees, depth %u, fan-out %u\n", trees, depth, fanout);
+    printf("build:   %.3fs\n", build);
+    printf("digest:  %.3fs\n", digest);
+    printf("release: %.3fs\n", release);
+    (void)tags;
+    return 0;
+}
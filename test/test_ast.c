@@ -1,5 +1,6 @@
 #include "libnez/ast.h"
 #include "core/pstring.h"
+#include <stdio.h>
 #include <string.h>
 
 static struct tag {
@@ -16,6 +17,137 @@ static struct tag {
 #undef STRING
 };
 
+#ifdef MOZVM_USE_POINTER_AS_POS_REGISTER
+#define POS(N) (str + (N))
+#else
+#define POS(N) (N)
+#endif
+
+struct event_buffer {
+    AstEventHandler base;
+    char buf[256];
+    unsigned len;
+};
+
+static void event_append(AstEventHandler *h, const char *fmt, const char *s, unsigned len)
+{
+    struct event_buffer *b = (struct event_buffer *)h;
+    b->len += snprintf(b->buf + b->len, sizeof(b->buf) - b->len, fmt, len, s);
+}
+
+static void event_open(AstEventHandler *h, const char *tag, mozpos_t pos)
+{
+    event_append(h, "#%.*s[", tag ? tag : "", tag ? pstring_length(tag) : 0);
+}
+
+static void event_capture(AstEventHandler *h, mozpos_t pos, unsigned len)
+{
+    event_append(h, "'%.*s'", (const char *)pos, len);
+}
+
+static void event_link(AstEventHandler *h, int labelId)
+{
+    event_append(h, "%.*s$", "", 0);
+}
+
+static void event_close(AstEventHandler *h, const char *tag)
+{
+    event_append(h, "]%.*s ", tag, pstring_length(tag));
+}
+
+static void event_error(AstEventHandler *h, const char *msg)
+{
+    event_append(h, "!%.*s", "", 0);
+}
+
+static void test_stream(const char *str, const char *tag_list, const char *tag_int)
+{
+    struct event_buffer b = {
+        { event_open, event_capture, event_link, event_close, event_error }, {0}, 0
+    };
+    AstMachine *ast;
+    Node *parsed;
+    long tx;
+    NodeManager_init();
+    ast = AstMachine_init(128, str);
+    ast_set_event_handler(ast, &b.base);
+    // input "[12, 345]"
+    ast_log_new(ast, POS(0));
+    tx = ast_start_tx(ast);
+    ast_log_new(ast, POS(1));
+    ast_log_tag(ast, tag_int);
+    ast_log_capture(ast, POS(3));
+    ast_stream_commit(ast, ast_save_tx(ast));
+    assert(b.len == 0 && "pending commit must not be emitted");
+    ast_commit_tx(ast, 0, tx);
+    ast_stream_commit(ast, ast_save_tx(ast));
+    assert(strcmp(b.buf, "#[$#Integer['12']Integer ") == 0);
+
+    tx = ast_start_tx(ast);
+    ast_log_new(ast, POS(5));
+    ast_log_tag(ast, tag_int);
+    ast_log_capture(ast, POS(8));
+    ast_commit_tx(ast, 0, tx);
+    ast_log_tag(ast, tag_list);
+    ast_log_capture(ast, POS(9));
+    parsed = ast_get_parsed_node(ast);
+    assert(parsed == NULL);
+    assert(strcmp(b.buf, "#[$#Integer['12']Integer $#Integer['345']Integer '[12, 345]']List ") == 0);
+
+    // a top-level left folding after the first child was reported
+    b.len = 0;
+    ast_log_new(ast, POS(0));
+    tx = ast_start_tx(ast);
+    ast_log_new(ast, POS(1));
+    ast_log_tag(ast, tag_int);
+    ast_log_capture(ast, POS(3));
+    ast_commit_tx(ast, 0, tx);
+    ast_stream_commit(ast, ast_save_tx(ast));
+    ast_log_tag(ast, tag_int);
+    ast_log_capture(ast, POS(3));
+    ast_log_swap(ast, POS(0), 0);
+    ast_log_tag(ast, tag_list);
+    ast_log_capture(ast, POS(9));
+    parsed = ast_get_parsed_node(ast);
+    assert(parsed == NULL);
+    assert(strcmp(b.buf, "#[$#Integer['12']Integer !'[12']Integer ") == 0);
+    (void)parsed;
+    AstMachine_dispose(ast);
+    NodeManager_dispose();
+}
+
+#ifdef MOZVM_AST_LAZY_NODE
+static void test_lazy(const char *str, const char *tag_list, const char *tag_int)
+{
+    AstMachine *ast;
+    Node *elm, *list;
+    NodeManager_init();
+    ast = AstMachine_init(128, str);
+    // input "[12, 345]"
+    ast_log_new(ast, POS(0));
+    ast_log_new(ast, POS(1));
+    ast_log_tag(ast, tag_int);
+    ast_log_capture(ast, POS(3));
+    ast_commit_tx(ast, 0, 1);
+    elm = ast_get_last_linked_node(ast);
+    /* committed logs are kept in a thunk until the node is read */
+    assert(elm->thunk != NULL && elm->tag == NULL);
+
+    ast_log_tag(ast, tag_list);
+    ast_log_capture(ast, POS(9));
+    list = ast_get_parsed_node(ast);
+    assert(Node_length(list) == 1 && list->thunk == NULL);
+    assert(list->tag == tag_list && list->len == 9);
+    assert(Node_get(list, 0) == elm && elm->thunk != NULL);
+    assert(Node_length(elm) == 0 && elm->thunk == NULL);
+    assert(elm->tag == tag_int && elm->len == 2 && strncmp(elm->pos, "12", 2) == 0);
+    (void)elm;
+    NODE_GC_RELEASE(list);
+    AstMachine_dispose(ast);
+    NodeManager_dispose();
+}
+#endif
+
 int main(int argc, char const* argv[])
 {
 #define TAG_String   ((char *)tags[0].tag)
@@ -54,11 +186,6 @@ int main(int argc, char const* argv[])
     NodeManager_init();
     ast = AstMachine_init(128, str);
     AstMachine_setSource(ast, str);
-#ifdef MOZVM_USE_POINTER_AS_POS_REGISTER
-#define POS(N) (str + (N))
-#else
-#define POS(N) (N)
-#endif
     /*00*/ast_log_new(ast, POS(0));
     /*01*/ast_log_new(ast, POS(2));
     /*02*/ast_log_new(ast, POS(3));
@@ -147,6 +274,13 @@ int main(int argc, char const* argv[])
     // asm volatile("int3");
     NODE_GC_RELEASE(node);
     AstMachine_dispose(ast);
+
+    pstring_delete(str);
+    str = (char *)pstring_alloc("[12, 345]", 9);
+    test_stream(str, TAG_List, TAG_Integer);
+#ifdef MOZVM_AST_LAZY_NODE
+    test_lazy(str, TAG_List, TAG_Integer);
+#endif
     for (i = 0; i < 5; i++) {
         struct tag *t = &tags[i];
         pstring_delete(t->tag);
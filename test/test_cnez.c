@@ -0,0 +1,170 @@
+#include "compiler/compiler.h"
+#include "compiler/expression.h"
+#include "compiler/module.h"
+#include "test_grammar.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <assert.h>
+
+/* Top = _ Value _
+ * Value = List / Num / Str / Sym
+ * List = { '(' _ (!')' @Value _)* ')' #List }
+ * Num = { '-'? [0-9]+ #Num }
+ * Str = { '"' (!'"' .)* '"' #Str }
+ * Sym = { [a-z]+ #Sym }
+ * _ = [ \n]*
+ * Every alternative fails before it consumes input or pushes a link: the IR
+ * restores neither on those paths, in vm2 as well as in the C parser. */
+static void build_grammar(moz_compiler_t *C)
+{
+    moz_expr_factory_t *F = moz_compiler_get_factory();
+    unsigned digit[] = {'0', '9'}, alpha[] = {'a', 'z'}, space[] = {' ', ' ', '\n', '\n'};
+    decl_t *top   = moz_decl_new(C, "Top", 3);
+    decl_t *value = moz_decl_new(C, "Value", 5);
+    decl_t *list  = moz_decl_new(C, "List", 4);
+    decl_t *num   = moz_decl_new(C, "Num", 3);
+    decl_t *str   = moz_decl_new(C, "Str", 3);
+    decl_t *sym   = moz_decl_new(C, "Sym", 3);
+    decl_t *sp    = moz_decl_new(C, "_", 1);
+    moz_decl_mark_as_top_level(top);
+
+    set_body(top, new_listn(F->_Sequence(C), 3,
+                new_invoke(C, sp), new_invoke(C, value), new_invoke(C, sp)));
+    set_body(value, new_listn(F->_Choice(C), 4, new_invoke(C, list),
+                new_invoke(C, num), new_invoke(C, str), new_invoke(C, sym)));
+    set_body(list, new_node(C, new_listn(F->_Sequence(C), 4,
+                    F->_Byte(C, '('), new_invoke(C, sp),
+                    new_listn(F->_Repetition(C), 1, new_listn(F->_Sequence(C), 3,
+                            F->_Not(C, F->_Byte(C, ')')),
+                            new_listn(F->_Sequence(C), 3, F->_Tpush(C),
+                                new_invoke(C, value), F->_Tpop(C, "", 0)),
+                            new_invoke(C, sp))),
+                    F->_Byte(C, ')')), "List"));
+    set_body(num, new_node(C, new_listn(F->_Sequence(C), 3,
+                    F->_Option(C, F->_Byte(C, '-')), F->_Set(C, digit, 2),
+                    new_listn(F->_Repetition(C), 1, F->_Set(C, digit, 2))), "Num"));
+    set_body(str, new_node(C, new_listn(F->_Sequence(C), 3,
+                    F->_Byte(C, '"'),
+                    new_listn(F->_Repetition(C), 1, new_listn(F->_Sequence(C), 2,
+                            F->_Not(C, F->_Byte(C, '"')), F->_Any(C))),
+                    F->_Byte(C, '"')), "Str"));
+    set_body(sym, new_node(C, new_listn(F->_Sequence(C), 2,
+                    F->_Set(C, alpha, 2),
+                    new_listn(F->_Repetition(C), 1, F->_Set(C, alpha, 2))), "Sym"));
+    set_body(sp, new_listn(F->_Repetition(C), 1, F->_Set(C, space, 4)));
+}
+
+#ifdef TEST_CNEZ_EMIT
+/* writes the C parser of the grammar to argv[1] */
+int main(int argc, char const* argv[])
+{
+    moz_compiler_t C;
+    FILE *fp;
+    int emitted;
+    if (argc != 2 || (fp = fopen(argv[1], "w")) == NULL) {
+        return 1;
+    }
+    moz_compiler_init(&C, NULL);
+    build_grammar(&C);
+    moz_ast_optimize(&C);
+    emitted = moz_compiler_compile_ast_cnez(&C, fp);
+    moz_compiler_dispose(&C);
+    fclose(fp);
+    return emitted ? 0 : 1;
+}
+#else
+/* the parser test_cnez_emit wrote, without its driver's main */
+#define main cnez_main
+#include "test_cnez_parser.c"
+#undef main
+
+/* the two trees have the same tags, spans and children */
+static int node_equal(Node *a, const char *a_input, Node *b, const char *b_input)
+{
+    unsigned i;
+    if (a == NULL || b == NULL) {
+        return a == b;
+    }
+    if (strcmp(a->tag, b->tag) != 0 || a->pos - a_input != b->pos - b_input ||
+            a->len != b->len || Node_length(a) != Node_length(b)) {
+        return 0;
+    }
+    for (i = 0; i < Node_length(a); i++) {
+        if (!node_equal(Node_get(a, i), a_input, Node_get(b, i), b_input)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* parses input with the generated C parser and vm2. Returns the consumed
+ * length (-1 on failure) if both agree on it and on the tree, -2 otherwise */
+static int compare(moz_module_t *M, const char *input)
+{
+    struct ParsingContext ctx;
+    Node *c_node = NULL, *vm2_node = NULL, *node;
+    int c_len = -1, vm2_len = -1, same;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.input = ctx.cur = (char *)input;
+    ctx.input_size = strlen(input);
+    ctx.ast = AstMachine_init(128, ctx.input);
+    AstMachine_setTagList(ctx.ast, global_tag_list);
+    if (pFile(&ctx) == 0) {
+        c_len = ctx.cur - ctx.input;
+        c_node = ast_get_parsed_node(ctx.ast);
+    }
+    AstMachine_dispose(ctx.ast);
+
+    moz_runtime_reset1(M->runtime);
+    moz_runtime_reset2(M->runtime);
+    if (M->parse(M, (char *)input, strlen(input), &node) == 0) {
+        vm2_len = M->runtime->cur - input;
+        vm2_node = node;
+    }
+    else if (node) {
+        NODE_GC_RELEASE(node);
+    }
+    same = c_len == vm2_len && node_equal(c_node, input, vm2_node, input);
+    if (c_node) {
+        NODE_GC_RELEASE(c_node);
+    }
+    if (vm2_node) {
+        NODE_GC_RELEASE(vm2_node);
+    }
+    return same ? c_len : -2;
+}
+
+int main(int argc, char const* argv[])
+{
+    static const struct {
+        const char *input;
+        int len;
+    } tests[] = {
+        { "(a -12 (b \"x y\") ())", 20 }, { "  42\n", 5 }, { "\"\"", 2 },
+        { "x1", 1 }, { " ( ( ( b ) ) ) ", 15 }, { "\"ab", -1 },
+        { ")", -1 }, { "-", -1 }, { "", -1 }
+    };
+    unsigned i;
+    moz_compiler_t C;
+    moz_module_t *M;
+
+    NodeManager_init();
+    moz_compiler_init(&C, NULL);
+    build_grammar(&C);
+    moz_ast_optimize(&C);
+    M = moz_compiler_compile_ast(&C);
+    for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        int len = compare(M, tests[i].input);
+        if (len != tests[i].len) {
+            fprintf(stderr, "\"%s\": expected %d, got %d (-2: C parser and vm2 differ)\n",
+                    tests[i].input, tests[i].len, len);
+            return 1;
+        }
+    }
+    M->dispose(M);
+    moz_compiler_dispose(&C);
+    NodeManager_dispose();
+    return 0;
+}
+#endif
@@ -1,8 +1,13 @@
 #include "compiler/compiler.h"
 #include "compiler/expression.h"
+#include "compiler/module.h"
+#include "test_grammar.h"
 #include <stdio.h>
+#include <stdarg.h>
 #include <assert.h>
 
+DEF_ARRAY_OP_NOPOINTER(decl_ptr_t);
+
 void test_compiler_init_dispose()
 {
     moz_compiler_t C;
@@ -31,10 +36,561 @@ void test_decl_new()
     moz_compiler_dispose(&C);
 }
 
+void test_first_set()
+{
+    moz_compiler_t C;
+    moz_compiler_init(&C, NULL);
+    moz_expr_factory_t *factory = moz_compiler_get_factory();
+    unsigned range[] = {'0', '9'};
+    bitset_t set;
+    expr_t *str = factory->_Str(&C, "if", 2);
+    expr_t *digit = factory->_Set(&C, range, 2);
+    expr_t *opt = factory->_Option(&C, factory->_Byte(&C, 'x'));
+    expr_t *seq = factory->_Sequence(&C);
+
+    moz_expr_first_set(str, &set);
+    assert(bitset_get(&set, 'i') && !bitset_get(&set, 'f'));
+    moz_expr_first_set(digit, &set);
+    assert(bitset_get(&set, '0') && bitset_get(&set, '9') && !bitset_get(&set, 'a'));
+    moz_expr_first_set(opt, &set);
+    assert(bitset_get(&set, 'x') && bitset_get(&set, 'y'));
+
+    /* 'x'? [0-9] starts with 'x' or a digit */
+    ARRAY_init(expr_ptr_t, &((Sequence_t *)seq)->list, 2);
+    ARRAY_add(expr_ptr_t, &((Sequence_t *)seq)->list, opt);
+    ARRAY_add(expr_ptr_t, &((Sequence_t *)seq)->list, digit);
+    moz_expr_first_set(seq, &set);
+    assert(bitset_get(&set, 'x') && bitset_get(&set, '5'));
+    assert(!bitset_get(&set, 'y') && !bitset_get(&set, 'i'));
+    moz_compiler_dispose(&C);
+    (void)&str;
+}
+
+/* parses input with M and returns the number of bytes consumed, -1 on failure */
+static int parse(moz_module_t *M, const char *input, Node **node)
+{
+    *node = NULL;
+    moz_runtime_reset1(M->runtime);
+    moz_runtime_reset2(M->runtime);
+    if (M->parse(M, (char *)input, strlen(input), node) != 0) {
+        return -1;
+    }
+    return M->runtime->cur - input;
+}
+
+__attribute__((unused))
+static int parse_tag(moz_module_t *M, const char *input, const char *tag)
+{
+    Node *node;
+    int len = parse(M, input, &node);
+    if (len >= 0 && (node == NULL || strcmp(node->tag, tag) != 0)) {
+        len = -2;
+    }
+    if (node) {
+        NODE_GC_RELEASE(node);
+    }
+    return len;
+}
+
+/* "Tag(Child Child(Grandchild))" */
+static void node_shape(Node *node, char *buf)
+{
+    unsigned i;
+    strcat(buf, node->tag);
+    if (Node_length(node) == 0) {
+        return;
+    }
+    strcat(buf, "(");
+    for (i = 0; i < Node_length(node); i++) {
+        if (i > 0) {
+            strcat(buf, " ");
+        }
+        node_shape(Node_get(node, i), buf);
+    }
+    strcat(buf, ")");
+}
+
+/* parse() that writes the shape of the parsed tree to buf */
+__attribute__((unused))
+static int parse_shape(moz_module_t *M, const char *input, char *buf)
+{
+    Node *node;
+    int len = parse(M, input, &node);
+    buf[0] = '\0';
+    if (node) {
+        if (len >= 0) {
+            node_shape(node, buf);
+        }
+        NODE_GC_RELEASE(node);
+    }
+    return len;
+}
+
+void test_inline_and_prune()
+{
+    moz_compiler_t C;
+    moz_compiler_init(&C, NULL);
+    moz_expr_factory_t *F = moz_compiler_get_factory();
+    decl_t *top   = moz_decl_new(&C, "Top", 3);
+    decl_t *list  = moz_decl_new(&C, "List", 4);
+    decl_t *item  = moz_decl_new(&C, "Item", 4);
+    decl_t *dead1 = moz_decl_new(&C, "Dead1", 5);
+    decl_t *dead2 = moz_decl_new(&C, "Dead2", 5);
+    moz_decl_mark_as_top_level(top);
+
+    /* Top = List; List = Item List / Item; Item = 'a' */
+    set_body(top, F->_Invoke(&C, "List", 4, list));
+    set_body(list, new_list(F->_Choice(&C),
+                new_list(F->_Sequence(&C),
+                    F->_Invoke(&C, "Item", 4, item),
+                    F->_Invoke(&C, "List", 4, list)),
+                F->_Invoke(&C, "Item", 4, item)));
+    set_body(item, F->_Byte(&C, 'a'));
+    /* Dead1 = Dead2 'x'; Dead2 = Dead1 / 'y' */
+    set_body(dead1, new_list(F->_Sequence(&C),
+                F->_Invoke(&C, "Dead2", 5, dead2), F->_Byte(&C, 'x')));
+    set_body(dead2, new_list(F->_Choice(&C),
+                F->_Invoke(&C, "Dead1", 5, dead1), F->_Byte(&C, 'y')));
+
+    moz_ast_optimize(&C);
+    /* recursive List is kept, Item is inlined, Dead1/Dead2 are dropped */
+    assert(ARRAY_size(C.decls) == 2);
+    assert(ARRAY_get(decl_ptr_t, &C.decls, 0) == top);
+    assert(ARRAY_get(decl_ptr_t, &C.decls, 1) == list);
+    assert(list->recursive && !top->recursive);
+    assert(top->body->type == Invoke);
+    moz_compiler_dispose(&C);
+}
+
+void test_recursive_decl()
+{
+    moz_compiler_t C;
+    unsigned i;
+    moz_compiler_init(&C, NULL);
+    moz_expr_factory_t *F = moz_compiler_get_factory();
+    decl_t *top = moz_decl_new(&C, "Top", 3);
+    decl_t *a   = moz_decl_new(&C, "A", 1);
+    decl_t *b   = moz_decl_new(&C, "B", 1);
+    decl_t *c   = moz_decl_new(&C, "C", 1);
+    decl_t *d   = moz_decl_new(&C, "D", 1);
+    decl_t *e   = moz_decl_new(&C, "E", 1);
+    for (i = 0; i < ARRAY_size(C.decls); i++) {
+        moz_decl_mark_as_top_level(ARRAY_get(decl_ptr_t, &C.decls, i));
+    }
+
+    /* Top = D; A = 'a' B / E; B = 'b' A; C = 'c' C / 'y'; D = A 'd'; E = 'e' */
+    set_body(top, new_invoke(&C, d));
+    set_body(a, new_list(F->_Choice(&C),
+                new_list(F->_Sequence(&C), F->_Byte(&C, 'a'), new_invoke(&C, b)),
+                new_invoke(&C, e)));
+    set_body(b, new_list(F->_Sequence(&C), F->_Byte(&C, 'b'), new_invoke(&C, a)));
+    set_body(c, new_list(F->_Choice(&C),
+                new_list(F->_Sequence(&C), F->_Byte(&C, 'c'), new_invoke(&C, c)),
+                F->_Byte(&C, 'y')));
+    set_body(d, new_list(F->_Sequence(&C), new_invoke(&C, a), F->_Byte(&C, 'd')));
+    set_body(e, F->_Byte(&C, 'e'));
+    moz_ast_optimize(&C);
+    /* A and B form a cycle, C calls itself; Top, D and E only call into
+     * or are called from a cycle */
+    assert(a->recursive && b->recursive && c->recursive);
+    assert(!top->recursive && !d->recursive && !e->recursive);
+    moz_compiler_dispose(&C);
+}
+
+void test_fuse_class()
+{
+    moz_compiler_t C;
+    moz_compiler_init(&C, NULL);
+    moz_expr_factory_t *F = moz_compiler_get_factory();
+    unsigned range[] = {'a', 'z'};
+    decl_t *decl = moz_decl_new(&C, "Ident", 5);
+    Set_t *set;
+    moz_decl_mark_as_top_level(decl);
+
+    /* !'q' &[a-z] . -> [a-pr-z] */
+    set_body(decl, new_list(F->_Sequence(&C),
+                new_list(F->_Sequence(&C),
+                    F->_Not(&C, F->_Byte(&C, 'q')),
+                    F->_And(&C, F->_Set(&C, range, 2))),
+                F->_Any(&C)));
+    moz_ast_optimize(&C);
+    assert(decl->body->type == Set);
+    set = (Set_t *)decl->body;
+    assert(bitset_get(&set->set, 'a') && bitset_get(&set->set, 'z'));
+    assert(!bitset_get(&set->set, 'q') && !bitset_get(&set->set, '0'));
+    moz_compiler_dispose(&C);
+    (void)&set;
+}
+
+void test_table_jump()
+{
+    moz_compiler_t C;
+    moz_module_t *M;
+    unsigned cd[] = {'c', 'd'};
+    moz_compiler_init(&C, NULL);
+    moz_expr_factory_t *F = moz_compiler_get_factory();
+    decl_t *top = moz_decl_new(&C, "Top", 3);
+    decl_t *a   = moz_decl_new(&C, "A", 1);
+    decl_t *b   = moz_decl_new(&C, "B", 1);
+    decl_t *pre = moz_decl_new(&C, "Pre", 3);
+    decl_t *c   = moz_decl_new(&C, "C", 1);
+    moz_decl_mark_as_top_level(top);
+    moz_decl_mark_as_top_level(a);
+    moz_decl_mark_as_top_level(b);
+    moz_decl_mark_as_top_level(pre);
+    moz_decl_mark_as_top_level(c);
+
+    /* Top = A / B / C; A = { 'ax' #A }; B = { Pre 'x' #B }; Pre = 'b'?
+     * C = { [cd] #C } */
+    set_body(top, new_listn(F->_Choice(&C), 3,
+                new_invoke(&C, a), new_invoke(&C, b), new_invoke(&C, c)));
+    set_body(a, new_node(&C, F->_Str(&C, "ax", 2), "A"));
+    set_body(b, new_node(&C, new_list(F->_Sequence(&C),
+                    new_invoke(&C, pre), F->_Byte(&C, 'x')), "B"));
+    set_body(pre, F->_Option(&C, F->_Byte(&C, 'b')));
+    set_body(c, new_node(&C, F->_Set(&C, cd, 2), "C"));
+    moz_ast_optimize(&C);
+    /* Pre is nullable, so B may start with 'b' or 'x' */
+    assert(pre->nullable && !b->nullable);
+    assert(bitset_get(&b->first, 'b') && bitset_get(&b->first, 'x'));
+    assert(!bitset_get(&b->first, 'a') && !bitset_get(&b->first, 'c'));
+
+    M = moz_compiler_compile_ast(&C);
+    assert(C.jmptbl_size == 1);
+    assert(parse_tag(M, "ax", "A") == 2);
+    assert(parse_tag(M, "bx", "B") == 2);
+    assert(parse_tag(M, "x", "B") == 1);
+    assert(parse_tag(M, "d", "C") == 1);
+    assert(parse_tag(M, "a", "A") == -1);
+    assert(parse_tag(M, "e", "C") == -1);
+    M->dispose(M);
+    moz_compiler_dispose(&C);
+}
+
+void test_left_recursion()
+{
+    moz_compiler_t C;
+    moz_module_t *M;
+    char buf[128];
+    unsigned digit[] = {'0', '9'};
+    moz_compiler_init(&C, NULL);
+    moz_expr_factory_t *F = moz_compiler_get_factory();
+    decl_t *top = moz_decl_new(&C, "Top", 3);
+    decl_t *e   = moz_decl_new(&C, "E", 1);
+    decl_t *n   = moz_decl_new(&C, "N", 1);
+    decl_t *a   = moz_decl_new(&C, "A", 1);
+    decl_t *b   = moz_decl_new(&C, "B", 1);
+    decl_t *x   = moz_decl_new(&C, "X", 1);
+    decl_t *y   = moz_decl_new(&C, "Y", 1);
+    decl_t *p   = moz_decl_new(&C, "P", 1);
+    moz_decl_mark_as_top_level(top);
+
+    /* Top = { E ';' / A ';' / P #File }
+     * E = E '+' N / N
+     * A = B X / Y; B = A
+     * P = @{ 'p' [0-9]* #P }
+     * N, X and Y link a node for [0-9], 'x' and 'y'. A failed alternative
+     * keeps its AST logs, so they only link after the guard &[0-9] (&'x',
+     * &'y') succeeds, and the trees stay flat. */
+    set_body(top, new_node(&C, new_listn(F->_Choice(&C), 3,
+                    new_list(F->_Sequence(&C), new_invoke(&C, e), F->_Byte(&C, ';')),
+                    new_list(F->_Sequence(&C), new_invoke(&C, a), F->_Byte(&C, ';')),
+                    new_invoke(&C, p)), "File"));
+    set_body(e, new_list(F->_Choice(&C),
+                new_listn(F->_Sequence(&C), 3,
+                    new_invoke(&C, e), F->_Byte(&C, '+'), new_invoke(&C, n)),
+                new_invoke(&C, n)));
+    set_body(n, new_list(F->_Sequence(&C), F->_And(&C, F->_Set(&C, digit, 2)),
+                new_link(&C, new_node(&C, F->_Set(&C, digit, 2), "Num"))));
+    set_body(a, new_list(F->_Choice(&C),
+                new_list(F->_Sequence(&C), new_invoke(&C, b), new_invoke(&C, x)),
+                new_invoke(&C, y)));
+    set_body(b, new_invoke(&C, a));
+    set_body(x, new_list(F->_Sequence(&C), F->_And(&C, F->_Byte(&C, 'x')),
+                new_link(&C, new_node(&C, F->_Byte(&C, 'x'), "X"))));
+    set_body(y, new_list(F->_Sequence(&C), F->_And(&C, F->_Byte(&C, 'y')),
+                new_link(&C, new_node(&C, F->_Byte(&C, 'y'), "Y"))));
+    set_body(p, new_link(&C, new_node(&C, new_list(F->_Sequence(&C),
+                    F->_Byte(&C, 'p'),
+                    new_listn(F->_Repetition(&C), 1, F->_Set(&C, digit, 2))), "P")));
+    moz_ast_optimize(&C);
+    /* one decl of each cycle grows the seed */
+    assert(e->left_recursive && a->left_recursive != b->left_recursive);
+    assert(!top->left_recursive && !p->left_recursive);
+
+    M = moz_compiler_compile_ast(&C);
+    /* direct: every run of E appends one N to the seed */
+    assert(parse_shape(M, "1;", buf) == 2 && strcmp(buf, "File(Num)") == 0);
+    assert(parse_shape(M, "1+2;", buf) == 4 && strcmp(buf, "File(Num Num)") == 0);
+    assert(parse_shape(M, "1+2+3;", buf) == 6 && strcmp(buf, "File(Num Num Num)") == 0);
+    assert(parse_shape(M, "1+;", buf) == -1);
+    assert(parse_shape(M, "+1;", buf) == -1);
+    /* indirect through B */
+    assert(parse_shape(M, "y;", buf) == 2 && strcmp(buf, "File(Y)") == 0);
+    assert(parse_shape(M, "yxx;", buf) == 4 && strcmp(buf, "File(Y X X)") == 0);
+    assert(parse_shape(M, "x;", buf) == -1);
+    /* the non left-recursive P next to them */
+    assert(parse_shape(M, "p12", buf) == 3 && strcmp(buf, "File(P)") == 0);
+    assert(parse_shape(M, "p", buf) == 1 && strcmp(buf, "File(P)") == 0);
+    M->dispose(M);
+    moz_compiler_dispose(&C);
+    (void)&buf;
+}
+
+void test_left_recursion_backtrack()
+{
+    moz_compiler_t C;
+    moz_module_t *M;
+    unsigned digit[] = {'0', '9'};
+    moz_compiler_init(&C, NULL);
+    moz_expr_factory_t *F = moz_compiler_get_factory();
+    decl_t *top = moz_decl_new(&C, "Top", 3);
+    decl_t *e   = moz_decl_new(&C, "E", 1);
+    moz_decl_mark_as_top_level(top);
+
+    /* Top = { E ';' #File }; E = E '+' [0-9] / [0-9]
+     * On "1+23;" the third run of E fails at '3' after E '+' consumed
+     * "1+2": [0-9] has to retry from the start of the run, not match '3'. */
+    set_body(top, new_node(&C, new_list(F->_Sequence(&C),
+                    new_invoke(&C, e), F->_Byte(&C, ';')), "File"));
+    set_body(e, new_list(F->_Choice(&C),
+                new_listn(F->_Sequence(&C), 3,
+                    new_invoke(&C, e), F->_Byte(&C, '+'), F->_Set(&C, digit, 2)),
+                F->_Set(&C, digit, 2)));
+    moz_ast_optimize(&C);
+    assert(e->left_recursive);
+
+    M = moz_compiler_compile_ast(&C);
+    assert(parse_tag(M, "1;", "File") == 2);
+    assert(parse_tag(M, "1+2+3;", "File") == 6);
+    assert(parse_tag(M, "1+23;", "File") == -1);
+    assert(parse_tag(M, "12;", "File") == -1);
+    M->dispose(M);
+    moz_compiler_dispose(&C);
+}
+
+/* Top = { (E1 E2)* 'a' 'd' #T }: a failed iteration goes back to where
+ * it started, so the 'a' after the repetition still matches. unit is an
+ * iteration, repeated often enough that a slot pushed per iteration would
+ * overflow the stack. */
+static void check_repetition(moz_compiler_t *C, expr_t *e1, expr_t *e2, decl_t *top,
+        const char *unit)
+{
+    moz_expr_factory_t *F = moz_compiler_get_factory();
+    moz_module_t *M;
+    unsigned i, len = strlen(unit);
+    char *input = (char *)malloc(len * 4096 + 3);
+    for (i = 0; i < 4096; i++) {
+        memcpy(input + i * len, unit, len);
+    }
+    strcpy(input + i * len, "ad");
+    moz_decl_mark_as_top_level(top);
+    set_body(top, new_node(C, new_listn(F->_Sequence(C), 3,
+                    new_list(F->_Repetition(C), e1, e2),
+                    F->_Byte(C, 'a'), F->_Byte(C, 'd')), "T"));
+    moz_ast_optimize(C);
+    M = moz_compiler_compile_ast(C);
+    assert(parse_tag(M, "ad", "T") == 2);
+    assert(parse_tag(M, input, "T") == (int)strlen(input));
+    assert(parse_tag(M, "abab", "T") == -1);
+    M->dispose(M);
+    free(input);
+}
+
+/* Top = { (&[0-9] @N ' ')* (&[0-9] @N) #List } (without the last @N if
+ * !last); N = { [0-9] #Num }. The guards keep an @N at the end of the input
+ * from pushing a link it cannot pop. */
+__attribute__((unused))
+static int parse_linked_repetition(const char *input, int last, char *buf)
+{
+    moz_compiler_t C;
+    moz_module_t *M;
+    unsigned digit[] = {'0', '9'};
+    expr_t *body;
+    int len;
+    moz_compiler_init(&C, NULL);
+    moz_expr_factory_t *F = moz_compiler_get_factory();
+    decl_t *top = moz_decl_new(&C, "Top", 3);
+    decl_t *n   = moz_decl_new(&C, "N", 1);
+    moz_decl_mark_as_top_level(top);
+    set_body(n, new_node(&C, F->_Set(&C, digit, 2), "Num"));
+    body = new_listn(F->_Repetition(&C), 3, F->_And(&C, F->_Set(&C, digit, 2)),
+            new_link(&C, new_invoke(&C, n)), F->_Byte(&C, ' '));
+    if (last) {
+        body = new_listn(F->_Sequence(&C), 3, body,
+                F->_And(&C, F->_Set(&C, digit, 2)), new_link(&C, new_invoke(&C, n)));
+    }
+    set_body(top, new_node(&C, body, "List"));
+    moz_ast_optimize(&C);
+    M = moz_compiler_compile_ast(&C);
+    len = parse_shape(M, input, buf);
+    M->dispose(M);
+    moz_compiler_dispose(&C);
+    return len;
+}
+
+void test_repetition()
+{
+    moz_compiler_t C;
+    moz_expr_factory_t *F = moz_compiler_get_factory();
+    unsigned bc[] = {'b', 'c'};
+    char buf[128];
+    decl_t *top, *x;
+
+    /* ('a' [bc])* keeps the position in a register */
+    moz_compiler_init(&C, NULL);
+    top = moz_decl_new(&C, "Top", 3);
+    check_repetition(&C, F->_Byte(&C, 'a'), F->_Set(&C, bc, 2), top, "ab");
+    moz_compiler_dispose(&C);
+
+    /* ('a' X)* with X = 'b' X / 'c' keeps it on the stack across the call */
+    moz_compiler_init(&C, NULL);
+    top = moz_decl_new(&C, "Top", 3);
+    x = moz_decl_new(&C, "X", 1);
+    set_body(x, new_list(F->_Choice(&C),
+                new_list(F->_Sequence(&C), F->_Byte(&C, 'b'), new_invoke(&C, x)),
+                F->_Byte(&C, 'c')));
+    check_repetition(&C, F->_Byte(&C, 'a'), new_invoke(&C, x), top, "abc");
+    moz_compiler_dispose(&C);
+
+    /* the failed second iteration has linked "2" already. Rewinding to
+     * the end of the first one would leave "2" in the tree and link it
+     * again (List(Num Num Num)), so a body that builds AST keeps what the
+     * failed iteration consumed. */
+    assert(parse_linked_repetition("1 2", 0, buf) == 3);
+    assert(strcmp(buf, "List(Num Num)") == 0);
+    assert(parse_linked_repetition("1 2", 1, buf) == -1);
+    assert(parse_linked_repetition("1 2 3", 0, buf) == 5);
+    assert(strcmp(buf, "List(Num Num Num)") == 0);
+    (void)&buf;
+}
+
+__attribute__((unused))
+static int load_profile(moz_compiler_t *C, const char *text)
+{
+    int loaded;
+    FILE *fp = tmpfile();
+    fputs(text, fp);
+    rewind(fp);
+    loaded = moz_compiler_load_profile(C, fp);
+    fclose(fp);
+    return loaded;
+}
+
+void test_load_profile()
+{
+    moz_compiler_t C;
+    moz_expr_factory_t *F = moz_compiler_get_factory();
+    decl_t *top;
+    expr_t *choice;
+    moz_module_t *M;
+    FILE *fp;
+    static const char *broken[] = {
+        "",
+        "# no header\n",
+        "branches 3\n0 5 1\n2 7",
+        "branches 3\n0 5 1\nxyz\n",
+        "branches 2\n2 1 1\n",
+        "1 2 3\nbranches 3\n",
+        "branches 99999\n0 1 1\n"
+    };
+    unsigned i;
+
+    moz_compiler_init(&C, NULL);
+    assert(load_profile(&C, "# comment\nbranches 3\n0 5 1\n2 7 0\n") == 1);
+    assert(C.branch_profile_size == 3);
+    assert(C.branch_profile[0] == 5 && C.branch_profile[1] == 0 && C.branch_profile[2] == 7);
+    moz_compiler_dispose(&C);
+    for (i = 0; i < sizeof(broken) / sizeof(broken[0]); i++) {
+        moz_compiler_init(&C, NULL);
+        assert(load_profile(&C, broken[i]) == 0);
+        assert(C.branch_profile == NULL && C.branch_profile_size == 0);
+        moz_compiler_dispose(&C);
+    }
+
+    /* Top = { ('a0' / 'b0' / ... / 'i0') #T }: what vm2 writes loads back
+     * for the same grammar. Nine first bytes are too many for a table jump,
+     * so every attempt is counted, and a failed 'x0' consumes nothing. */
+    moz_compiler_init(&C, NULL);
+    top = moz_decl_new(&C, "Top", 3);
+    moz_decl_mark_as_top_level(top);
+    choice = F->_Choice(&C);
+    ARRAY_init(expr_ptr_t, &((List_t *)choice)->list, 9);
+    for (i = 0; i < 9; i++) {
+        char str[2] = { (char)('a' + i), '0' };
+        expr_t *e = F->_Str(&C, str, 2);
+        ARRAY_add(expr_ptr_t, &((List_t *)choice)->list, e);
+        MOZ_RC_RETAIN(e);
+    }
+    set_body(top, new_node(&C, choice, "T"));
+    moz_ast_optimize(&C);
+    M = moz_compiler_compile_ast(&C);
+    assert(parse_tag(M, "b0", "T") == 2);
+    fp = tmpfile();
+    if (moz_vm2_module_write_profile(M, fp)) {
+        moz_compiler_t C2;
+        rewind(fp);
+        moz_compiler_init(&C2, NULL);
+        assert(moz_compiler_load_profile(&C2, fp) == 1);
+        assert(C2.branch_profile_size == C.branch_size / 2);
+        /* 'a0' and 'b0' were tried, only 'b0' succeeded */
+        assert(C2.branch_profile[0] == 0 && C2.branch_profile[1] == 1);
+        assert(C2.branch_profile[2] == 0);
+        moz_compiler_dispose(&C2);
+    }
+    fclose(fp);
+    M->dispose(M);
+    moz_compiler_dispose(&C);
+}
+
+/* test/vm1_parse.c */
+int vm1_parse_tag(const uint8_t *code, unsigned size, const char *input, const char *tag);
+
+void test_vm1_emit()
+{
+    moz_compiler_t C;
+    uint8_t *code;
+    unsigned size;
+    unsigned bc[] = {'b', 'c'};
+    moz_compiler_init(&C, NULL);
+    moz_expr_factory_t *F = moz_compiler_get_factory();
+    decl_t *top = moz_decl_new(&C, "Top", 3);
+    moz_decl_mark_as_top_level(top);
+
+    /* Top = { 'a' ([bc] / 'dd')* !'x' #List } */
+    set_body(top, new_node(&C, new_listn(F->_Sequence(&C), 3,
+                    F->_Byte(&C, 'a'),
+                    new_listn(F->_Repetition(&C), 1,
+                        new_list(F->_Choice(&C),
+                            F->_Set(&C, bc, 2), F->_Str(&C, "dd", 2))),
+                    F->_Not(&C, F->_Byte(&C, 'x'))), "List"));
+    moz_ast_optimize(&C);
+    code = moz_vm1_module_emit(&C, &size);
+    assert(code != NULL);
+    assert(vm1_parse_tag(code, size, "abddc", "List") == 5);
+    assert(vm1_parse_tag(code, size, "a", "List") == 1);
+    assert(vm1_parse_tag(code, size, "abx", "List") == -1);
+    assert(vm1_parse_tag(code, size, "b", "List") == -1);
+    VM_FREE(code);
+    moz_compiler_dispose(&C);
+}
+
 int main(int argc, char const* argv[])
 {
     test_compiler_init_dispose();
     test_factory();
     test_decl_new();
+    test_first_set();
+    test_inline_and_prune();
+    test_recursive_decl();
+    test_fuse_class();
+    NodeManager_init();
+    test_table_jump();
+    test_left_recursion();
+    test_left_recursion_backtrack();
+    test_repetition();
+    test_load_profile();
+    test_vm1_emit();
+    NodeManager_dispose();
     return 0;
 }
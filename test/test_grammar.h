@@ -0,0 +1,64 @@
+#ifndef TEST_GRAMMAR_H
+#define TEST_GRAMMAR_H
+
+/* builds grammars with moz_compiler_get_factory() in test_compiler and
+ * test_cnez */
+#include "compiler/compiler.h"
+#include "compiler/expression.h"
+#include <stdarg.h>
+#include <string.h>
+
+DEF_ARRAY_OP_NOPOINTER(expr_ptr_t);
+
+static inline expr_t *new_list(expr_t *list, expr_t *e1, expr_t *e2)
+{
+    ARRAY_init(expr_ptr_t, &((Sequence_t *)list)->list, 2);
+    ARRAY_add(expr_ptr_t, &((Sequence_t *)list)->list, e1);
+    ARRAY_add(expr_ptr_t, &((Sequence_t *)list)->list, e2);
+    MOZ_RC_RETAIN(e1);
+    MOZ_RC_RETAIN(e2);
+    return list;
+}
+
+static inline void set_body(decl_t *decl, expr_t *body)
+{
+    expr_t **ref = &decl->body;
+    MOZ_RC_INIT_FIELD(*ref, body);
+}
+
+static inline expr_t *new_listn(expr_t *list, unsigned n, ...)
+{
+    unsigned i;
+    va_list ap;
+    va_start(ap, n);
+    ARRAY_init(expr_ptr_t, &((List_t *)list)->list, n);
+    for (i = 0; i < n; i++) {
+        expr_t *e = va_arg(ap, expr_t *);
+        ARRAY_add(expr_ptr_t, &((List_t *)list)->list, e);
+        MOZ_RC_RETAIN(e);
+    }
+    va_end(ap);
+    return list;
+}
+
+/* { e #tag } */
+static inline expr_t *new_node(moz_compiler_t *C, expr_t *e, const char *tag)
+{
+    moz_expr_factory_t *F = moz_compiler_get_factory();
+    return new_listn(F->_Sequence(C), 4, F->_Tnew(C), e,
+            F->_Ttag(C, tag, strlen(tag)), F->_Tcapture(C));
+}
+
+/* @e */
+static inline expr_t *new_link(moz_compiler_t *C, expr_t *e)
+{
+    moz_expr_factory_t *F = moz_compiler_get_factory();
+    return new_listn(F->_Sequence(C), 3, F->_Tpush(C), e, F->_Tpop(C, "", 0));
+}
+
+static inline expr_t *new_invoke(moz_compiler_t *C, decl_t *decl)
+{
+    return moz_compiler_get_factory()->_Invoke(C, decl->name.str, decl->name.len, decl);
+}
+
+#endif /* end of include guard */
@@ -1,11 +1,126 @@
 #include "node/node.h"
+#include "core/pstring.h"
+#include <string.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#ifdef MOZVM_MEMORY_USE_MSGC
+static void trace_root(void *p, NodeVisitor *visitor)
+{
+    Node *o = *(Node **)p;
+    if (o) {
+        visitor->fn_visit(visitor, o);
+    }
+}
+#endif
+
+#ifdef MOZVM_NODE_MERKLE_DIGEST
+static Node *merkle_tree(const char *text, const char **tags)
+{
+    unsigned i;
+    Node *leaf;
+    Node *o = Node_new(NULL, NULL, 0, 3, NULL);
+    Node *inner = Node_new(NULL, NULL, 0, 1, NULL);
+    for (i = 0; i < 2; i++) {
+        leaf = Node_new(NULL, text + i * 3, 3, 0, NULL);
+        Node_merkle_update(leaf, tags);
+        Node_set(o, i, 0, leaf);
+    }
+    leaf = Node_new(NULL, text + 6, 3, 0, NULL);
+    Node_merkle_update(leaf, tags);
+    Node_set(inner, 0, 0, leaf);
+    Node_merkle_update(inner, tags);
+    Node_set(o, 2, 0, inner);
+    Node_merkle_update(o, tags);
+    return o;
+}
+
+static void count_diff(Node *a, Node *b, void *ctx)
+{
+    assert(a->len == 3 && b->len == 3);
+    assert(a->pos[2] == 'i' && b->pos[2] == 'X');
+    (*(int *)ctx)++;
+}
+
+static Node *labeled_tree(const char *text, uint16_t label, const char **tags)
+{
+    Node *o = Node_new(NULL, NULL, 0, 2, NULL);
+    Node *leaf = Node_new(NULL, text, 3, 0, NULL);
+    Node_merkle_update(leaf, tags);
+    Node_set(o, 0, label, leaf);
+    leaf = Node_new(NULL, text + 3, 3, 0, NULL);
+    Node_merkle_update(leaf, tags);
+    Node_set(o, 1, 0, leaf);
+    Node_merkle_update(o, tags);
+    return o;
+}
+
+static void check_relabel(Node *a, Node *b, void *ctx)
+{
+    if ((*(int *)ctx)++ == 0) {
+        assert(Node_length(a) == 2 && Node_length(b) == 2);
+    }
+    else {
+        assert(a->pos[2] == 'f' && b->pos[2] == 'X');
+    }
+}
+#endif
+
+#define STRESS_THREADS 4
+#define STRESS_NODES   50000
+
+/* every thread owns a node manager; with MSGC each of them marks in
+ * parallel and sweeps on its own background thread */
+static void *stress(void *arg)
+{
+    unsigned id = (unsigned)(uintptr_t)arg;
+    unsigned i, round;
+    Node *live = NULL;
+    NodeManager_init();
+#ifdef MOZVM_MEMORY_USE_MSGC
+    NodeManager_add_gc_root(&live, trace_root);
+#endif
+    for (round = 0; round < 4; round++) {
+        live = Node_new(NULL, NULL, 0, 0, NULL);
+        NODE_GC_RETAIN(live);
+        for (i = 0; i < STRESS_NODES; i++) {
+            /* MSGC does not scan the C stack: link o before allocating */
+            Node *o = Node_new(NULL, NULL, i, 2, NULL);
+            Node_append(live, o);
+            Node_set(o, 0, 0, Node_new(NULL, NULL, round, 0, NULL));
+            Node_new(NULL, NULL, 0, 1, NULL);
+            Node_set(o, 1, 0, Node_new(NULL, NULL, id, 0, NULL));
+        }
+        for (i = 0; i < STRESS_NODES; i++) {
+            assert(Node_get(live, i)->len == i);
+            assert(Node_get(Node_get(live, i), 0)->len == round);
+            assert(Node_get(Node_get(live, i), 1)->len == id);
+        }
+        NODE_GC_RELEASE(live);
+    }
+    live = NULL;
+    NodeManager_dispose();
+    return NULL;
+}
 
 int main(int argc, char const* argv[])
 {
     Node *root, *child1, *child2, *child3;
+    unsigned i;
+#ifdef MOZVM_ENABLE_NODE_DIGEST
+    unsigned char digest[32], digest2[32];
+    char text[1000];
+#endif
     const char *tags[] = {
         ""
     };
+    root = NULL;
+#ifdef MOZVM_MEMORY_USE_MSGC
+    /* a runtime registers its roots before the front end initialises the
+     * node manager */
+    NodeManager_remove_gc_root(&root);
+    NodeManager_add_gc_root(&root, trace_root);
+#endif
     NodeManager_init();
     root = Node_new("root", NULL, 0, 1, NULL);
     NODE_GC_RETAIN(root);
@@ -22,6 +137,134 @@ int main(int argc, char const* argv[])
     assert(root->MOZ_RC_FIELD == 1);
 #endif
     NODE_GC_RELEASE(root);
+
+    // deep left-folded tree must not overflow the C stack
+    root = Node_new(NULL, NULL, 0, 0, NULL);
+    for (i = 0; i < 1000000; i++) {
+        Node *parent = Node_new(NULL, NULL, 0, 1, NULL);
+        Node_set(parent, 0, 0, root);
+        root = parent;
+    }
+    NODE_GC_RETAIN(root);
+#ifdef MOZVM_ENABLE_NODE_DIGEST
+    Node_digest(root, tags, digest);
+#endif
+    NODE_GC_RELEASE(root);
+
+#ifdef MOZVM_ENABLE_NODE_DIGEST
+    // digest depends on the text of every leaf, not on buffer boundaries
+    for (i = 0; i < sizeof(text); i++) {
+        text[i] = 'a' + i % 26;
+    }
+    for (i = 0; i < 2; i++) {
+        unsigned j;
+        root = Node_new(NULL, NULL, 0, 8, NULL);
+        NODE_GC_RETAIN(root);
+        for (j = 0; j < 8; j++) {
+            Node_set(root, j, 0, Node_new(NULL, text + j, 1 + j * 71, 0, NULL));
+        }
+        Node_digest(root, tags, i == 0 ? digest : digest2);
+        NODE_GC_RELEASE(root);
+    }
+    assert(memcmp(digest, digest2, 32) == 0);
+    text[500] = '!';
+    root = Node_new(NULL, NULL, 0, 1, NULL);
+    NODE_GC_RETAIN(root);
+    Node_set(root, 0, 0, Node_new(NULL, text + 7, 1 + 7 * 71, 0, NULL));
+    Node_digest(root, tags, digest2);
+    assert(memcmp(digest, digest2, 32) != 0);
+    NODE_GC_RELEASE(root);
+#endif
+
+#ifdef MOZVM_MEMORY_USE_MSGC
+    // young children appended to a tenured node must survive minor GCs
+    root = Node_new(NULL, NULL, 0, 0, NULL);
+    for (i = 0; i < 100; i++) {
+        unsigned j;
+        for (j = 0; j < 20000; j++) {
+            Node_new(NULL, NULL, 0, 0, NULL);
+        }
+        Node_append(root, Node_new("child", NULL, i, 0, NULL));
+    }
+    for (i = 0; i < 100; i++) {
+        assert(Node_get(root, i)->len == i);
+    }
+
+    // a reset frees every node but keeps the heap, the roots and the
+    // sweeper for the next document
+    for (i = 0; i < 20; i++) {
+        unsigned j;
+        root = NULL;
+        NodeManager_reset();
+        root = Node_new(NULL, NULL, 0, 0, NULL);
+        for (j = 0; j < 100000; j++) {
+            Node *o = Node_new(NULL, NULL, 0, 0, NULL);
+            if (j % 1000 == 0) {
+                Node_append(root, o);
+            }
+        }
+        assert(Node_length(root) == 100);
+        for (j = 0; j < 100; j++) {
+            assert(Node_length(Node_get(root, j)) == 0);
+        }
+    }
+#endif
+#ifdef MOZVM_NODE_MERKLE_DIGEST
+    // only the subtree that differs is reported
+    {
+        int ndiff = 0;
+        unsigned n;
+        root = Node_new(NULL, NULL, 0, 3, NULL);
+        NODE_GC_RETAIN(root);
+        Node_set(root, 0, 0, merkle_tree("abcdefghi", tags));
+        Node_set(root, 1, 0, merkle_tree("abcdefghi", tags));
+        Node_set(root, 2, 0, merkle_tree("abcdefghX", tags));
+        Node_merkle_digest(Node_get(root, 0), digest);
+        Node_merkle_digest(Node_get(root, 1), digest2);
+        assert(memcmp(digest, digest2, 32) == 0);
+        n = Node_diff(Node_get(root, 0), Node_get(root, 1), count_diff, &ndiff);
+        assert(n == 0);
+        n = Node_diff(Node_get(root, 0), Node_get(root, 2), count_diff, &ndiff);
+        assert(n == 1);
+        assert(ndiff == 1);
+        (void)n;
+        NODE_GC_RELEASE(root);
+    }
+    // a relabeled child is reported even when a sibling is descended into
+    {
+        const char *labels[] = { "", NULL };
+        int ndiff = 0;
+        unsigned n;
+        labels[1] = pstring_alloc("key", 3);
+        root = Node_new(NULL, NULL, 0, 3, NULL);
+        NODE_GC_RETAIN(root);
+        Node_set(root, 0, 0, labeled_tree("abcdef", 0, labels));
+        Node_set(root, 1, 0, labeled_tree("abcdef", 1, labels));
+        Node_set(root, 2, 0, labeled_tree("abcdeX", 1, labels));
+        n = Node_diff(Node_get(root, 0), Node_get(root, 1), check_relabel, &ndiff);
+        assert(n == 1);
+        assert(ndiff == 1);
+        ndiff = 0;
+        n = Node_diff(Node_get(root, 0), Node_get(root, 2), check_relabel, &ndiff);
+        assert(n == 2);
+        assert(ndiff == 2);
+        (void)n;
+        NODE_GC_RELEASE(root);
+        pstring_delete(labels[1]);
+    }
+#endif
     NodeManager_dispose();
+
+    {
+        pthread_t th[STRESS_THREADS];
+        for (i = 0; i < STRESS_THREADS; i++) {
+            if (pthread_create(&th[i], NULL, stress, (void *)(uintptr_t)i) != 0) {
+                return 1;
+            }
+        }
+        for (i = 0; i < STRESS_THREADS; i++) {
+            pthread_join(th[i], NULL);
+        }
+    }
     return 0;
 }
@@ -1,13 +1,159 @@
 #include "libnez/symtable.h"
 #include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+enum { TYPE, VAR, FAR = 9 };
+
+static token_t mktoken(const char *s)
+{
+    token_t t;
+    token_init(&t, s, s + strlen(s));
+    return t;
+}
+
+static void test_mask_and_rollback()
+{
+    token_t a = mktoken("a"), b = mktoken("b"), tmp;
+    symtable_t *tbl = symtable_init();
+    long saved;
+
+    symtable_add_symbol(tbl, TYPE, &a);
+    symtable_add_symbol(tbl, VAR, &b);
+    assert(symtable_contains(tbl, TYPE, &a) == 1);
+    assert(symtable_contains(tbl, TYPE, &b) == 0);
+    assert(symtable_contains(tbl, VAR, &b) == 1);
+    assert(symtable_has_symbol(tbl, FAR) == 0);
+
+    saved = symtable_savepoint(tbl);
+    symtable_add_symbol_mask(tbl, TYPE);
+    assert(symtable_has_symbol(tbl, TYPE) == 0);
+    assert(symtable_contains(tbl, TYPE, &a) == 0);
+    assert(symtable_get_symbol(tbl, TYPE, &tmp) == 1);
+    assert(token_equal(&tmp, &a));
+    symtable_add_symbol(tbl, TYPE, &b);
+    assert(symtable_contains(tbl, TYPE, &a) == 0);
+    assert(symtable_contains(tbl, TYPE, &b) == 1);
+    assert(symtable_contains(tbl, VAR, &b) == 1);
+
+    symtable_add_symbol(tbl, FAR, &a);
+    assert(symtable_contains(tbl, FAR, &a) == 1);
+
+    symtable_rollback(tbl, saved);
+    assert(symtable_has_symbol(tbl, FAR) == 0);
+    assert(symtable_has_symbol(tbl, TYPE) == 1);
+    assert(symtable_contains(tbl, TYPE, &a) == 1);
+    assert(symtable_contains(tbl, TYPE, &b) == 0);
+    assert(symtable_get_symbol(tbl, TYPE, &tmp) == 1);
+    assert(token_equal(&tmp, &a));
+    symtable_dispose(tbl);
+    (void)&tmp; // avoid 'unused variable'
+}
+
+static void test_many_symbols()
+{
+    static char buf[1024][16];
+    token_t t;
+    int i;
+    long saved;
+    symtable_t *tbl = symtable_init();
+
+    for (i = 0; i < 1024; i++) {
+        snprintf(buf[i], 16, "s%d", i);
+    }
+    for (i = 0; i < 512; i++) {
+        t = mktoken(buf[i]);
+        symtable_add_symbol(tbl, TYPE, &t);
+    }
+    saved = symtable_savepoint(tbl);
+    for (i = 512; i < 1024; i++) {
+        t = mktoken(buf[i]);
+        symtable_add_symbol(tbl, TYPE, &t);
+    }
+    for (i = 0; i < 1024; i++) {
+        t = mktoken(buf[i]);
+        assert(symtable_contains(tbl, TYPE, &t) == 1);
+        assert(symtable_contains(tbl, VAR, &t) == 0);
+    }
+    symtable_rollback(tbl, saved);
+    for (i = 0; i < 1024; i++) {
+        t = mktoken(buf[i]);
+        assert(symtable_contains(tbl, TYPE, &t) == (i < 512));
+    }
+    symtable_dispose(tbl);
+}
+
+static void test_token_bounds()
+{
+    unsigned len, i;
+    for (len = 0; len < 40; len++) {
+        // tokens end exactly at the end of their buffers
+        char *s1 = (char *)malloc(len + 1) + 1;
+        char *s2 = (char *)malloc(len + 1) + 1;
+        token_t t1, t2;
+        for (i = 0; i < len; i++) {
+            s1[i] = s2[i] = 'a' + i % 26;
+        }
+        token_init(&t1, s1, s1 + len);
+        token_init(&t2, s2, s2 + len);
+        assert(token_equal(&t1, &t2));
+        assert(token_hash(s1, len) == token_hash(s2, len));
+        for (i = 0; i < len; i++) {
+            s2[i] = '_';
+            assert(!token_equal(&t1, &t2));
+            assert(!token_equal_string(&t1, s2));
+            s2[i] = s1[i];
+        }
+        free(s1 - 1);
+        free(s2 - 1);
+    }
+}
+
+static void test_reset_keeps_capacity()
+{
+    static char buf[256][16];
+    token_t t;
+    int i;
+    unsigned capacity;
+    symtable_t *tbl = symtable_init();
+
+    symtable_reserve(tbl, 200, 4);
+    capacity = tbl->table.capacity;
+    assert(capacity >= 200);
+    for (i = 0; i < 200; i++) {
+        snprintf(buf[i], 16, "s%d", i);
+        t = mktoken(buf[i]);
+        symtable_add_symbol(tbl, i % 2 ? VAR : FAR, &t);
+    }
+    assert(tbl->table.capacity == capacity);
+    symtable_reset(tbl);
+    assert(symtable_savepoint(tbl) == 0);
+    assert(tbl->table.capacity == capacity);
+    for (i = 0; i < 200; i++) {
+        t = mktoken(buf[i]);
+        assert(symtable_contains(tbl, VAR, &t) == 0);
+        assert(symtable_contains(tbl, FAR, &t) == 0);
+    }
+    t = mktoken(buf[0]);
+    symtable_add_symbol(tbl, VAR, &t);
+    assert(symtable_contains(tbl, VAR, &t) == 1);
+    assert(symtable_has_symbol(tbl, FAR) == 0);
+    symtable_dispose(tbl);
+    (void)&capacity;
+}
 
 int main(int argc, char const* argv[])
 {
     token_t tmp = {};
     symtable_t *tbl = symtable_init();
-    assert(symtable_has_symbol(tbl, "NULL") == 0);
-    assert(symtable_get_symbol(tbl, "NULL", &tmp) == 0);
+    assert(symtable_has_symbol(tbl, 0) == 0);
+    assert(symtable_get_symbol(tbl, 0, &tmp) == 0);
     symtable_dispose(tbl);
+    test_mask_and_rollback();
+    test_many_symbols();
+    test_token_bounds();
+    test_reset_keeps_capacity();
     return 0;
     (void)&tmp; // avoid 'unused variable'
 }
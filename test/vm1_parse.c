@@ -0,0 +1,37 @@
+#include "loader.h"
+#include <string.h>
+
+/* Runs .moz bytecode on input with vm1 for test_compiler, which cannot
+ * include loader.h: vm1/instruction.h and expression.h both define Byte,
+ * Any, Str, ... Returns the length of the parsed node, -1 on failure or -2
+ * if the node is not tagged with tag. */
+int vm1_parse_tag(const uint8_t *code, unsigned size, const char *input, const char *tag)
+{
+    mozvm_loader_t L;
+    moz_inst_t *inst;
+    Node *node;
+    int len = -1;
+
+    memset(&L, 0, sizeof(L));
+    mozvm_loader_load_input_text(&L, input, strlen(input));
+    inst = mozvm_loader_load_syntax(&L, code, size, 1);
+    if (inst == NULL) {
+        mozvm_loader_dispose(&L);
+        return -1;
+    }
+    moz_runtime_set_source(L.R, L.input, L.input + strlen(input));
+    inst = moz_runtime_parse_init(L.R, L.input, inst);
+    if (moz_runtime_parse(L.R, L.input, inst) == 0) {
+        node = ast_get_parsed_node(L.R->ast);
+        len = -2;
+        if (node != NULL) {
+            if (strcmp(node->tag, tag) == 0) {
+                len = node->len;
+            }
+            NODE_GC_RELEASE(node);
+        }
+    }
+    moz_runtime_dispose(L.R);
+    mozvm_loader_dispose(&L);
+    return len;
+}